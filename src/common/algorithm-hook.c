@@ -31,12 +31,18 @@
 #include <pulsecore/shared.h>
 #include <pulsecore/hashmap.h>
 #include <pulsecore/idxset.h>
-#include <pulsecore/aupdate.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/thread.h>
 
 #include "algorithm-hook.h"
+#include "pa-optimized.h"
+#include "worker-pool.h"
 
 #define ALGORITHM_API_IDENTIFIER "meego-algorithm-hook-1"
 
+/* Per-channel slots are run on at most this many additional cores */
+#define MAX_WORKERS 3
+
 struct meego_algorithm_hook_api {
     PA_REFCNT_DECLARE;
 
@@ -46,32 +52,67 @@ struct meego_algorithm_hook_api {
     /* List of algorithm hooks that were deleted while
      * still having connected hook slots. */
     PA_LLIST_HEAD(meego_algorithm_hook, dead_hooks);
+
+    /* Created when the first slot declares per-channel processing,
+     * NULL if there are no cores to spare. */
+    bool pool_checked;
+    meego_worker_pool *pool;
 };
 
+/* What firing needs to know of an enabled slot. */
+typedef struct slot_entry {
+    pa_hook_cb_t callback;
+    void *userdata;
+    meego_algorithm_hook_format format;
+    bool per_channel;
+} slot_entry;
+
+/* Immutable array of the enabled slots of a hook in priority order. Slot
+ * changes build a new snapshot and publish it with one pointer store, the
+ * snapshot it replaces is freed once no reader can be using it anymore. */
+typedef struct slot_snapshot {
+    unsigned n_entries;
+    struct slot_snapshot *next;     /* Next in retired or waiting list. */
+    slot_entry entries[];
+} slot_snapshot;
+
 struct meego_algorithm_hook {
     meego_algorithm_hook_api *api;
 
     char *name;             /* Name of the hook, used as identifier when connecting slots. */
     bool enabled;           /* Hook enabled state, if all slots are disabled, hook is disabled. */
+    bool multi_fragment;    /* All enabled slots accept buffers spanning several fragments. */
+    meego_algorithm_hook_format format; /* Format of the first enabled slot. */
+    bool fade_out;          /* Owner fades out processing when hook gets disabled. */
+    bool lingering;         /* Disabled, but last enabled slots still published for fade out. */
     bool dead;              /* Dead hooks are hooks that are removed, but had slots
                              * connected to them at that time. Removed at _unref() */
 
-    pa_aupdate *aupdate;
-    meego_algorithm_hook_slot *slots[2];
+    /* All connected slots, only accessed from main thread. */
+    PA_LLIST_HEAD(meego_algorithm_hook_slot, slots);
+
+    /* Published slot_snapshot, read when firing. */
+    pa_atomic_ptr_t snapshot;
+
+    /* Epoch based reclamation. Readers register in readers[epoch & 1] for
+     * the duration of one firing. Snapshots unpublished before the epoch
+     * is flipped can be freed once the readers of the old parity drain. */
+    pa_atomic_t epoch;
+    pa_atomic_t readers[2];
+    slot_snapshot *retired;         /* Unpublished, epoch not flipped yet. */
+    slot_snapshot *waiting;         /* Waiting for readers[waiting_parity] to drain. */
+    unsigned waiting_parity;
 
     /* Hooks are llist type, to be able to add to dead_hooks list. */
     PA_LLIST_FIELDS(meego_algorithm_hook);
 };
 
-/* Hook slots are stored twice for aupdate. To keep both lists identical and to be able
- * to work with correct list when doing operations to meego_algorithm_hook_slot pointer
- * (remember, caller might use slot from list that is currently not in use!) correct
- * slot is identified by id that is identical to both structs. */
 struct meego_algorithm_hook_slot {
     meego_algorithm_hook *hook;     /* Hook this slot is connected to. */
-    unsigned id;                    /* Slots are identified by order number, when doing enabled/free operations.
-                                     * This id changes if list changes. */
     bool enabled;                   /* Enabled state of slot, disabled slots aren't fired in _fire(). */
+    bool multi_fragment;            /* Slot callback can process several fragments in one call. */
+    bool per_channel;               /* Slot callback processes channels independently. */
+    meego_algorithm_hook_format format; /* Sample format slot callback accepts. */
     pa_hook_priority_t priority;    /* Slots are ordered in llist by rising priority value. */
     pa_hook_cb_t callback;          /* Slot callback */
     void *userdata;
@@ -118,62 +159,149 @@ meego_algorithm_hook_api *meego_algorithm_hook_api_ref(meego_algorithm_hook_api
     return a;
 }
 
-/* Must be called with write lock */
-static void slot_free(meego_algorithm_hook_slot **list, meego_algorithm_hook_slot *slot) {
-    pa_assert(slot);
-    pa_assert(slot->hook);
-    pa_assert(list);
+static void snapshot_list_free(slot_snapshot *s) {
+    slot_snapshot *next;
 
-    PA_LLIST_REMOVE(meego_algorithm_hook_slot, *list, slot);
-    pa_xfree(slot);
+    for (; s; s = next) {
+        next = s->next;
+        pa_xfree(s);
+    }
 }
 
-/* Must be called with write lock */
-static void reset_ids(meego_algorithm_hook_slot *list) {
-    meego_algorithm_hook_slot *slot;
-    unsigned i;
+/* Called from the thread firing the hook. Returns the parity to pass to read_end(). */
+static inline unsigned read_begin(meego_algorithm_hook *hook) {
+    unsigned p;
+
+    /* Register in the parity of the current epoch. If the epoch flipped
+     * in between, the writer may have checked the counter already. */
+    for (;;) {
+        p = (unsigned) pa_atomic_load(&hook->epoch) & 1;
+        pa_atomic_inc(&hook->readers[p]);
 
-    i = 0;
-    PA_LLIST_FOREACH(slot, list)
-        slot->id = i++;
+        if (((unsigned) pa_atomic_load(&hook->epoch) & 1) == p)
+            return p;
+
+        pa_atomic_dec(&hook->readers[p]);
+    }
 }
 
-/* Must be called with read or write lock */
-static meego_algorithm_hook_slot *find_slot(meego_algorithm_hook_slot *list, unsigned id) {
-    pa_assert(list);
+static inline void read_end(meego_algorithm_hook *hook, unsigned p) {
+    pa_atomic_dec(&hook->readers[p]);
+}
 
-    while (list) {
-        if (id == list->id)
-            break;
-        list = list->next;
+/* Main thread. Frees the snapshots no reader can be using anymore, never waits.
+ * Returns true if nothing is left to reclaim. */
+static bool reclaim(meego_algorithm_hook *hook) {
+    if (hook->waiting) {
+        if (pa_atomic_load(&hook->readers[hook->waiting_parity]) > 0)
+            return false;
+
+        snapshot_list_free(hook->waiting);
+        hook->waiting = NULL;
+    }
+
+    if (hook->retired) {
+        /* Readers registering after the flip load the snapshot that is
+         * published now, so only readers of the old parity may still
+         * hold a retired one. */
+        hook->waiting = hook->retired;
+        hook->retired = NULL;
+        hook->waiting_parity = (unsigned) pa_atomic_load(&hook->epoch) & 1;
+        pa_atomic_inc(&hook->epoch);
+
+        if (pa_atomic_load(&hook->readers[hook->waiting_parity]) > 0)
+            return false;
+
+        snapshot_list_free(hook->waiting);
+        hook->waiting = NULL;
     }
 
-    /* If list is now NULL it means slot with id wasn't in the list. It should be. */
-    pa_assert(list);
+    return true;
+}
+
+/* Main thread. Waits until no reader can be using an unpublished snapshot. */
+static void synchronize(meego_algorithm_hook *hook) {
+    while (!reclaim(hook))
+        pa_thread_yield();
+}
+
+/* Main thread. Publishes the enabled slots of the hook and updates hook state. */
+static void publish(meego_algorithm_hook *hook) {
+    meego_algorithm_hook_slot *s;
+    slot_snapshot *snapshot, *old;
+    bool hook_enabled = false;
+    bool hook_multi_fragment = true;
+    meego_algorithm_hook_format hook_format = MEEGO_ALGORITHM_HOOK_FORMAT_S16;
+    unsigned n = 0;
+
+    /* If any of the slots is enabled, hook is enabled.
+     * If all slots are disabled, hook is disabled.
+     * Hook accepts multi-fragment buffers only if all enabled slots do. */
+    PA_LLIST_FOREACH(s, hook->slots)
+        if (s->enabled) {
+            if (!hook_enabled)
+                hook_format = s->format;
+            hook_enabled = true;
+            if (!s->multi_fragment)
+                hook_multi_fragment = false;
+            n++;
+        }
+
+    /* Keep the slots that were enabled published, so that the owner has
+     * processed data to fade out from. Format and multi-fragment state
+     * stay as they are, they describe the published slots. */
+    if (hook->fade_out && hook->enabled && !hook_enabled) {
+        pa_log_debug("Hook %s state changes to disabled, fading out", hook->name);
+        hook->enabled = false;
+        hook->lingering = true;
+        reclaim(hook);
+        return;
+    }
+
+    hook->lingering = false;
+
+    snapshot = pa_xmalloc0(sizeof(slot_snapshot) + n * sizeof(slot_entry));
 
-    return list;
+    PA_LLIST_FOREACH(s, hook->slots)
+        if (s->enabled) {
+            snapshot->entries[snapshot->n_entries].callback = s->callback;
+            snapshot->entries[snapshot->n_entries].userdata = s->userdata;
+            snapshot->entries[snapshot->n_entries].format = s->format;
+            snapshot->entries[snapshot->n_entries].per_channel = s->per_channel;
+            snapshot->n_entries++;
+        }
+
+    old = pa_atomic_ptr_load(&hook->snapshot);
+    pa_atomic_ptr_store(&hook->snapshot, snapshot);
+
+    old->next = hook->retired;
+    hook->retired = old;
+
+    if (hook->enabled != hook_enabled)
+        pa_log_debug("Hook %s state changes to %s", hook->name, hook_enabled ? "enabled" : "disabled");
+    hook->enabled = hook_enabled;
+    hook->multi_fragment = hook_enabled && hook_multi_fragment;
+    hook->format = hook_format;
+
+    reclaim(hook);
 }
 
 static void algorithm_hook_free(meego_algorithm_hook *hook) {
     meego_algorithm_hook_slot *slot;
-    unsigned j;
 
     pa_assert(hook);
     pa_assert(hook->name);
 
-    j = pa_aupdate_write_begin(hook->aupdate);
-
-    while ((slot = hook->slots[j]))
-        slot_free(&hook->slots[j], slot);
-
-    j = pa_aupdate_write_swap(hook->aupdate);
-
-    while ((slot = hook->slots[j]))
-        slot_free(&hook->slots[j], slot);
+    while ((slot = hook->slots)) {
+        PA_LLIST_REMOVE(meego_algorithm_hook_slot, hook->slots, slot);
+        pa_xfree(slot);
+    }
 
-    pa_aupdate_write_end(hook->aupdate);
+    /* Hook is not fired anymore, nothing can be reading the snapshots. */
+    snapshot_list_free(hook->waiting);
+    snapshot_list_free(hook->retired);
+    pa_xfree(pa_atomic_ptr_load(&hook->snapshot));
 
-    pa_aupdate_free(hook->aupdate);
     pa_xfree(hook->name);
     pa_xfree(hook);
 }
@@ -197,6 +325,9 @@ void meego_algorithm_hook_api_unref(meego_algorithm_hook_api *a) {
         algorithm_hook_free(hook);
     }
 
+    if (a->pool)
+        meego_worker_pool_free(a->pool);
+
     pa_xfree(a);
 }
 
@@ -209,11 +340,19 @@ static meego_algorithm_hook* hook_new(meego_algorithm_hook_api *a, const char *n
     hook = pa_xnew0(meego_algorithm_hook, 1);
     hook->api = a;
     hook->name = pa_xstrdup(name);
-    hook->aupdate = pa_aupdate_new();
     hook->enabled = false;
+    hook->multi_fragment = false;
+    hook->format = MEEGO_ALGORITHM_HOOK_FORMAT_S16;
+    hook->fade_out = false;
+    hook->lingering = false;
     hook->dead = false;
-    PA_LLIST_HEAD_INIT(meego_algorithm_hook_slot, hook->slots[0]);
-    PA_LLIST_HEAD_INIT(meego_algorithm_hook_slot, hook->slots[1]);
+    PA_LLIST_HEAD_INIT(meego_algorithm_hook_slot, hook->slots);
+    pa_atomic_ptr_store(&hook->snapshot, pa_xnew0(slot_snapshot, 1));
+    pa_atomic_store(&hook->epoch, 0);
+    pa_atomic_store(&hook->readers[0], 0);
+    pa_atomic_store(&hook->readers[1], 0);
+    hook->retired = NULL;
+    hook->waiting = NULL;
     PA_LLIST_INIT(meego_algorithm_hook, hook);
 
     return hook;
@@ -238,9 +377,6 @@ meego_algorithm_hook *meego_algorithm_hook_init(meego_algorithm_hook_api *a, con
 }
 
 void meego_algorithm_hook_done(meego_algorithm_hook *hook) {
-    bool done = true;
-    unsigned j;
-
     pa_assert(hook);
     pa_assert(hook->name);
     pa_assert(hook->api);
@@ -249,53 +385,148 @@ void meego_algorithm_hook_done(meego_algorithm_hook *hook) {
     hook->dead = true;
     pa_hashmap_remove(hook->api->hooks, hook->name);
 
-    /* Check from both copies if there are still slots connected */
-
-    j = pa_aupdate_write_begin(hook->aupdate);
-
-    if (hook->slots[j])
-        done = false;
-
-    j = pa_aupdate_write_swap(hook->aupdate);
-
-    if (hook->slots[j])
-        done = false;
-
-    pa_aupdate_write_end(hook->aupdate);
-
     /* if there are still hook_slots connected to our hook
      * we cannot clean up the hook yet. we'll add this hook to
      * dead_hooks list and clean up when meego_algorithm_hook_api struct is
      * cleaned up in meego_algorithm_hook_api_unref. */
-    if (done)
+    if (!hook->slots)
         algorithm_hook_free(hook);
     else
         PA_LLIST_PREPEND(meego_algorithm_hook, hook->api->dead_hooks, hook);
 }
 
 pa_hook_result_t meego_algorithm_hook_fire(meego_algorithm_hook *hook, void *data) {
-    meego_algorithm_hook_slot *slot;
+    const slot_snapshot *snapshot;
+    pa_hook_result_t result = PA_HOOK_OK;
+    unsigned i, p;
+
+    pa_assert_fp(hook);
+    pa_assert_fp(!hook->dead);
+
+    p = read_begin(hook);
+    snapshot = pa_atomic_ptr_load(&hook->snapshot);
+
+    /* Snapshot has the enabled slots in priority order. */
+    for (i = 0; i < snapshot->n_entries; i++) {
+        if ((result = snapshot->entries[i].callback(hook->api->core, data, snapshot->entries[i].userdata)) != PA_HOOK_OK)
+            break;
+    }
+
+    read_end(hook, p);
+
+    return result;
+}
+
+static void convert_data(meego_algorithm_hook_data *data, meego_algorithm_hook_format from,
+                         meego_algorithm_hook_format to) {
+    pa_memchunk converted;
+    unsigned i;
+
+    pa_assert_fp(data);
+    pa_assert_fp(data->channels <= MEEGO_ALGORITHM_HOOK_CHANNELS_MAX);
+
+    if (from == to)
+        return;
+
+    for (i = 0; i < data->channels; i++) {
+        if (to == MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32)
+            pa_optimized_s16_to_float(&data->channel[i], &converted);
+        else
+            pa_optimized_float_to_s16(&data->channel[i], &converted);
+
+        pa_memblock_unref(data->channel[i].memblock);
+        data->channel[i] = converted;
+    }
+}
+
+/* A run of consecutive per-channel slots, run for every channel as its own lane. */
+struct lane_job {
+    meego_algorithm_hook *hook;
+    const slot_entry *entries;
+    unsigned n_entries;
+    meego_algorithm_hook_data *data;
+    meego_algorithm_hook_format in_format;
+    meego_algorithm_hook_format out_format;
+    pa_atomic_t result;
+};
+
+/* Called from IO thread or worker thread context */
+static void lane_run(unsigned lane, void *userdata) {
+    struct lane_job *job = userdata;
+    meego_algorithm_hook_data view;
+    meego_algorithm_hook_format format = job->in_format;
+    pa_hook_result_t result;
+    unsigned i;
+
+    view.channels = 1;
+    view.channel[0] = job->data->channel[lane];
+
+    for (i = 0; i < job->n_entries; i++) {
+        convert_data(&view, format, job->entries[i].format);
+        format = job->entries[i].format;
+
+        if ((result = job->entries[i].callback(job->hook->api->core, &view, job->entries[i].userdata)) != PA_HOOK_OK) {
+            pa_atomic_store(&job->result, result);
+            break;
+        }
+    }
+
+    /* All channels need to end up in the same format */
+    convert_data(&view, format, job->out_format);
+
+    job->data->channel[lane] = view.channel[0];
+}
+
+pa_hook_result_t meego_algorithm_hook_fire_data(meego_algorithm_hook *hook, meego_algorithm_hook_data *data,
+                                                meego_algorithm_hook_format *format) {
+    const slot_snapshot *snapshot;
+    meego_worker_pool *pool;
+    struct lane_job job;
     pa_hook_result_t result = PA_HOOK_OK;
-    unsigned j;
+    unsigned i, j, p;
 
     pa_assert_fp(hook);
-    pa_assert_fp(hook->aupdate);
     pa_assert_fp(!hook->dead);
+    pa_assert_fp(data);
+    pa_assert_fp(format);
+
+    p = read_begin(hook);
+    snapshot = pa_atomic_ptr_load(&hook->snapshot);
+    pool = data->channels > 1 ? hook->api->pool : NULL;
+
+    for (i = 0; i < snapshot->n_entries; i = j) {
+        j = i + 1;
 
-    j = pa_aupdate_read_begin(hook->aupdate);
+        if (pool && snapshot->entries[i].per_channel) {
+            while (j < snapshot->n_entries && snapshot->entries[j].per_channel)
+                j++;
 
-    /* Go through algorithm hook slots in priority order and fire hook slot
-     * callback for enabled ones. */
-    PA_LLIST_FOREACH(slot, hook->slots[j]) {
+            job.hook = hook;
+            job.entries = &snapshot->entries[i];
+            job.n_entries = j - i;
+            job.data = data;
+            job.in_format = *format;
+            job.out_format = snapshot->entries[j - 1].format;
+            pa_atomic_store(&job.result, PA_HOOK_OK);
+
+            meego_worker_pool_run(pool, data->channels, lane_run, &job);
+
+            *format = job.out_format;
+
+            if ((result = pa_atomic_load(&job.result)) != PA_HOOK_OK)
+                break;
 
-        if (!slot->enabled)
             continue;
+        }
+
+        convert_data(data, *format, snapshot->entries[i].format);
+        *format = snapshot->entries[i].format;
 
-        if ((result = slot->callback(hook->api->core, data, slot->userdata)) != PA_HOOK_OK)
+        if ((result = snapshot->entries[i].callback(hook->api->core, data, snapshot->entries[i].userdata)) != PA_HOOK_OK)
             break;
     }
 
-    pa_aupdate_read_end(hook->aupdate);
+    read_end(hook, p);
 
     return result;
 }
@@ -308,17 +539,18 @@ static meego_algorithm_hook_slot *slot_new(meego_algorithm_hook *hook, pa_hook_p
 
     slot = pa_xnew0(meego_algorithm_hook_slot, 1);
     slot->hook = hook;
-    slot->id = 0;
     slot->priority = prio;
     slot->callback = cb;
     slot->userdata = data;
     slot->enabled = false;
+    slot->multi_fragment = false;
+    slot->per_channel = false;
+    slot->format = MEEGO_ALGORITHM_HOOK_FORMAT_S16;
     PA_LLIST_INIT(meego_algorithm_hook_slot, slot);
 
     return slot;
 }
 
-/* Must be called with write lock */
 static void list_add(meego_algorithm_hook_slot **list, meego_algorithm_hook_slot *slot) {
     meego_algorithm_hook_slot *prev, *where;
 
@@ -335,8 +567,7 @@ static void list_add(meego_algorithm_hook_slot **list, meego_algorithm_hook_slot
 
 meego_algorithm_hook_slot *meego_algorithm_hook_connect(meego_algorithm_hook_api *a, const char *name, pa_hook_priority_t prio, pa_hook_cb_t cb, void *data) {
     meego_algorithm_hook *hook;
-    meego_algorithm_hook_slot *slot, *slot2;
-    unsigned j;
+    meego_algorithm_hook_slot *slot;
 
     pa_assert(a);
     pa_assert(PA_REFCNT_VALUE(a) >= 1);
@@ -346,24 +577,11 @@ meego_algorithm_hook_slot *meego_algorithm_hook_connect(meego_algorithm_hook_api
     slot = NULL;
 
     if ((hook = pa_hashmap_get(a->hooks, name)) && !hook->dead) {
-
-        j = pa_aupdate_write_begin(hook->aupdate);
-
+        /* New slots are disabled, so there's nothing to publish yet. */
         slot = slot_new(hook, prio, cb, data);
-        list_add(&hook->slots[j], slot);
-        /* Recalculate slot ids after list order has changed. */
-        reset_ids(hook->slots[j]);
-
-        j = pa_aupdate_write_swap(hook->aupdate);
-
-        slot2 = slot_new(hook, prio, cb, data);
-        list_add(&hook->slots[j], slot2);
-        /* Recalculate slot ids after list order has changed. */
-        reset_ids(hook->slots[j]);
+        list_add(&hook->slots, slot);
 
-        pa_aupdate_write_end(hook->aupdate);
-
-        pa_log_debug("Connected hook slot %u to %s", slot->id, hook->name);
+        pa_log_debug("Connected hook slot %p to %s", (void *) slot, hook->name);
     } else
         pa_log_debug("No hook with name %s registered.", name);
 
@@ -372,84 +590,98 @@ meego_algorithm_hook_slot *meego_algorithm_hook_connect(meego_algorithm_hook_api
 
 void meego_algorithm_hook_slot_free(meego_algorithm_hook_slot *slot) {
     meego_algorithm_hook *hook;
-    unsigned id;
-    unsigned j;
 
     pa_assert(slot);
     pa_assert(slot->hook);
 
-    j = pa_aupdate_write_begin(slot->hook->aupdate);
-
     hook = slot->hook;
-    id = slot->id;
-
-    slot = find_slot(hook->slots[j], id);
-    slot_free(&hook->slots[j], slot);
-    /* Recalculate slot ids after list order has changed. */
-    reset_ids(hook->slots[j]);
 
-    pa_log_debug("Disconnect hook slot %u from %s", id, hook->name);
+    PA_LLIST_REMOVE(meego_algorithm_hook_slot, hook->slots, slot);
 
-    j = pa_aupdate_write_swap(hook->aupdate);
+    pa_log_debug("Disconnect hook slot %p from %s", (void *) slot, hook->name);
 
-    slot = find_slot(hook->slots[j], id);
-    slot_free(&hook->slots[j], slot);
-    /* Recalculate slot ids after list order has changed. */
-    reset_ids(hook->slots[j]);
+    if (slot->enabled || hook->lingering) {
+        publish(hook);
+        /* The slot owner may free userdata once we return, so wait for
+         * readers that may still call the callback. Those registered before
+         * the publish, so this lasts at most one firing. Disabled slots are
+         * not in any published snapshot, unless the hook lingers for fade
+         * out, and never wait. The slot itself is not read when firing. */
+        synchronize(hook);
+    }
 
-    pa_aupdate_write_end(hook->aupdate);
+    pa_xfree(slot);
 }
 
 void meego_algorithm_hook_slot_set_enabled(meego_algorithm_hook_slot *slot, bool enabled) {
-    meego_algorithm_hook_slot *s;
-    unsigned j;
-    bool hook_enabled = false;
-
     pa_assert(slot);
     pa_assert(slot->hook);
 
-    j = pa_aupdate_write_begin(slot->hook->aupdate);
+    if (slot->enabled == enabled)
+        return;
 
-    slot = find_slot(slot->hook->slots[j], slot->id);
     slot->enabled = enabled;
+    publish(slot->hook);
+}
 
-    /* If any of the slots is enabled, hook is enabled.
-     * If all slots are disabled, hook is disabled. */
-    PA_LLIST_FOREACH(s, slot->hook->slots[j])
-        if (s->enabled) {
-            hook_enabled = true;
-            break;
-        }
+void meego_algorithm_hook_slot_set_multi_fragment(meego_algorithm_hook_slot *slot, bool multi_fragment) {
+    pa_assert(slot);
+    pa_assert(slot->hook);
 
-    if (slot->hook->enabled != hook_enabled)
-        pa_log_debug("Hook %s state changes to %s", slot->hook->name, hook_enabled ? "enabled" : "disabled");
-    slot->hook->enabled = hook_enabled;
+    if (slot->multi_fragment == multi_fragment)
+        return;
 
-    /* Update copy as well */
-    j = pa_aupdate_write_swap(slot->hook->aupdate);
+    slot->multi_fragment = multi_fragment;
+    publish(slot->hook);
+}
 
-    slot = find_slot(slot->hook->slots[j], slot->id);
-    slot->enabled = enabled;
+void meego_algorithm_hook_slot_set_format(meego_algorithm_hook_slot *slot, meego_algorithm_hook_format format) {
+    pa_assert(slot);
+    pa_assert(slot->hook);
+
+    if (slot->format == format)
+        return;
 
-    pa_aupdate_write_end(slot->hook->aupdate);
+    slot->format = format;
+    publish(slot->hook);
 }
 
-bool meego_algorithm_hook_slot_enabled(meego_algorithm_hook_slot *slot) {
-    bool enabled;
-    unsigned j;
+void meego_algorithm_hook_slot_set_per_channel(meego_algorithm_hook_slot *slot, bool per_channel) {
+    meego_algorithm_hook_api *a;
+
+    pa_assert(slot);
+    pa_assert(slot->hook);
+
+    if (slot->per_channel == per_channel)
+        return;
+
+    a = slot->hook->api;
+
+    /* Pool is created before any snapshot refers to it. */
+    if (per_channel && !a->pool_checked) {
+        a->pool = meego_worker_pool_new(a->core, MAX_WORKERS);
+        a->pool_checked = true;
+    }
+
+    slot->per_channel = per_channel;
+    publish(slot->hook);
+}
 
+bool meego_algorithm_hook_slot_enabled(meego_algorithm_hook_slot *slot) {
     pa_assert(slot);
     pa_assert(slot->hook);
 
-    j = pa_aupdate_read_begin(slot->hook->aupdate);
+    return slot->enabled;
+}
 
-    /* Search and select active slot */
-    slot = find_slot(slot->hook->slots[j], slot->id);
-    enabled = slot->enabled;
+void meego_algorithm_hook_set_fade_out(meego_algorithm_hook *hook, bool fade_out) {
+    pa_assert(hook);
 
-    pa_aupdate_read_end(slot->hook->aupdate);
+    hook->fade_out = fade_out;
 
-    return enabled;
+    /* Stop lingering right away when fade out is not wanted anymore. */
+    if (!fade_out && hook->lingering)
+        publish(hook);
 }
 
 bool meego_algorithm_hook_enabled(meego_algorithm_hook *hook) {
@@ -457,3 +689,15 @@ bool meego_algorithm_hook_enabled(meego_algorithm_hook *hook) {
 
     return hook->enabled;
 }
+
+bool meego_algorithm_hook_multi_fragment(meego_algorithm_hook *hook) {
+    pa_assert(hook);
+
+    return hook->multi_fragment;
+}
+
+meego_algorithm_hook_format meego_algorithm_hook_input_format(meego_algorithm_hook *hook) {
+    pa_assert(hook);
+
+    return hook->format;
+}
@@ -64,6 +64,14 @@ struct meego_algorithm_hook_data {
     pa_memchunk channel[MEEGO_ALGORITHM_HOOK_CHANNELS_MAX];
 };
 
+/* Sample format of meego_algorithm_hook_data channels. S16 is native endian
+ * signed 16 bit, FLOAT32 is native endian float normalized to [-1.0, 1.0).
+ * In both cases every channel memchunk holds one channel (planar). */
+typedef enum meego_algorithm_hook_format {
+    MEEGO_ALGORITHM_HOOK_FORMAT_S16 = 0,
+    MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32
+} meego_algorithm_hook_format;
+
 
 /* Get pointer to opaque meego_algorithm_hook_api struct.
  * Unref after use. */
@@ -79,7 +87,8 @@ meego_algorithm_hook *meego_algorithm_hook_init(meego_algorithm_hook_api *a, con
 void meego_algorithm_hook_done(meego_algorithm_hook *hook);
 
 /* Fire hook for processing in algorithm hook implementors. It is guaranteed that all hook slots
- * that are connected to hook are in one enabled state for the duration of single hook firing. */
+ * that are connected to hook are in one enabled state for the duration of single hook firing.
+ * Firing never blocks, slot changes made meanwhile from main thread apply from the next firing. */
 pa_hook_result_t meego_algorithm_hook_fire(meego_algorithm_hook *hook, void *data);
 
 /* Connect to hook with name. Returns new meego_algorithm_hook_slot on success,
@@ -93,13 +102,20 @@ pa_hook_result_t meego_algorithm_hook_fire(meego_algorithm_hook *hook, void *dat
  * slot_data is pointer to userdata given in meego_algorithm_hook_connect().
  */
 meego_algorithm_hook_slot *meego_algorithm_hook_connect(meego_algorithm_hook_api *a, const char *name, pa_hook_priority_t prio, pa_hook_cb_t cb, void *userdata);
-/* Release hook slot */
+/* Release hook slot. Once this returns, the slot callback is not called anymore and
+ * userdata may be freed. If the slot may still be called, that is if it is enabled
+ * or the hook lingers for fade out, the main thread yields until hook firings that
+ * started before the call have returned, which takes at most one firing of the
+ * hook. Other slots never wait. */
 void meego_algorithm_hook_slot_free(meego_algorithm_hook_slot *slot);
 
 /* Set hook slot enabled state. This changes hook enabled state as well, so that
  * if at least one connected hook slot is enabled, hook is also enabled. If there
  * are no connected hook slots or all connected hook slots are disabled, hook is disabled.
- * Callbacks for hook slots that are disabled won't be called when firing the hook. */
+ * Callbacks for hook slots that are disabled won't be called when firing the hook,
+ * except during fade out, see meego_algorithm_hook_set_fade_out().
+ * Disabling never waits: a firing already in progress may still call the callback
+ * after this returns, so free the slot before freeing its userdata. */
 void meego_algorithm_hook_slot_set_enabled(meego_algorithm_hook_slot *slot, bool enabled);
 bool meego_algorithm_hook_slot_enabled(meego_algorithm_hook_slot *slot);
 
@@ -107,5 +123,50 @@ bool meego_algorithm_hook_slot_enabled(meego_algorithm_hook_slot *slot);
  * meego_algorithm_hook_fire() for data. */
 bool meego_algorithm_hook_enabled(meego_algorithm_hook *hook);
 
+/* Hook owners that fade processed audio out when the hook gets disabled may
+ * declare so with meego_algorithm_hook_set_fade_out(). When the last enabled
+ * slot of such a hook is disabled, the hook is disabled right away, but firing
+ * keeps calling the slots that were enabled until the next slot change, so
+ * that the owner has a processed render to fade from. Owners fire the hook
+ * only for the length of the fade while it is disabled. */
+void meego_algorithm_hook_set_fade_out(meego_algorithm_hook *hook, bool fade_out);
+
+/* Hook owners normally fire hooks with one processing fragment of data at a time.
+ * Slots that can process buffers spanning several fragments in one call may
+ * declare so with meego_algorithm_hook_slot_set_multi_fragment(), slots are
+ * single fragment by default. Hook owners that batch fragments should check
+ * meego_algorithm_hook_multi_fragment() and split the batch into fragments if
+ * any of the enabled slots didn't declare support. */
+void meego_algorithm_hook_slot_set_multi_fragment(meego_algorithm_hook_slot *slot, bool multi_fragment);
+bool meego_algorithm_hook_multi_fragment(meego_algorithm_hook *hook);
+
+/* Slots receive meego_algorithm_hook_data in S16 format by default. Slots that
+ * process float samples may declare MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32 with
+ * meego_algorithm_hook_slot_set_format(). Declared format only has effect when
+ * the hook is fired with meego_algorithm_hook_fire_data(). */
+void meego_algorithm_hook_slot_set_format(meego_algorithm_hook_slot *slot, meego_algorithm_hook_format format);
+
+/* Slots that process every channel of meego_algorithm_hook_data on its own, without
+ * looking at the other channels, may declare so with
+ * meego_algorithm_hook_slot_set_per_channel(). When the hook is fired with
+ * meego_algorithm_hook_fire_data() with more than one channel, consecutive enabled
+ * per-channel slots are run once per channel, with a one channel
+ * meego_algorithm_hook_data, and the channels are processed in parallel on a pool
+ * of worker threads on multi-core devices. The callback may be called concurrently
+ * from several threads, once for each channel. */
+void meego_algorithm_hook_slot_set_per_channel(meego_algorithm_hook_slot *slot, bool per_channel);
+
+/* Format accepted by the first enabled slot. Hook owners should convert to this
+ * format when taking data in, so that a chain of float slots is fed float data
+ * without S16 round-trips in between. */
+meego_algorithm_hook_format meego_algorithm_hook_input_format(meego_algorithm_hook *hook);
+
+/* Fire hook with meego_algorithm_hook_data in *format. Data is converted only
+ * where consecutive enabled slots declare different formats. On return *format
+ * is the format data is left in (format of the last slot that was called), hook
+ * owner converts back from that when writing data out. */
+pa_hook_result_t meego_algorithm_hook_fire_data(meego_algorithm_hook *hook, meego_algorithm_hook_data *data,
+                                                meego_algorithm_hook_format *format);
+
 
 #endif
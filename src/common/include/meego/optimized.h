@@ -48,4 +48,28 @@ void symmetric_mix(const short *src1, const short *src2, short *dst, const unsig
 void mix_in_with_volume(const short volume, const short *src, short *dst, const unsigned n);
 void apply_volume(const short volume, const short *src, short *dst, const unsigned n);
 
+/* Float samples are normalized to [-1.0, 1.0). Conversions back to 16 bits
+ * saturate. Lengths follow the 16 bit versions above, n is a multiple of 8
+ * (16 for the interleaved deinterleave input). */
+#define MEEGO_FLOAT_FROM_S16 (1.0f / 32768.0f)
+#define MEEGO_FLOAT_TO_S16 (32768.0f)
+
+void convert_s16_to_float(const short *src, float *dst, unsigned n);
+void convert_float_to_s16(const float *src, short *dst, unsigned n);
+void deinterleave_stereo_to_float(const short *src, float *dst[], unsigned n);
+void interleave_float_to_stereo(const float *src[], short *dst, unsigned n);
+
+/* Any number of channels, n is the length in frames and a multiple of 8.
+ * 1, 2, 4, 6 and 8 channels have vectorized paths. */
+void deinterleave_to_planar(const short *src, short *dst[], unsigned channels, unsigned n);
+void interleave_from_planar(const short *src[], short *dst, unsigned channels, unsigned n);
+void deinterleave_to_planar_float(const short *src, float *dst[], unsigned channels, unsigned n);
+void interleave_from_planar_float(const float *src[], short *dst, unsigned channels, unsigned n);
+
+/* Linear crossfade of n interleaved frames from from to to, position and
+ * length in frames define where in the fade the first frame is. dst may be
+ * the same as to. */
+void crossfade_interleaved(const short *from, const short *to, short *dst,
+                           unsigned channels, unsigned n, unsigned position, unsigned length);
+
 #endif
@@ -39,4 +39,21 @@ int pa_optimized_mono_to_stereo(const pa_memchunk *ichunk, pa_memchunk *ochunk);
 int pa_optimized_interleave_stereo(const pa_memchunk *ichunk1, const pa_memchunk *ichunk2, pa_memchunk *ochunk);
 int pa_optimized_deinterleave_stereo_to_mono(const pa_memchunk *ichunk, pa_memchunk *ochunk1, pa_memchunk *ochunk2);
 
+/* Float32 planar variants, see optimized.h for sample scaling. */
+int pa_optimized_s16_to_float(const pa_memchunk *ichunk, pa_memchunk *ochunk);
+int pa_optimized_float_to_s16(const pa_memchunk *ichunk, pa_memchunk *ochunk);
+int pa_optimized_deinterleave_stereo_to_float(const pa_memchunk *ichunk, pa_memchunk *ochunk1, pa_memchunk *ochunk2);
+int pa_optimized_interleave_stereo_from_float(const pa_memchunk *ichunk1, const pa_memchunk *ichunk2, pa_memchunk *ochunk);
+
+/* N-channel variants, ochunk/ichunk arrays hold one memchunk per channel. */
+int pa_optimized_deinterleave(const pa_memchunk *ichunk, pa_memchunk ochunk[], unsigned channels);
+int pa_optimized_interleave(const pa_memchunk ichunk[], pa_memchunk *ochunk, unsigned channels);
+int pa_optimized_deinterleave_to_float(const pa_memchunk *ichunk, pa_memchunk ochunk[], unsigned channels);
+int pa_optimized_interleave_from_float(const pa_memchunk ichunk[], pa_memchunk *ochunk, unsigned channels);
+
+/* Crossfade writable interleaved S16 chunk in place from a chunk of the same
+ * length. See crossfade_interleaved(). */
+int pa_optimized_crossfade(const pa_memchunk *from, pa_memchunk *chunk,
+                           unsigned channels, unsigned position, unsigned length);
+
 #endif /* pa_optimized_h */
@@ -61,13 +61,41 @@ typedef enum meego_parameter_status {
  *      This status is also always set if only mode changes
  *      are requested. In that case parameters is NULL and length 0.
  *
+ * delta
+ *      For listeners connected with meego_parameter_request_delta_updates().
+ *      With status MEEGO_PARAM_UPDATE, if not NULL, describes how parameters
+ *      differ from the parameters of the previous update. Otherwise NULL.
+ *      Other listeners of the same algorithm may see it too and should
+ *      ignore it.
+ *
  * Hook callback should always return PA_HOOK_OK.
  */
+
+/*
+ * Bytes [offset, offset + length) of the new parameters differ from the
+ * previous parameters.
+ */
+typedef struct meego_parameter_delta_range {
+    unsigned offset;
+    unsigned length;
+} meego_parameter_delta_range;
+
+/*
+ * The previous parameters had the same length as the new ones, and all
+ * bytes outside ranges are unchanged. Ranges are in ascending order and
+ * don't overlap. Zero ranges means the parameters didn't change at all.
+ */
+typedef struct meego_parameter_delta {
+    unsigned n_ranges;
+    const meego_parameter_delta_range *ranges;
+} meego_parameter_delta;
+
 typedef struct meego_parameter_update_args {
     const char *mode;
     meego_parameter_status_t status;
     const void *parameters;
     unsigned length;
+    const meego_parameter_delta *delta;
 } meego_parameter_update_args;
 
 /*
@@ -78,6 +106,20 @@ typedef struct meego_parameter_update_args {
  */
 int meego_parameter_request_updates(const char *name, pa_hook_cb_t cb, pa_hook_priority_t prio, bool full_updates, void *userdata);
 
+/*
+ * As meego_parameter_request_updates(), but updates may also carry a delta
+ * against the previous update. Listeners can use it to update only the
+ * changed parts of their state. Stop with meego_parameter_stop_updates().
+ */
+int meego_parameter_request_delta_updates(const char *name, pa_hook_cb_t cb, pa_hook_priority_t prio, bool full_updates, void *userdata);
+
+/*
+ * Copies the changed ranges of an update carrying a delta over dst, which
+ * holds a copy of the previous parameters. Returns -1 if the update has no
+ * delta or dst is of wrong size, in which case dst is not touched.
+ */
+int meego_parameter_apply_delta(void *dst, unsigned length, const meego_parameter_update_args *ua);
+
 /*
  * Stop calling the given callback "cb" with "userdata" for the algorithm
  * called "name". Every call to meego_parameter_request_updates must have a
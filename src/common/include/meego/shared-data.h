@@ -73,6 +73,44 @@ int pa_shared_data_getd(pa_shared_data *t, const char *key, const void **data, s
  * slot_data    - void *userdata
  */
 pa_hook_slot *pa_shared_data_connect(pa_shared_data *t, const char *key, pa_hook_cb_t callback, void *userdata);
+/* Like pa_shared_data_connect(), but the callback is called from a deferred event, at most once
+ * per main loop iteration no matter how many times the item changed in between. */
+pa_hook_slot *pa_shared_data_connect_deferred(pa_shared_data *t, const char *key, pa_hook_cb_t callback, void *userdata);
 void pa_shared_data_hook_slot_free(pa_hook_slot *slot);
 
+/* Transactions. Changes made between begin and commit are notified once per item, when the
+ * outermost transaction is committed, and subscribers only see the final values. Transactions
+ * may be nested. Getters return the new values immediately. */
+void pa_shared_data_begin(pa_shared_data *t);
+void pa_shared_data_commit(pa_shared_data *t);
+
+/* Key handles.
+ *
+ * A key handle refers to a shared item without looking the key up again on
+ * every access. Registering the same key twice returns the same handle, and
+ * the handle stays valid as long as the caller holds its shared data
+ * reference. The functions behave like their string key counterparts above.
+ *
+ * pa_shared_data_key_get_boolean() and pa_shared_data_key_get_integer() don't
+ * take locks and may also be called from IO threads. All other functions
+ * must be called from main thread. */
+typedef struct pa_shared_data_key pa_shared_data_key;
+
+/* Returns NULL if key is invalid. */
+pa_shared_data_key *pa_shared_data_key_register(pa_shared_data *t, const char *key);
+const char *pa_shared_data_key_name(const pa_shared_data_key *k);
+
+int pa_shared_data_key_set_boolean(pa_shared_data_key *k, bool value);
+bool pa_shared_data_key_get_boolean(const pa_shared_data_key *k);
+int pa_shared_data_key_set_integer(pa_shared_data_key *k, int32_t value);
+int pa_shared_data_key_get_integer(const pa_shared_data_key *k, int32_t *return_value);
+int pa_shared_data_key_inc_integer(pa_shared_data_key *k, int32_t change);
+int pa_shared_data_key_sets(pa_shared_data_key *k, const char *value);
+int pa_shared_data_key_sets_always(pa_shared_data_key *k, const char *value);
+const char *pa_shared_data_key_gets(const pa_shared_data_key *k);
+
+/* Hook call data is the key name, as with pa_shared_data_connect(). */
+pa_hook_slot *pa_shared_data_key_connect(pa_shared_data_key *k, pa_hook_cb_t callback, void *userdata);
+pa_hook_slot *pa_shared_data_key_connect_deferred(pa_shared_data_key *k, pa_hook_cb_t callback, void *userdata);
+
 #endif
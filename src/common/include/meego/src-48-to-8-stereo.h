@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef __SRC_48_TO_8_STEREO_H__
+#define __SRC_48_TO_8_STEREO_H__
+
+/* 48kHz interleaved stereo to 8kHz mono resampler that picks or mixes the
+ * channels while filtering, so no 48kHz mono intermediate is needed. Uses
+ * the same two stage polyphase filter as src_48_to_8 and gives identical
+ * output to extracting the channel first and running process_src_48_to_8().
+ *
+ * One src_48_to_8_stereo holds filter state for one output stream. Input
+ * frame count must be a multiple of 6 and at most
+ * SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES. Functions return number of output
+ * frames, or -1 on bad input frame count. */
+
+#define SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES 960
+
+typedef enum src_48_to_8_stereo_mode {
+    SRC_48_TO_8_STEREO_CH0,         /* left channel */
+    SRC_48_TO_8_STEREO_CH1,         /* right channel */
+    SRC_48_TO_8_STEREO_DOWNMIX      /* saturated sum of both channels */
+} src_48_to_8_stereo_mode;
+
+struct src_48_to_8_stereo;
+typedef struct src_48_to_8_stereo src_48_to_8_stereo;
+
+src_48_to_8_stereo *alloc_src_48_to_8_stereo(void);
+
+void free_src_48_to_8_stereo(src_48_to_8_stereo *src);
+
+/* Resample one channel (or downmix) of interleaved stereo input. */
+int process_src_48_to_8_stereo_select(src_48_to_8_stereo *src, short *output, const short *input, int input_frames,
+                                      src_48_to_8_stereo_mode mode);
+
+/* Resample both channels of interleaved stereo input. mic_channel (0 or 1) goes
+ * through mic_src to mic_output, the other channel through amb_src to amb_output. */
+int process_src_48_to_8_stereo_split(src_48_to_8_stereo *mic_src, src_48_to_8_stereo *amb_src,
+                                     short *mic_output, short *amb_output,
+                                     const short *input, int input_frames, int mic_channel);
+
+/* Resample 48kHz mono input. For data that needs processing before resampling,
+ * keeps filter state continuous with the stereo variants. */
+int process_src_48_to_8_stereo_mono(src_48_to_8_stereo *src, short *output, const short *input, int input_frames);
+
+#endif /* __SRC_48_TO_8_STEREO_H__ */
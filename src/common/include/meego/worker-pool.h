@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef _worker_pool_h_
+#define _worker_pool_h_
+
+/* Pool of real-time worker threads for running independent lanes of work,
+ * for example the channels of meego_algorithm_hook_data, in parallel.
+ *
+ * The pool is created and freed from main thread. Running lanes is done from
+ * IO thread context and does no allocation: lanes are handed to workers
+ * through per-worker mailboxes, and a lane a worker hasn't picked up by the
+ * time the calling thread has run its own share is taken back and run by the
+ * calling thread. Only one thread at a time gets the workers, a concurrent
+ * caller runs all of its lanes itself.
+ *
+ * A lane a worker has started can't be taken back, so running may wait for
+ * it. The calling thread spins until a deadline derived from the time its own
+ * share took, then sleeps until the worker is done. A missed deadline is
+ * logged and the next runs are done by the calling thread alone, without the
+ * workers. */
+
+#include <pulsecore/core.h>
+
+typedef struct meego_worker_pool meego_worker_pool;
+
+/* Called for every lane, from calling thread or a worker thread. */
+typedef void (*meego_worker_lane_cb_t)(unsigned lane, void *userdata);
+
+/* Creates one worker per CPU the daemon may run on, leaving one for the calling
+ * thread, but at most max_workers. Workers are not pinned, they keep the CPU affinity
+ * of the daemon, and are made SCHED_FIFO if the core uses realtime scheduling.
+ * Returns NULL if there are no CPUs to spare or threads can't be created. */
+meego_worker_pool *meego_worker_pool_new(pa_core *core, unsigned max_workers);
+void meego_worker_pool_free(meego_worker_pool *p);
+
+unsigned meego_worker_pool_size(meego_worker_pool *p);
+
+/* Runs cb for lanes 0 .. n_lanes - 1 and returns once all lanes are done. May sleep
+ * for a worker that missed its deadline, see above. */
+void meego_worker_pool_run(meego_worker_pool *p, unsigned n_lanes, meego_worker_lane_cb_t cb, void *userdata);
+
+#endif
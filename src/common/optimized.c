@@ -23,6 +23,8 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "optimized.h"
 
 #ifdef __ARM_NEON__
@@ -31,6 +33,7 @@
 #define OPTIMIZE_MOVE
 #define OPTIMIZE_INTERLEAVE
 #define OPTIMIZE_MIX
+#define OPTIMIZE_FLOAT
 #else
 
 /* Get rid of PA dependecy */
@@ -44,6 +47,16 @@
 
 #endif
 
+static inline short float_sample_to_s16(float sample)
+{
+    sample *= MEEGO_FLOAT_TO_S16;
+    if (sample >= 32767.0f)
+        return 32767;
+    if (sample <= -32768.0f)
+        return -32768;
+    return (short) sample;
+}
+
 #ifdef OPTIMIZE_MOVE
 
 void move_16bit_to_32bit(int32_t *dst, const short *src, unsigned n)
@@ -240,6 +253,76 @@ void apply_volume(const short volume, const short *src, short *dst, const unsign
 }
 
 
+#endif
+
+#ifdef OPTIMIZE_FLOAT
+
+void convert_s16_to_float(const short *src, float *dst, unsigned n)
+{
+    unsigned i;
+    int16x8_t input;
+    float32x4_t low;
+    float32x4_t high;
+
+    for (i = 0; i < n; i += 8) {
+        input = vld1q_s16(src + i);
+        low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(input)));
+        high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(input)));
+        vst1q_f32(dst + i, vmulq_n_f32(low, MEEGO_FLOAT_FROM_S16));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(high, MEEGO_FLOAT_FROM_S16));
+    }
+}
+
+/* vcvtq_s32_f32 saturates and vqmovn_s32 clamps to 16 bits, so
+ * out of range float samples clip instead of wrapping. */
+static inline int16x4_t float_to_s16_quad(float32x4_t input)
+{
+    return vqmovn_s32(vcvtq_s32_f32(vmulq_n_f32(input, MEEGO_FLOAT_TO_S16)));
+}
+
+void convert_float_to_s16(const float *src, short *dst, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i += 8) {
+        vst1q_s16(dst + i, vcombine_s16(float_to_s16_quad(vld1q_f32(src + i)),
+                                        float_to_s16_quad(vld1q_f32(src + i + 4))));
+    }
+}
+
+void deinterleave_stereo_to_float(const short *src, float *dst[], unsigned n)
+{
+    unsigned i;
+    float *channel_1 = dst[0];
+    float *channel_2 = dst[1];
+    int16x8x2_t input;
+
+    for (i = 0; i < n; i += 16) {
+        input = vld2q_s16(src + i);
+        vst1q_f32(channel_1,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(input.val[0]))), MEEGO_FLOAT_FROM_S16));
+        vst1q_f32(channel_1 + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(input.val[0]))), MEEGO_FLOAT_FROM_S16));
+        vst1q_f32(channel_2,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(input.val[1]))), MEEGO_FLOAT_FROM_S16));
+        vst1q_f32(channel_2 + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(input.val[1]))), MEEGO_FLOAT_FROM_S16));
+        channel_1 += 8;
+        channel_2 += 8;
+    }
+}
+
+void interleave_float_to_stereo(const float *src[], short *dst, unsigned n)
+{
+    unsigned i;
+    int16x8x2_t output;
+
+    for (i = 0; i < n; i += 8) {
+        output.val[0] = vcombine_s16(float_to_s16_quad(vld1q_f32(src[0] + i)),
+                                     float_to_s16_quad(vld1q_f32(src[0] + i + 4)));
+        output.val[1] = vcombine_s16(float_to_s16_quad(vld1q_f32(src[1] + i)),
+                                     float_to_s16_quad(vld1q_f32(src[1] + i + 4)));
+        vst2q_s16(dst, output);
+        dst += 16;
+    }
+}
+
 #endif
 
 #ifndef OPTIMIZE_MOVE
@@ -409,3 +492,276 @@ void apply_volume(const short volume, const short *src, short *dst, const unsign
 }
 
 #endif
+
+
+#ifndef OPTIMIZE_FLOAT
+
+void convert_s16_to_float(const short *src, float *dst, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = src[i] * MEEGO_FLOAT_FROM_S16;
+}
+
+void convert_float_to_s16(const float *src, short *dst, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        dst[i] = float_sample_to_s16(src[i]);
+}
+
+void deinterleave_stereo_to_float(const short *src, float *dst[], unsigned n)
+{
+    unsigned i;
+    float *channel_1 = dst[0];
+    float *channel_2 = dst[1];
+
+    for (i = 0; i < n; i += 2) {
+        *channel_1++ = src[i] * MEEGO_FLOAT_FROM_S16;
+        *channel_2++ = src[i + 1] * MEEGO_FLOAT_FROM_S16;
+    }
+}
+
+void interleave_float_to_stereo(const float *src[], short *dst, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        *dst++ = float_sample_to_s16(src[0][i]);
+        *dst++ = float_sample_to_s16(src[1][i]);
+    }
+}
+
+#endif
+
+#ifdef OPTIMIZE_INTERLEAVE
+
+/* Four channel frames are handled eight at a time with vld4q/vst4q. */
+static void deinterleave_4ch(const short *src, short *dst[], unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x4_t input;
+
+    for (i = 0; i < n; i += 8) {
+        input = vld4q_s16(src + 4 * i);
+        for (c = 0; c < 4; c++)
+            vst1q_s16(dst[c] + i, input.val[c]);
+    }
+}
+
+static void interleave_4ch(const short *src[], short *dst, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x4_t output;
+
+    for (i = 0; i < n; i += 8) {
+        for (c = 0; c < 4; c++)
+            output.val[c] = vld1q_s16(src[c] + i);
+        vst4q_s16(dst + 4 * i, output);
+    }
+}
+
+/* With six channels vld3q splits four frames into channel pairs (c, c + 3),
+ * unzipping two such loads gives eight frames of each channel. */
+static void deinterleave_6ch(const short *src, short *dst[], unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x3_t first;
+    int16x8x3_t second;
+    int16x8x2_t pair;
+
+    for (i = 0; i < n; i += 8) {
+        first = vld3q_s16(src + 6 * i);
+        second = vld3q_s16(src + 6 * i + 24);
+        for (c = 0; c < 3; c++) {
+            pair = vuzpq_s16(first.val[c], second.val[c]);
+            vst1q_s16(dst[c] + i, pair.val[0]);
+            vst1q_s16(dst[c + 3] + i, pair.val[1]);
+        }
+    }
+}
+
+static void interleave_6ch(const short *src[], short *dst, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x3_t first;
+    int16x8x3_t second;
+    int16x8x2_t pair;
+
+    for (i = 0; i < n; i += 8) {
+        for (c = 0; c < 3; c++) {
+            pair = vzipq_s16(vld1q_s16(src[c] + i), vld1q_s16(src[c + 3] + i));
+            first.val[c] = pair.val[0];
+            second.val[c] = pair.val[1];
+        }
+        vst3q_s16(dst + 6 * i, first);
+        vst3q_s16(dst + 6 * i + 24, second);
+    }
+}
+
+/* Same as six channels, vld4q gives channel pairs (c, c + 4). */
+static void deinterleave_8ch(const short *src, short *dst[], unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x4_t first;
+    int16x8x4_t second;
+    int16x8x2_t pair;
+
+    for (i = 0; i < n; i += 8) {
+        first = vld4q_s16(src + 8 * i);
+        second = vld4q_s16(src + 8 * i + 32);
+        for (c = 0; c < 4; c++) {
+            pair = vuzpq_s16(first.val[c], second.val[c]);
+            vst1q_s16(dst[c] + i, pair.val[0]);
+            vst1q_s16(dst[c + 4] + i, pair.val[1]);
+        }
+    }
+}
+
+static void interleave_8ch(const short *src[], short *dst, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+    int16x8x4_t first;
+    int16x8x4_t second;
+    int16x8x2_t pair;
+
+    for (i = 0; i < n; i += 8) {
+        for (c = 0; c < 4; c++) {
+            pair = vzipq_s16(vld1q_s16(src[c] + i), vld1q_s16(src[c + 4] + i));
+            first.val[c] = pair.val[0];
+            second.val[c] = pair.val[1];
+        }
+        vst4q_s16(dst + 8 * i, first);
+        vst4q_s16(dst + 8 * i + 32, second);
+    }
+}
+
+#endif
+
+static void deinterleave_generic(const short *src, short *dst[], unsigned channels, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++)
+            dst[c][i] = *src++;
+}
+
+static void interleave_generic(const short *src[], short *dst, unsigned channels, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++)
+            *dst++ = src[c][i];
+}
+
+void deinterleave_to_planar(const short *src, short *dst[], unsigned channels, unsigned n)
+{
+    switch (channels) {
+        case 1:
+            memcpy(dst[0], src, n * sizeof(short));
+            break;
+        case 2:
+            deinterleave_stereo_to_mono(src, dst, 2 * n);
+            break;
+#ifdef OPTIMIZE_INTERLEAVE
+        case 4:
+            deinterleave_4ch(src, dst, n);
+            break;
+        case 6:
+            deinterleave_6ch(src, dst, n);
+            break;
+        case 8:
+            deinterleave_8ch(src, dst, n);
+            break;
+#endif
+        default:
+            deinterleave_generic(src, dst, channels, n);
+            break;
+    }
+}
+
+void interleave_from_planar(const short *src[], short *dst, unsigned channels, unsigned n)
+{
+    switch (channels) {
+        case 1:
+            memcpy(dst, src[0], n * sizeof(short));
+            break;
+        case 2:
+            interleave_mono_to_stereo(src, dst, n);
+            break;
+#ifdef OPTIMIZE_INTERLEAVE
+        case 4:
+            interleave_4ch(src, dst, n);
+            break;
+        case 6:
+            interleave_6ch(src, dst, n);
+            break;
+        case 8:
+            interleave_8ch(src, dst, n);
+            break;
+#endif
+        default:
+            interleave_generic(src, dst, channels, n);
+            break;
+    }
+}
+
+void deinterleave_to_planar_float(const short *src, float *dst[], unsigned channels, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+
+    if (channels == 2) {
+        deinterleave_stereo_to_float(src, dst, 2 * n);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++)
+            dst[c][i] = *src++ * MEEGO_FLOAT_FROM_S16;
+}
+
+void interleave_from_planar_float(const float *src[], short *dst, unsigned channels, unsigned n)
+{
+    unsigned i;
+    unsigned c;
+
+    if (channels == 2) {
+        interleave_float_to_stereo(src, dst, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        for (c = 0; c < channels; c++)
+            *dst++ = float_sample_to_s16(src[c][i]);
+}
+
+void crossfade_interleaved(const short *from, const short *to, short *dst,
+                           unsigned channels, unsigned n, unsigned position, unsigned length)
+{
+    unsigned i;
+    unsigned c;
+    int gain;
+
+    for (i = 0; i < n; i++, position++) {
+        /* Q15 weight of to, from gets the rest */
+        gain = position < length ? (int) (((uint64_t) position << 15) / length) : 1 << 15;
+        for (c = 0; c < channels; c++)
+            dst[c] = (short) ((from[c] * ((1 << 15) - gain) + to[c] * gain) >> 15);
+        from += channels;
+        to += channels;
+        dst += channels;
+    }
+}
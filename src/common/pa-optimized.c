@@ -197,3 +197,211 @@ int pa_optimized_deinterleave_stereo_to_mono(const pa_memchunk *ichunk, pa_memch
 
     return 0;
 }
+
+static int convert_chunk(const pa_memchunk *ichunk, pa_memchunk *ochunk, size_t isample, size_t osample) {
+    pa_mempool *pool;
+    const uint8_t *input;
+    uint8_t *output;
+    unsigned n;
+
+    pa_assert_fp(ichunk);
+    pa_assert_fp(ochunk);
+    pa_assert_fp(ichunk->memblock);
+    pa_assert_fp(0 == (ichunk->length % (8*isample)));
+    pool = pa_memblock_get_pool(ichunk->memblock);
+
+    n = ichunk->length/isample;
+    ochunk->length = n*osample;
+    ochunk->index = 0;
+    ochunk->memblock = pa_memblock_new(pool, ochunk->length);
+    output = pa_memblock_acquire(ochunk->memblock);
+    input = (const uint8_t *) pa_memblock_acquire(ichunk->memblock) + ichunk->index;
+    if (isample == sizeof(short))
+        convert_s16_to_float((const short *) input, (float *) output, n);
+    else
+        convert_float_to_s16((const float *) input, (short *) output, n);
+    pa_memblock_release(ochunk->memblock);
+    pa_memblock_release(ichunk->memblock);
+
+    return 0;
+}
+
+int pa_optimized_s16_to_float(const pa_memchunk *ichunk, pa_memchunk *ochunk) {
+    return convert_chunk(ichunk, ochunk, sizeof(short), sizeof(float));
+}
+
+int pa_optimized_float_to_s16(const pa_memchunk *ichunk, pa_memchunk *ochunk) {
+    return convert_chunk(ichunk, ochunk, sizeof(float), sizeof(short));
+}
+
+int pa_optimized_deinterleave_stereo_to_float(const pa_memchunk *ichunk, pa_memchunk *ochunk1, pa_memchunk *ochunk2) {
+    pa_mempool *pool;
+    pa_assert_fp(ichunk);
+    pa_assert_fp(ochunk1);
+    pa_assert_fp(ochunk2);
+    pa_assert_fp(ichunk->memblock);
+    pa_assert_fp(0 == (ichunk->length % (8*sizeof(short))));
+    pool = pa_memblock_get_pool(ichunk->memblock);
+
+    ochunk1->length = ichunk->length;
+    ochunk1->index = 0;
+
+    ochunk2->length = ichunk->length;
+    ochunk2->index = 0;
+
+    ochunk1->memblock = pa_memblock_new(pool, ochunk1->length);
+    ochunk2->memblock = pa_memblock_new(pool, ochunk2->length);
+
+    float *output1 = (float *) pa_memblock_acquire(ochunk1->memblock);
+    float *output2 = (float *) pa_memblock_acquire(ochunk2->memblock);
+
+    /* set input pointer to correct position */
+    const short *input = ((short *)pa_memblock_acquire(ichunk->memblock) + ichunk->index/sizeof(short));
+
+    float *bufs[2] = { output1, output2 };
+    deinterleave_stereo_to_float(input, bufs, ichunk->length/sizeof(short));
+
+    pa_memblock_release(ichunk->memblock);
+    pa_memblock_release(ochunk1->memblock);
+    pa_memblock_release(ochunk2->memblock);
+
+    return 0;
+}
+
+int pa_optimized_interleave_stereo_from_float(const pa_memchunk *ichunk1, const pa_memchunk *ichunk2, pa_memchunk *ochunk) {
+    pa_mempool *pool;
+    pa_assert_fp(ochunk);
+    pa_assert_fp(ichunk1);
+    pa_assert_fp(ichunk2);
+    pa_assert_fp(ichunk1->memblock);
+    pa_assert_fp(ichunk2->memblock);
+    pa_assert_fp(0 == (ichunk1->length % (8*sizeof(float))));
+    pa_assert_fp(ichunk1->length == ichunk2->length);
+    pool = pa_memblock_get_pool(ichunk1->memblock);
+
+    ochunk->length = ichunk1->length;
+    ochunk->index = 0;
+    ochunk->memblock = pa_memblock_new(pool, ochunk->length);
+    short *output = (short *) pa_memblock_acquire(ochunk->memblock);
+    const float *input1 = ((float *)pa_memblock_acquire(ichunk1->memblock) + ichunk1->index/sizeof(float));
+    const float *input2 = ((float *)pa_memblock_acquire(ichunk2->memblock) + ichunk2->index/sizeof(float));
+    const float *bufs[2] = { input1, input2 };
+    interleave_float_to_stereo(bufs, output, ichunk1->length/sizeof(float));
+    pa_memblock_release(ochunk->memblock);
+    pa_memblock_release(ichunk1->memblock);
+    pa_memblock_release(ichunk2->memblock);
+
+    return 0;
+}
+
+static int deinterleave_chunk(const pa_memchunk *ichunk, pa_memchunk ochunk[], unsigned channels, size_t osample) {
+    pa_mempool *pool;
+    void *bufs[PA_CHANNELS_MAX];
+    const short *input;
+    unsigned frames;
+    unsigned c;
+
+    pa_assert_fp(ichunk);
+    pa_assert_fp(ochunk);
+    pa_assert_fp(ichunk->memblock);
+    pa_assert_fp(channels > 0 && channels <= PA_CHANNELS_MAX);
+    pa_assert_fp(0 == (ichunk->length % (8*channels*sizeof(short))));
+    pool = pa_memblock_get_pool(ichunk->memblock);
+
+    frames = ichunk->length/(channels*sizeof(short));
+
+    for (c = 0; c < channels; c++) {
+        ochunk[c].length = frames*osample;
+        ochunk[c].index = 0;
+        ochunk[c].memblock = pa_memblock_new(pool, ochunk[c].length);
+        bufs[c] = pa_memblock_acquire(ochunk[c].memblock);
+    }
+
+    input = ((short *)pa_memblock_acquire(ichunk->memblock) + ichunk->index/sizeof(short));
+    if (osample == sizeof(short))
+        deinterleave_to_planar(input, (short **) bufs, channels, frames);
+    else
+        deinterleave_to_planar_float(input, (float **) bufs, channels, frames);
+    pa_memblock_release(ichunk->memblock);
+
+    for (c = 0; c < channels; c++)
+        pa_memblock_release(ochunk[c].memblock);
+
+    return 0;
+}
+
+static int interleave_chunk(const pa_memchunk ichunk[], pa_memchunk *ochunk, unsigned channels, size_t isample) {
+    pa_mempool *pool;
+    const void *bufs[PA_CHANNELS_MAX];
+    short *output;
+    unsigned frames;
+    unsigned c;
+
+    pa_assert_fp(ichunk);
+    pa_assert_fp(ochunk);
+    pa_assert_fp(channels > 0 && channels <= PA_CHANNELS_MAX);
+    pa_assert_fp(ichunk[0].memblock);
+    pa_assert_fp(0 == (ichunk[0].length % (8*isample)));
+    pool = pa_memblock_get_pool(ichunk[0].memblock);
+
+    frames = ichunk[0].length/isample;
+
+    for (c = 0; c < channels; c++) {
+        pa_assert_fp(ichunk[c].length == ichunk[0].length);
+        bufs[c] = (const uint8_t *) pa_memblock_acquire(ichunk[c].memblock) + ichunk[c].index;
+    }
+
+    ochunk->length = frames*channels*sizeof(short);
+    ochunk->index = 0;
+    ochunk->memblock = pa_memblock_new(pool, ochunk->length);
+    output = (short *) pa_memblock_acquire(ochunk->memblock);
+    if (isample == sizeof(short))
+        interleave_from_planar((const short **) bufs, output, channels, frames);
+    else
+        interleave_from_planar_float((const float **) bufs, output, channels, frames);
+    pa_memblock_release(ochunk->memblock);
+
+    for (c = 0; c < channels; c++)
+        pa_memblock_release(ichunk[c].memblock);
+
+    return 0;
+}
+
+int pa_optimized_deinterleave(const pa_memchunk *ichunk, pa_memchunk ochunk[], unsigned channels) {
+    return deinterleave_chunk(ichunk, ochunk, channels, sizeof(short));
+}
+
+int pa_optimized_interleave(const pa_memchunk ichunk[], pa_memchunk *ochunk, unsigned channels) {
+    return interleave_chunk(ichunk, ochunk, channels, sizeof(short));
+}
+
+int pa_optimized_deinterleave_to_float(const pa_memchunk *ichunk, pa_memchunk ochunk[], unsigned channels) {
+    return deinterleave_chunk(ichunk, ochunk, channels, sizeof(float));
+}
+
+int pa_optimized_interleave_from_float(const pa_memchunk ichunk[], pa_memchunk *ochunk, unsigned channels) {
+    return interleave_chunk(ichunk, ochunk, channels, sizeof(float));
+}
+
+int pa_optimized_crossfade(const pa_memchunk *from, pa_memchunk *chunk,
+                           unsigned channels, unsigned position, unsigned length) {
+    const short *input;
+    short *output;
+    unsigned frames;
+
+    pa_assert_fp(chunk);
+    pa_assert_fp(chunk->memblock);
+    pa_assert_fp(from);
+    pa_assert_fp(from->length == chunk->length);
+
+    frames = chunk->length/(channels*sizeof(short));
+    output = (short *)pa_memblock_acquire(chunk->memblock) + chunk->index/sizeof(short);
+
+    input = (const short *)pa_memblock_acquire(from->memblock) + from->index/sizeof(short);
+    crossfade_interleaved(input, output, output, channels, frames, position, length);
+    pa_memblock_release(from->memblock);
+
+    pa_memblock_release(chunk->memblock);
+
+    return 0;
+}
@@ -24,6 +24,8 @@
 #endif
 
 #include <pulsecore/core.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/hook-list.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -44,19 +46,37 @@ enum shared_item_type {
     SHARED_ITEM_MAX
 };
 
-typedef struct shared_item {
+/* Items are never removed before the shared data itself is freed, so an
+ * item pointer is handed out as the key handle. Type and boolean or integer
+ * value are atomic so that IO threads can read them without locking; they
+ * are written from main thread only, value before type. */
+struct pa_shared_data_key {
     char *key;
-    enum shared_item_type type;
+    pa_atomic_t type;
+    pa_atomic_t integer;
     void *value;
     size_t nbytes;
     pa_hook changed_hook;
-} shared_item;
+    /* Fired once per main loop iteration with the final value */
+    pa_hook deferred_hook;
+    pa_shared_data *shared;
+};
+
+typedef struct pa_shared_data_key shared_item;
 
 struct pa_shared_data {
     PA_REFCNT_DECLARE;
 
     pa_core *core;
     pa_hashmap *items;
+
+    /* Items changed during the current transaction */
+    unsigned transaction;
+    pa_idxset *pending;
+
+    /* Items whose deferred hook needs to be fired */
+    pa_idxset *deferred;
+    pa_defer_event *defer_event;
 };
 
 static void shared_item_free(shared_item *i);
@@ -70,6 +90,8 @@ static pa_shared_data* shared_data_new(pa_core *c) {
     PA_REFCNT_INIT(t);
     t->core = c;
     t->items = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func, NULL, (pa_free_cb_t) shared_item_free);
+    t->pending = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    t->deferred = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     pa_assert_se(pa_shared_set(c, "shared-data-0", t) >= 0);
 
@@ -96,9 +118,9 @@ pa_shared_data *pa_shared_data_ref(pa_shared_data *t) {
 
 static void shared_item_free(shared_item *i) {
     pa_hook_done(&i->changed_hook);
+    pa_hook_done(&i->deferred_hook);
     pa_xfree(i->key);
-    if (i->type == SHARED_ITEM_STR || i->type == SHARED_ITEM_DATA)
-        pa_xfree(i->value);
+    pa_xfree(i->value);
     pa_xfree(i);
 }
 
@@ -109,6 +131,13 @@ void pa_shared_data_unref(pa_shared_data *t) {
     if (PA_REFCNT_DEC(t) > 0)
         return;
 
+    pa_assert(t->transaction == 0);
+
+    if (t->defer_event)
+        t->core->mainloop->defer_free(t->defer_event);
+
+    pa_idxset_free(t->pending, NULL);
+    pa_idxset_free(t->deferred, NULL);
     pa_hashmap_free(t->items);
 
     pa_assert_se(pa_shared_remove(t->core, "shared-data-0") >= 0);
@@ -128,24 +157,136 @@ static shared_item *item_get(pa_shared_data *t, pa_hashmap *items, const char *k
 
         item = pa_xnew0(shared_item, 1);
         item->key = pa_xstrdup(key);
+        pa_atomic_store(&item->type, SHARED_ITEM_NONE);
+        pa_atomic_store(&item->integer, 0);
+        item->shared = t;
         pa_hashmap_put(items, item->key, item);
         pa_hook_init(&item->changed_hook, t);
+        pa_hook_init(&item->deferred_hook, t);
     }
 
     return item;
 }
 
+static void defer_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_shared_data *t = userdata;
+    shared_item *item;
+    pa_idxset *deferred;
+
+    pa_assert(t);
+
+    m->defer_enable(e, 0);
+
+    /* Changes made by the callbacks are delivered on the next iteration */
+    deferred = t->deferred;
+    t->deferred = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    while ((item = pa_idxset_steal_first(deferred, NULL)))
+        pa_hook_fire(&item->deferred_hook, item->key);
+
+    pa_idxset_free(deferred, NULL);
+}
+
+static void item_notify(shared_item *item) {
+    pa_shared_data *t = item->shared;
+
+    pa_hook_fire(&item->changed_hook, item->key);
+
+    if (!item->deferred_hook.slots)
+        return;
+
+    pa_idxset_put(t->deferred, item, NULL);
+
+    if (!t->defer_event)
+        t->defer_event = t->core->mainloop->defer_new(t->core->mainloop, defer_cb, t);
+    else
+        t->core->mainloop->defer_enable(t->defer_event, 1);
+}
+
+/* Called whenever the value of item changes, or is written with a
+ * function that always notifies. */
+static void item_changed(shared_item *item) {
+    if (item->shared->transaction > 0)
+        pa_idxset_put(item->shared->pending, item, NULL);
+    else
+        item_notify(item);
+}
+
+void pa_shared_data_begin(pa_shared_data *t) {
+    pa_assert(t);
+    pa_assert(PA_REFCNT_VALUE(t) >= 1);
+
+    t->transaction++;
+}
+
+void pa_shared_data_commit(pa_shared_data *t) {
+    shared_item *item;
+
+    pa_assert(t);
+    pa_assert(t->transaction > 0);
+
+    if (--t->transaction > 0)
+        return;
+
+    while ((item = pa_idxset_steal_first(t->pending, NULL)))
+        item_notify(item);
+}
+
+static inline enum shared_item_type item_type(const shared_item *item) {
+    return (enum shared_item_type) pa_atomic_load(&item->type);
+}
+
+static void item_set_integer(shared_item *item, enum shared_item_type type, int32_t value) {
+    pa_atomic_store(&item->integer, value);
+    pa_atomic_store(&item->type, type);
+    item->nbytes = sizeof(void*);
+}
+
 #define GETI(t, key)    \
     pa_assert(t);       \
     pa_assert(key);     \
     pa_assert_se((item = item_get(t, t->items, key)));
 
+pa_shared_data_key *pa_shared_data_key_register(pa_shared_data *t, const char *key) {
+    pa_assert(t);
+    pa_assert(key);
+
+    if (!pa_proplist_key_valid(key))
+        return NULL;
+
+    return item_get(t, t->items, key);
+}
+
+const char *pa_shared_data_key_name(const pa_shared_data_key *item) {
+    pa_assert(item);
+
+    return item->key;
+}
+
+pa_hook_slot *pa_shared_data_key_connect(pa_shared_data_key *item, pa_hook_cb_t callback, void *userdata) {
+    pa_assert(item);
+
+    return pa_hook_connect(&item->changed_hook, PA_HOOK_NORMAL, callback, userdata);
+}
+
+pa_hook_slot *pa_shared_data_key_connect_deferred(pa_shared_data_key *item, pa_hook_cb_t callback, void *userdata) {
+    pa_assert(item);
+
+    return pa_hook_connect(&item->deferred_hook, PA_HOOK_NORMAL, callback, userdata);
+}
 
 pa_hook_slot *pa_shared_data_connect(pa_shared_data *t, const char *key, pa_hook_cb_t callback, void *userdata) {
     shared_item *item;
     GETI(t, key);
 
-    return pa_hook_connect(&item->changed_hook, PA_HOOK_NORMAL, callback, userdata);
+    return pa_shared_data_key_connect(item, callback, userdata);
+}
+
+pa_hook_slot *pa_shared_data_connect_deferred(pa_shared_data *t, const char *key, pa_hook_cb_t callback, void *userdata) {
+    shared_item *item;
+    GETI(t, key);
+
+    return pa_shared_data_key_connect_deferred(item, callback, userdata);
 }
 
 void pa_shared_data_hook_slot_free(pa_hook_slot *slot) {
@@ -153,44 +294,71 @@ void pa_shared_data_hook_slot_free(pa_hook_slot *slot) {
     pa_hook_slot_free(slot);
 }
 
-int pa_shared_data_set_boolean(pa_shared_data *t, const char *key, bool value) {
-    shared_item *item;
+int pa_shared_data_key_set_boolean(pa_shared_data_key *item, bool value) {
+    enum shared_item_type type;
     bool changed = false;
-    GETI(t, key);
 
-    if (item->type != SHARED_ITEM_NONE && item->type != SHARED_ITEM_BOOL)
+    pa_assert(item);
+
+    type = item_type(item);
+
+    if (type != SHARED_ITEM_NONE && type != SHARED_ITEM_BOOL)
         return -1;
 
-    if (item->type == SHARED_ITEM_NONE)
+    if (type == SHARED_ITEM_NONE)
         changed = true;
 
-    if (item->type == SHARED_ITEM_BOOL && value != !!PA_PTR_TO_UINT(item->value))
+    if (type == SHARED_ITEM_BOOL && value != !!pa_atomic_load(&item->integer))
         changed = true;
 
-    item->type = SHARED_ITEM_BOOL;
-    item->value = PA_UINT_TO_PTR(value);
-    item->nbytes = sizeof(void*);
+    item_set_integer(item, SHARED_ITEM_BOOL, value);
 
     if (changed) {
         pa_log_debug("Shared item '%s' changes to bool value %s", item->key, value ? "true" : "false");
-        pa_hook_fire(&item->changed_hook, item->key);
+        item_changed(item);
     }
 
     return 0;
 }
 
+int pa_shared_data_set_boolean(pa_shared_data *t, const char *key, bool value) {
+    shared_item *item;
+    GETI(t, key);
+
+    return pa_shared_data_key_set_boolean(item, value);
+}
+
+bool pa_shared_data_key_get_boolean(const pa_shared_data_key *item) {
+    pa_assert(item);
+
+    switch (item_type(item)) {
+        case SHARED_ITEM_NONE:
+            return false;
+        case SHARED_ITEM_BOOL:
+        case SHARED_ITEM_INTEGER:
+            return !!pa_atomic_load(&item->integer);
+        default:
+            return !!item->value;
+    }
+}
+
 bool pa_shared_data_get_boolean(pa_shared_data *t, const char *key) {
     shared_item *item;
     GETI(t, key);
 
-    if (item->type == SHARED_ITEM_BOOL)
-        return !!PA_PTR_TO_UINT(item->value);
-    else if (item->type == SHARED_ITEM_NONE)
-        return false;
-    else if (item->value)
-        return true;
-    else
-        return false;
+    return pa_shared_data_key_get_boolean(item);
+}
+
+int pa_shared_data_key_get_integer(const pa_shared_data_key *item, int32_t *return_value) {
+    pa_assert(item);
+    pa_assert(return_value);
+
+    if (item_type(item) != SHARED_ITEM_INTEGER)
+        return -1;
+
+    *return_value = pa_atomic_load(&item->integer);
+
+    return 0;
 }
 
 int pa_shared_data_get_integer(pa_shared_data *t, const char *key, int32_t *return_value) {
@@ -206,12 +374,25 @@ int pa_shared_data_get_integer(pa_shared_data *t, const char *key, int32_t *retu
     if (!(item = pa_hashmap_get(t->items, key)))
         return -1;
 
-    GETI(t, key);
+    return pa_shared_data_key_get_integer(item, return_value);
+}
+
+int pa_shared_data_key_set_integer(pa_shared_data_key *item, int32_t value) {
+    enum shared_item_type type;
+
+    pa_assert(item);
 
-    if (item->type != SHARED_ITEM_INTEGER)
+    type = item_type(item);
+
+    if (type == SHARED_ITEM_INTEGER && pa_atomic_load(&item->integer) == value)
+        return 0;
+    else if (type != SHARED_ITEM_NONE && type != SHARED_ITEM_INTEGER)
         return -1;
 
-    *return_value = PA_PTR_TO_INT(item->value);
+    item_set_integer(item, SHARED_ITEM_INTEGER, value);
+
+    pa_log_debug("Shared item '%s' changes to integer value '%d'", item->key, value);
+    item_changed(item);
 
     return 0;
 }
@@ -226,26 +407,38 @@ int pa_shared_data_set_integer(pa_shared_data *t, const char *key, int32_t value
 
     GETI(t, key);
 
-    if (item->type == SHARED_ITEM_NONE) {
-        item->type = SHARED_ITEM_INTEGER;
-        item->value = PA_INT_TO_PTR(value);
-        item->nbytes = sizeof(void*);
-    } else if (item->type == SHARED_ITEM_INTEGER && PA_PTR_TO_INT(item->value) == value)
+    return pa_shared_data_key_set_integer(item, value);
+}
+
+int pa_shared_data_key_inc_integer(pa_shared_data_key *item, int32_t change) {
+    enum shared_item_type type;
+    int32_t old_value;
+
+    pa_assert(item);
+
+    if (change == 0)
         return 0;
-    else if (item->type != SHARED_ITEM_INTEGER)
+
+    type = item_type(item);
+
+    if (type == SHARED_ITEM_NONE)
+        item_set_integer(item, SHARED_ITEM_INTEGER, 0);
+    else if (type != SHARED_ITEM_INTEGER)
         return -1;
 
-    item->value = PA_INT_TO_PTR(value);
+    old_value = pa_atomic_load(&item->integer);
 
-    pa_log_debug("Shared item '%s' changes to integer value '%d'", item->key, PA_PTR_TO_INT(item->value));
-    pa_hook_fire(&item->changed_hook, item->key);
+    if (old_value + change != old_value) {
+        pa_atomic_store(&item->integer, old_value + change);
+        pa_log_debug("Shared item '%s' changes to integer value '%d'", item->key, old_value + change);
+        item_changed(item);
+    }
 
     return 0;
 }
 
 int pa_shared_data_inc_integer(pa_shared_data *t, const char *key, int32_t change) {
     shared_item *item;
-    int32_t new_value;
 
     pa_assert(t);
     pa_assert(key);
@@ -258,37 +451,22 @@ int pa_shared_data_inc_integer(pa_shared_data *t, const char *key, int32_t chang
 
     GETI(t, key);
 
-    if (item->type == SHARED_ITEM_NONE) {
-        item->value = PA_INT_TO_PTR(0);
-        item->type = SHARED_ITEM_INTEGER;
-        item->nbytes = sizeof(void*);
-    } else if (item->type != SHARED_ITEM_INTEGER)
-        return -1;
-
-    new_value = change + PA_PTR_TO_INT(item->value);
-
-    if (new_value != PA_PTR_TO_INT(item->value)) {
-        item->value = PA_INT_TO_PTR(new_value);
-        pa_log_debug("Shared item '%s' changes to integer value '%d'", item->key, PA_PTR_TO_INT(item->value));
-        pa_hook_fire(&item->changed_hook, item->key);
-    }
-
-    return 0;
+    return pa_shared_data_key_inc_integer(item, change);
 }
 
-static int shared_data_sets(pa_shared_data *t, const char *key, const char *value, bool fire_always) {
-    shared_item *item;
+static int key_sets(shared_item *item, const char *value, bool fire_always) {
+    enum shared_item_type type;
     bool changed = true;
 
-    pa_assert(key);
+    pa_assert(item);
     pa_assert(value);
 
-    if (!pa_proplist_key_valid(key) || !pa_utf8_valid(value))
+    if (!pa_utf8_valid(value))
         return -1;
 
-    GETI(t, key);
+    type = item_type(item);
 
-    if (item->type != SHARED_ITEM_NONE && item->type != SHARED_ITEM_STR)
+    if (type != SHARED_ITEM_NONE && type != SHARED_ITEM_STR)
         return -1;
 
     if (item->value) {
@@ -299,19 +477,41 @@ static int shared_data_sets(pa_shared_data *t, const char *key, const char *valu
     }
 
     if (changed) {
-        item->type = SHARED_ITEM_STR;
         item->value = pa_xstrdup(value);
         item->nbytes = strlen(value) + 1;
+        pa_atomic_store(&item->type, SHARED_ITEM_STR);
     }
 
     if (fire_always || changed) {
         pa_log_debug("Shared item '%s' changes to str value '%s'", item->key, (const char *) item->value);
-        pa_hook_fire(&item->changed_hook, item->key);
+        item_changed(item);
     }
 
     return 0;
 }
 
+static int shared_data_sets(pa_shared_data *t, const char *key, const char *value, bool fire_always) {
+    shared_item *item;
+
+    pa_assert(key);
+    pa_assert(value);
+
+    if (!pa_proplist_key_valid(key))
+        return -1;
+
+    GETI(t, key);
+
+    return key_sets(item, value, fire_always);
+}
+
+int pa_shared_data_key_sets(pa_shared_data_key *item, const char *value) {
+    return key_sets(item, value, false);
+}
+
+int pa_shared_data_key_sets_always(pa_shared_data_key *item, const char *value) {
+    return key_sets(item, value, true);
+}
+
 int pa_shared_data_sets_always(pa_shared_data *t, const char *key, const char *value) {
     return shared_data_sets(t, key, value, true);
 }
@@ -320,15 +520,21 @@ int pa_shared_data_sets(pa_shared_data *t, const char *key, const char *value) {
     return shared_data_sets(t, key, value, false);
 }
 
+const char *pa_shared_data_key_gets(const pa_shared_data_key *item) {
+    pa_assert(item);
+
+    if (item_type(item) == SHARED_ITEM_STR)
+        return (char *) item->value;
+    else
+        return NULL;
+}
+
 const char *pa_shared_data_gets(pa_shared_data *t, const char *key) {
     shared_item *item;
 
     GETI(t, key);
 
-    if (item->type == SHARED_ITEM_STR)
-        return (char *) item->value;
-    else
-        return NULL;
+    return pa_shared_data_key_gets(item);
 }
 
 int pa_shared_data_setd(pa_shared_data *t, const char *key, const void *data, size_t nbytes) {
@@ -351,7 +557,7 @@ int pa_shared_data_setd(pa_shared_data *t, const char *key, const void *data, si
     ((char *) item->value)[nbytes] = 0;
 
     pa_log_debug("Shared item '%s' changes to data ptr from %p", item->key, (void *) data);
-    pa_hook_fire(&item->changed_hook, item->key);
+    item_changed(item);
 
     return 0;
 }
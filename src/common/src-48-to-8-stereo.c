@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "src-48-to-8-stereo.h"
+
+#ifdef ARM_DSP
+#include <dspfns.h>
+#endif
+
+#define DOWNSAMPLING_FACTOR_1 3
+#define FILTER_LENGTH_1 16
+#define FILTER_MEMORY_1 15
+
+#define DOWNSAMPLING_FACTOR_2 2
+#define FILTER_LENGTH_2 80
+#define FILTER_MEMORY_2 79
+
+struct src_48_to_8_stereo
+{
+  short filter_memory_1[FILTER_MEMORY_1];
+  /* 16kHz intermediate, preceded by stage 2 filter memory */
+  short stage_2[FILTER_MEMORY_2 + SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES / 3];
+  /* downmix needs the channel sum before filtering */
+  short downmix_buffer[SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES];
+};
+
+/* Same coefficients as in src-48-to-8.c */
+static const signed short filter_coeffs_1[] =
+{
+  8, 69, 185, 94, -502, -1527, -2132, -1143,
+  1841, 5719, 8467, 8671, 6566, 3651, 1390, 290
+};
+
+static const signed short filter_coeffs_2[] =
+{
+  2, -6, 4, 4, -5, -6, 7, 9, -10, -12, 13, 17,
+  -18, -24, 23, 34, -28, -46, 34, 62, -40, -84,
+  44, 111, -46, -146, 43, 189, -31, -242, 6, 304,
+  42, -370, -126, 421, 261, -376, -313, 366, 333,
+  -477, -555, 377, 631, -371, -808, 261, 939, -146,
+  -1094, -42, 1218, 277, -1319, -584, 1361, 958,
+  -1319, -1403, 1144, 1901, -776, -2414, 131, 2851,
+  890, -3020, -2377, 2523, 4284, -585, -5955, -4086,
+  4336, 11559, 12142, 7681, 2961, 564
+};
+
+src_48_to_8_stereo *alloc_src_48_to_8_stereo(void)
+{
+  src_48_to_8_stereo *src = (src_48_to_8_stereo *) malloc(sizeof(src_48_to_8_stereo));
+  memset(src, 0, sizeof(*src));
+  return src;
+}
+
+void free_src_48_to_8_stereo(src_48_to_8_stereo *src)
+{
+  free(src);
+}
+
+static inline short round_q15(int result)
+{
+  result = (result + 16384) >> 15;
+#ifdef USE_SATURATION
+#ifdef ARM_DSP
+  result = __ssat(result, 16);
+#else
+  result = result < (-32768) ? (-32768) : result;
+  result = result > 32767 ? 32767 : result;
+#endif
+#endif
+  return (short) result;
+}
+
+static inline short downmix(const short *frame)
+{
+  int sum = (int) frame[0] + frame[1];
+
+  if (sum > 0x7FFF)
+    return 0x7FFF;
+  if (sum < -0x8000)
+    return -0x8000;
+  return (short) sum;
+}
+
+/* Runs both filter stages over input read with given stride (1 for mono,
+ * 2 for one channel of interleaved stereo) and moves filter memories forward. */
+static int filter(src_48_to_8_stereo *c, short *output,
+                  const short *input, int stride, int input_frames)
+{
+  int intermediate_frames = input_frames / DOWNSAMPLING_FACTOR_1;
+  int output_frames = intermediate_frames / DOWNSAMPLING_FACTOR_2;
+  short *intermediate = &c->stage_2[FILTER_MEMORY_2];
+  short head[2 * FILTER_MEMORY_1];
+  const short *x;
+  int result;
+  int i, j;
+
+  /* polyphase filter from 48kHz to 16kHz */
+
+  /* first outputs overlap filter memory */
+  memcpy(head, c->filter_memory_1, FILTER_MEMORY_1 * sizeof(short));
+  for (i = 0; i < FILTER_MEMORY_1; i++)
+    head[FILTER_MEMORY_1 + i] = input[i * stride];
+
+  for (i = 0, x = head; x + FILTER_LENGTH_1 <= head + 2 * FILTER_MEMORY_1; i++, x += DOWNSAMPLING_FACTOR_1)
+    {
+      result = 0;
+      for (j = 0; j < FILTER_LENGTH_1; j++)
+        result += (int)(x[j]) * filter_coeffs_1[j];
+      intermediate[i] = round_q15(result);
+    }
+
+  /* then the rest straight from input */
+  for (x = input + (i * DOWNSAMPLING_FACTOR_1 - FILTER_MEMORY_1) * stride;
+       i < intermediate_frames;
+       i++, x += DOWNSAMPLING_FACTOR_1 * stride)
+    {
+      result = 0;
+      for (j = 0; j < FILTER_LENGTH_1; j++)
+        result += (int)(x[j * stride]) * filter_coeffs_1[j];
+      intermediate[i] = round_q15(result);
+    }
+
+  for (i = 0; i < FILTER_MEMORY_1; i++)
+    c->filter_memory_1[i] = input[(input_frames - FILTER_MEMORY_1 + i) * stride];
+
+  /* polyphase filter from 16kHz to 8kHz */
+  for (i = 0, x = c->stage_2; i < output_frames; i++, x += DOWNSAMPLING_FACTOR_2)
+    {
+      result = 0;
+      for (j = 0; j < FILTER_LENGTH_2; j++)
+        result += (int)(x[j]) * filter_coeffs_2[j];
+      output[i] = round_q15(result);
+    }
+
+  memmove(c->stage_2, &c->stage_2[intermediate_frames], FILTER_MEMORY_2 * sizeof(short));
+
+  return output_frames;
+}
+
+static inline int check_frames(int input_frames)
+{
+  return (input_frames % 6) == 0 &&
+    input_frames > FILTER_MEMORY_1 &&
+    input_frames <= SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES;
+}
+
+int process_src_48_to_8_stereo_select(src_48_to_8_stereo *s,
+                                      short *output,
+                                      const short *input,
+                                      int input_frames,
+                                      src_48_to_8_stereo_mode mode)
+{
+  int i;
+
+  if (!check_frames(input_frames))
+    return -1;
+
+  switch (mode)
+    {
+    case SRC_48_TO_8_STEREO_CH0:
+      return filter(s, output, input, 2, input_frames);
+
+    case SRC_48_TO_8_STEREO_CH1:
+      return filter(s, output, input + 1, 2, input_frames);
+
+    case SRC_48_TO_8_STEREO_DOWNMIX:
+      for (i = 0; i < input_frames; i++)
+        s->downmix_buffer[i] = downmix(&input[2 * i]);
+      return filter(s, output, s->downmix_buffer, 1, input_frames);
+    }
+
+  return -1;
+}
+
+int process_src_48_to_8_stereo_split(src_48_to_8_stereo *mic_s,
+                                     src_48_to_8_stereo *amb_s,
+                                     short *mic_output,
+                                     short *amb_output,
+                                     const short *input,
+                                     int input_frames,
+                                     int mic_channel)
+{
+  if (!check_frames(input_frames))
+    return -1;
+
+  filter(amb_s, amb_output, input + (mic_channel ? 0 : 1), 2, input_frames);
+
+  return filter(mic_s, mic_output, input + (mic_channel ? 1 : 0), 2, input_frames);
+}
+
+int process_src_48_to_8_stereo_mono(src_48_to_8_stereo *s,
+                                    short *output,
+                                    const short *input,
+                                    int input_frames)
+{
+  if (!check_frames(input_frames))
+    return -1;
+
+  return filter(s, output, input, 1, input_frames);
+}
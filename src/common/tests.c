@@ -19,10 +19,15 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
  * USA.
  */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "optimized.h"
+#include "src-48-to-8.h"
+#include "src-48-to-8-stereo.h"
 
 #define TEST_LENGTH 160
 
@@ -290,7 +295,212 @@ int test_apply_volume(int argc, char *argv[])
   return 0;
 }
 
+#ifdef X86
+/* Fused resampler must be bit exact with the separate channel selection or
+ * downmix followed by src_48_to_8. */
+int test_src_48_to_8_stereo(int argc, char *argv[])
+{
+  int i = 0;
+  int n = 0;
+  int frames = 0;
+  int mismatch = 0;
+  short test_input[2 * 480];
+  short test_ch1[480];
+  short test_mix[480];
+  short test_result_select[480 / 6];
+  short test_result_downmix[480 / 6];
+  short test_result_mic[480 / 6];
+  short test_result_amb[480 / 6];
+  short test_ref_ch0[480 / 6];
+  short test_ref_ch1[480 / 6];
+  short test_ref_mix[480 / 6];
+  src_48_to_8_stereo *select_src = alloc_src_48_to_8_stereo();
+  src_48_to_8_stereo *downmix_src = alloc_src_48_to_8_stereo();
+  src_48_to_8_stereo *mic_src = alloc_src_48_to_8_stereo();
+  src_48_to_8_stereo *amb_src = alloc_src_48_to_8_stereo();
+  src_48_to_8 *ref_ch0_src = alloc_src_48_to_8();
+  src_48_to_8 *ref_ch1_src = alloc_src_48_to_8();
+  src_48_to_8 *ref_mix_src = alloc_src_48_to_8();
+
+  printf("\n * Test: %s\n", __PRETTY_FUNCTION__);
+
+  /* Several rounds so that filter memory carries over between calls */
+  for (n = 0; n < 4; n++)
+    {
+      short test_ch0[480];
+
+      for (i = 0; i < 480; i++)
+        {
+          test_input[2 * i] = test_ch0[i] = (((i + 7 * n) % 61) - 30) * 1000;
+          test_input[2 * i + 1] = test_ch1[i] = (((i + 5 * n) % 37) - 18) * 1500;
+        }
+
+      /* reference: separate channel selection or downmix, then src_48_to_8 */
+      downmix_to_mono_from_interleaved_stereo(test_input, test_mix, 2 * 480);
+      process_src_48_to_8(ref_ch0_src, test_ref_ch0, test_ch0, 480);
+      process_src_48_to_8(ref_ch1_src, test_ref_ch1, test_ch1, 480);
+      process_src_48_to_8(ref_mix_src, test_ref_mix, test_mix, 480);
+
+      frames = process_src_48_to_8_stereo_select(select_src, test_result_select, test_input, 480, SRC_48_TO_8_STEREO_CH1);
+      process_src_48_to_8_stereo_select(downmix_src, test_result_downmix, test_input, 480, SRC_48_TO_8_STEREO_DOWNMIX);
+      process_src_48_to_8_stereo_split(mic_src, amb_src, test_result_mic, test_result_amb, test_input, 480, 1);
+
+      if (frames != 480 / 6)
+        mismatch++;
+
+      for (i = 0; i < 480 / 6; i++)
+        {
+          if (test_result_select[i] != test_ref_ch1[i])
+            mismatch++;
+          if (test_result_downmix[i] != test_ref_mix[i])
+            mismatch++;
+          if (test_result_mic[i] != test_ref_ch1[i] || test_result_amb[i] != test_ref_ch0[i])
+            mismatch++;
+        }
+    }
+
+  for (i = 0; i < 480 / 6; i++)
+    {
+      printf("test result in index %d is %d (downmix %d mic %d amb %d)\n",
+             i, test_result_select[i], test_result_downmix[i], test_result_mic[i], test_result_amb[i]);
+    }
+
+  if (process_src_48_to_8_stereo_select(select_src, test_result_select, test_input, 478, SRC_48_TO_8_STEREO_CH0) >= 0)
+    mismatch++;
+
+  printf("mismatches against src_48_to_8 %d\n", mismatch);
+
+  free_src_48_to_8_stereo(select_src);
+  free_src_48_to_8_stereo(downmix_src);
+  free_src_48_to_8_stereo(mic_src);
+  free_src_48_to_8_stereo(amb_src);
+  free_src_48_to_8(ref_ch0_src);
+  free_src_48_to_8(ref_ch1_src);
+  free_src_48_to_8(ref_mix_src);
+
+  return mismatch;
+}
+#endif
+
+int test_float(int argc, char *argv[])
+{
+  int i = 0;
+  int mismatch = 0;
+  short test_input[TEST_LENGTH];
+  short test_result[TEST_LENGTH];
+  float test_float_1[TEST_LENGTH / 2];
+  float test_float_2[TEST_LENGTH / 2];
+  float *test_planar[2];
+  float test_clip[8] = { 1.0f, 1.5f, -1.0f, -2.0f, 0.5f, -0.5f, 0.0f, 32767.0f / 32768.0f };
+  short test_clip_result[8];
+
+  printf("\n * Test: %s\n", __PRETTY_FUNCTION__);
+
+  test_planar[0] = test_float_1;
+  test_planar[1] = test_float_2;
+
+  for (i = 0; i < TEST_LENGTH; i++)
+    {
+      test_input[i] = (short)(i * 409 - 32768);
+    }
+
+  /* S16 -> float -> S16 must be lossless */
+  convert_s16_to_float(test_input, test_float_1, TEST_LENGTH / 2);
+  convert_float_to_s16(test_float_1, test_result, TEST_LENGTH / 2);
+
+  for (i = 0; i < TEST_LENGTH / 2; i++)
+    {
+      if (test_result[i] != test_input[i])
+        mismatch++;
+    }
+
+  deinterleave_stereo_to_float(test_input, test_planar, TEST_LENGTH);
+  interleave_float_to_stereo((const float **)test_planar, test_result, TEST_LENGTH / 2);
+
+  for (i = 0; i < TEST_LENGTH; i++)
+    {
+      if (test_result[i] != test_input[i])
+        mismatch++;
+    }
+
+  for (i = 0; i < TEST_LENGTH / 2; i++)
+    {
+      printf("test result in index %d is %f %f\n", i, test_float_1[i], test_float_2[i]);
+    }
+
+  convert_float_to_s16(test_clip, test_clip_result, 8);
+
+  for (i = 0; i < 8; i++)
+    {
+      printf("clip result in index %d is %d\n", i, test_clip_result[i]);
+    }
+
+  printf("round trip mismatches %d\n", mismatch);
+
+  return mismatch;
+}
+
+int test_planar(int argc, char *argv[])
+{
+  int i = 0;
+  unsigned c = 0;
+  unsigned channels = 0;
+  int mismatch = 0;
+  short test_input[8 * TEST_LENGTH];
+  short test_result[8 * TEST_LENGTH];
+  short test_planar_s16[8][TEST_LENGTH];
+  float test_planar_float[8][TEST_LENGTH];
+  short *planar_s16[8];
+  float *planar_float[8];
+
+  printf("\n * Test: %s\n", __PRETTY_FUNCTION__);
+
+  for (c = 0; c < 8; c++)
+    {
+      planar_s16[c] = test_planar_s16[c];
+      planar_float[c] = test_planar_float[c];
+    }
+
+  for (channels = 1; channels <= 8; channels++)
+    {
+      int channel_mismatch = 0;
+
+      /* Sample value encodes frame and channel */
+      for (i = 0; i < TEST_LENGTH; i++)
+        for (c = 0; c < channels; c++)
+          test_input[i * channels + c] = (short)(i * 16 + c);
+
+      deinterleave_to_planar(test_input, planar_s16, channels, TEST_LENGTH);
+
+      for (i = 0; i < TEST_LENGTH; i++)
+        for (c = 0; c < channels; c++)
+          if (test_planar_s16[c][i] != (short)(i * 16 + c))
+            channel_mismatch++;
+
+      interleave_from_planar((const short **)planar_s16, test_result, channels, TEST_LENGTH);
+
+      for (i = 0; i < (int)(TEST_LENGTH * channels); i++)
+        if (test_result[i] != test_input[i])
+          channel_mismatch++;
+
+      deinterleave_to_planar_float(test_input, planar_float, channels, TEST_LENGTH);
+      interleave_from_planar_float((const float **)planar_float, test_result, channels, TEST_LENGTH);
+
+      for (i = 0; i < (int)(TEST_LENGTH * channels); i++)
+        if (test_result[i] != test_input[i])
+          channel_mismatch++;
+
+      printf("%u channels: last frame first sample %d, mismatches %d\n",
+             channels, test_planar_s16[0][TEST_LENGTH - 1], channel_mismatch);
+      mismatch += channel_mismatch;
+    }
+
+  return mismatch;
+}
+
 int main (int argc, char * argv[]) {
+    int failures = 0;
+
     test_interleave(argc, argv);
     test_deinterleave(argc, argv);
     test_dup(argc, argv);
@@ -299,4 +509,11 @@ int main (int argc, char * argv[]) {
     test_mix(argc, argv);
     test_mix_in_with_volume(argc, argv);
     test_apply_volume(argc, argv);
+#ifdef X86
+    failures += test_src_48_to_8_stereo(argc, argv) != 0;
+#endif
+    failures += test_float(argc, argv) != 0;
+    failures += test_planar(argc, argv) != 0;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
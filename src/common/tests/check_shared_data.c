@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulsecore/core.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+
+#include "shared-data.h"
+
+#define KEY_A "x-test.a"
+#define KEY_B "x-test.b"
+
+/* Shared data only needs the mainloop and the shared object map of the
+ * core, so a zeroed core is enough and doesn't depend on pa_core_new(). */
+static pa_mainloop *mainloop;
+static pa_core core;
+static pa_shared_data *shared;
+
+struct counter {
+    pa_shared_data_key *key;
+    int calls;
+    int32_t seen;
+};
+
+static void setup(void) {
+    mainloop = pa_mainloop_new();
+    memset(&core, 0, sizeof(core));
+    core.mainloop = pa_mainloop_get_api(mainloop);
+    core.shared = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    shared = pa_shared_data_get(&core);
+}
+
+static void teardown(void) {
+    pa_shared_data_unref(shared);
+    pa_hashmap_free(core.shared);
+    pa_mainloop_free(mainloop);
+}
+
+static void iterate(void) {
+    pa_mainloop_iterate(mainloop, 0, NULL);
+}
+
+static pa_hook_result_t count_cb(void *hook_data, void *call_data, void *slot_data) {
+    struct counter *c = slot_data;
+
+    c->calls++;
+    pa_shared_data_key_get_integer(c->key, &c->seen);
+
+    return PA_HOOK_OK;
+}
+
+/* Sets the value again from the callback, the first time round */
+static pa_hook_result_t set_again_cb(void *hook_data, void *call_data, void *slot_data) {
+    struct counter *c = slot_data;
+
+    if (c->calls++ == 0)
+        pa_shared_data_key_set_integer(c->key, 100);
+    pa_shared_data_key_get_integer(c->key, &c->seen);
+
+    return PA_HOOK_OK;
+}
+
+START_TEST (commit_coalesces)
+{
+    struct counter a = { NULL, 0, 0 };
+    struct counter b = { NULL, 0, 0 };
+    pa_hook_slot *sa, *sb;
+    int32_t value;
+
+    a.key = pa_shared_data_key_register(shared, KEY_A);
+    b.key = pa_shared_data_key_register(shared, KEY_B);
+    sa = pa_shared_data_key_connect(a.key, count_cb, &a);
+    sb = pa_shared_data_key_connect(b.key, count_cb, &b);
+
+    pa_shared_data_begin(shared);
+    pa_shared_data_key_set_integer(a.key, 1);
+    pa_shared_data_key_set_integer(a.key, 2);
+    pa_shared_data_key_inc_integer(a.key, 3);
+    pa_shared_data_set_integer(shared, KEY_B, 7);
+
+    fail_unless(a.calls == 0 && b.calls == 0, "Notified inside transaction");
+    fail_unless(pa_shared_data_key_get_integer(a.key, &value) == 0 && value == 5,
+                "Getter doesn't return the new value, got %d", value);
+
+    pa_shared_data_commit(shared);
+
+    fail_unless(a.calls == 1, "Expected 1 notification - got %d", a.calls);
+    fail_unless(a.seen == 5, "Expected final value 5 - got %d", a.seen);
+    fail_unless(b.calls == 1, "Expected 1 notification - got %d", b.calls);
+    fail_unless(b.seen == 7, "Expected final value 7 - got %d", b.seen);
+
+    /* Outside of transactions every change is notified */
+    pa_shared_data_key_set_integer(a.key, 6);
+    pa_shared_data_key_set_integer(a.key, 6);
+    pa_shared_data_key_set_integer(a.key, 8);
+
+    fail_unless(a.calls == 3, "Expected 3 notifications - got %d", a.calls);
+
+    pa_shared_data_hook_slot_free(sa);
+    pa_shared_data_hook_slot_free(sb);
+}
+END_TEST
+
+START_TEST (commit_nested)
+{
+    struct counter a = { NULL, 0, 0 };
+    pa_hook_slot *s;
+
+    a.key = pa_shared_data_key_register(shared, KEY_A);
+    s = pa_shared_data_key_connect(a.key, count_cb, &a);
+
+    pa_shared_data_begin(shared);
+    pa_shared_data_key_inc_integer(a.key, 1);
+
+    pa_shared_data_begin(shared);
+    pa_shared_data_key_inc_integer(a.key, 1);
+    pa_shared_data_commit(shared);
+
+    fail_unless(a.calls == 0, "Inner commit notified");
+
+    pa_shared_data_key_inc_integer(a.key, -1);
+    pa_shared_data_commit(shared);
+
+    fail_unless(a.calls == 1, "Expected 1 notification - got %d", a.calls);
+    fail_unless(a.seen == 1, "Expected final value 1 - got %d", a.seen);
+
+    /* Nothing is left pending for the next transaction */
+    pa_shared_data_begin(shared);
+    pa_shared_data_commit(shared);
+
+    fail_unless(a.calls == 1, "Empty transaction notified");
+
+    pa_shared_data_hook_slot_free(s);
+}
+END_TEST
+
+START_TEST (deferred_once_per_iteration)
+{
+    struct counter sync = { NULL, 0, 0 };
+    struct counter deferred = { NULL, 0, 0 };
+    pa_hook_slot *ss, *sd;
+
+    sync.key = deferred.key = pa_shared_data_key_register(shared, KEY_A);
+    ss = pa_shared_data_key_connect(sync.key, count_cb, &sync);
+    sd = pa_shared_data_connect_deferred(shared, KEY_A, count_cb, &deferred);
+
+    pa_shared_data_key_set_integer(sync.key, 1);
+    pa_shared_data_key_inc_integer(sync.key, 1);
+    pa_shared_data_set_integer(shared, KEY_A, 3);
+
+    fail_unless(sync.calls == 3, "Expected 3 notifications - got %d", sync.calls);
+    fail_unless(deferred.calls == 0, "Deferred callback called synchronously");
+
+    iterate();
+
+    fail_unless(deferred.calls == 1, "Expected 1 deferred call - got %d", deferred.calls);
+    fail_unless(deferred.seen == 3, "Expected final value 3 - got %d", deferred.seen);
+
+    iterate();
+
+    fail_unless(deferred.calls == 1, "Deferred callback called without a change");
+
+    pa_shared_data_hook_slot_free(ss);
+    pa_shared_data_hook_slot_free(sd);
+}
+END_TEST
+
+START_TEST (deferred_change_from_callback)
+{
+    struct counter deferred = { NULL, 0, 0 };
+    pa_hook_slot *s;
+
+    deferred.key = pa_shared_data_key_register(shared, KEY_A);
+    s = pa_shared_data_key_connect_deferred(deferred.key, set_again_cb, &deferred);
+
+    pa_shared_data_key_set_integer(deferred.key, 1);
+    iterate();
+
+    fail_unless(deferred.calls == 1, "Expected 1 deferred call - got %d", deferred.calls);
+
+    /* The change made by the callback is delivered on the next iteration */
+    iterate();
+
+    fail_unless(deferred.calls == 2, "Expected 2 deferred calls - got %d", deferred.calls);
+    fail_unless(deferred.seen == 100, "Expected final value 100 - got %d", deferred.seen);
+
+    pa_shared_data_hook_slot_free(s);
+}
+END_TEST
+
+START_TEST (deferred_after_commit)
+{
+    struct counter deferred = { NULL, 0, 0 };
+    pa_hook_slot *s;
+
+    deferred.key = pa_shared_data_key_register(shared, KEY_A);
+    s = pa_shared_data_key_connect_deferred(deferred.key, count_cb, &deferred);
+
+    pa_shared_data_begin(shared);
+    pa_shared_data_key_set_integer(deferred.key, 1);
+    iterate();
+
+    fail_unless(deferred.calls == 0, "Deferred callback called inside transaction");
+
+    pa_shared_data_key_set_integer(deferred.key, 2);
+    pa_shared_data_commit(shared);
+    iterate();
+
+    fail_unless(deferred.calls == 1, "Expected 1 deferred call - got %d", deferred.calls);
+    fail_unless(deferred.seen == 2, "Expected final value 2 - got %d", deferred.seen);
+
+    pa_shared_data_hook_slot_free(s);
+}
+END_TEST
+
+Suite *shared_data_suite() {
+    Suite *s = suite_create("SharedData");
+
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+
+    /* add test cases */
+    tcase_add_test(tc_core, commit_coalesces);
+    tcase_add_test(tc_core, commit_nested);
+    tcase_add_test(tc_core, deferred_once_per_iteration);
+    tcase_add_test(tc_core, deferred_change_from_callback);
+    tcase_add_test(tc_core, deferred_after_commit);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void) {
+    int number_failed;
+    Suite *s = shared_data_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "worker-pool.h"
+
+/* How many times an idle worker polls its mailbox before going to sleep. */
+#define SPIN_COUNT 2000
+
+/* How much longer than the calling thread took for its own lanes it spins
+ * for a worker to finish, before sleeping until the worker is done. */
+#define DEADLINE_MARGIN_USEC 200
+
+/* How many runs after a missed deadline are done by the calling thread alone. */
+#define INLINE_RUNS 100
+
+enum mailbox_state {
+    MAILBOX_IDLE,
+    MAILBOX_ASSIGNED,
+    MAILBOX_RUNNING
+};
+
+typedef struct worker {
+    meego_worker_pool *pool;
+    unsigned index;
+    pa_thread *thread;
+
+    pa_atomic_t state;              /* enum mailbox_state */
+    pa_atomic_t sleeping;           /* Set while waiting on semaphore. */
+    pa_semaphore *semaphore;
+    unsigned lane;                  /* Written before state becomes ASSIGNED. */
+} worker;
+
+struct meego_worker_pool {
+    pa_core *core;
+    pa_atomic_t busy;
+    pa_atomic_t quit;
+
+    /* Calling thread sleeping after a missed deadline. */
+    pa_atomic_t waiting;
+    pa_semaphore *done;
+
+    /* Runs left to do inline, only accessed by the thread holding busy. */
+    unsigned inline_runs;
+
+    /* Job of the current run, written before lanes are assigned. */
+    meego_worker_lane_cb_t cb;
+    void *userdata;
+
+    unsigned n_workers;
+    worker workers[];
+};
+
+static inline void cpu_relax(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("pause");
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+/* Workers are not pinned. They inherit the CPU affinity of the daemon, which
+ * decides where they and the IO threads calling the pool may run. */
+static void worker_setup(worker *w) {
+    if (w->pool->core->realtime_scheduling)
+        pa_make_realtime(w->pool->core->realtime_priority);
+}
+
+/* Number of CPUs the daemon may run on. */
+static unsigned usable_cpus(void) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return (unsigned) CPU_COUNT(&set);
+#endif
+
+    return (unsigned) PA_MAX(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+}
+
+/* Waits until a lane is assigned or the pool is shut down. */
+static void worker_wait(worker *w) {
+    unsigned i;
+
+    for (i = 0; i < SPIN_COUNT; i++) {
+        if (pa_atomic_load(&w->state) == MAILBOX_ASSIGNED || pa_atomic_load(&w->pool->quit))
+            return;
+        cpu_relax();
+    }
+
+    pa_atomic_store(&w->sleeping, 1);
+
+    if (pa_atomic_load(&w->state) == MAILBOX_ASSIGNED || pa_atomic_load(&w->pool->quit)) {
+        /* If the flag is gone the semaphore was posted as well, consume it. */
+        if (pa_atomic_cmpxchg(&w->sleeping, 1, 0))
+            return;
+    }
+
+    pa_semaphore_wait(w->semaphore);
+}
+
+static void worker_wakeup(worker *w) {
+    if (pa_atomic_cmpxchg(&w->sleeping, 1, 0))
+        pa_semaphore_post(w->semaphore);
+}
+
+static void thread_func(void *userdata) {
+    worker *w = userdata;
+    meego_worker_pool *p = w->pool;
+
+    worker_setup(w);
+
+    for (;;) {
+        worker_wait(w);
+
+        if (pa_atomic_load(&p->quit))
+            break;
+
+        /* The calling thread may have taken the lane back already. */
+        if (pa_atomic_cmpxchg(&w->state, MAILBOX_ASSIGNED, MAILBOX_RUNNING)) {
+            p->cb(w->lane, p->userdata);
+            pa_atomic_store(&w->state, MAILBOX_IDLE);
+
+            if (pa_atomic_cmpxchg(&p->waiting, 1, 0))
+                pa_semaphore_post(p->done);
+        }
+    }
+}
+
+meego_worker_pool *meego_worker_pool_new(pa_core *core, unsigned max_workers) {
+    meego_worker_pool *p;
+    unsigned n_cpus;
+    unsigned i, n;
+    char name[32];
+
+    pa_assert(core);
+
+    n_cpus = usable_cpus();
+
+    if (n_cpus < 2 || max_workers == 0)
+        return NULL;
+
+    /* One CPU is left for the calling thread */
+    n = PA_MIN(n_cpus - 1, max_workers);
+
+    p = pa_xmalloc0(sizeof(meego_worker_pool) + n * sizeof(worker));
+    p->core = core;
+    pa_atomic_store(&p->busy, 0);
+    pa_atomic_store(&p->quit, 0);
+    pa_atomic_store(&p->waiting, 0);
+    p->done = pa_semaphore_new(0);
+
+    for (i = 0; i < n; i++) {
+        worker *w = &p->workers[i];
+
+        w->pool = p;
+        w->index = i;
+        pa_atomic_store(&w->state, MAILBOX_IDLE);
+        pa_atomic_store(&w->sleeping, 0);
+        w->semaphore = pa_semaphore_new(0);
+
+        pa_snprintf(name, sizeof(name), "algorithm-%u", i);
+
+        if (!(w->thread = pa_thread_new(name, thread_func, w))) {
+            pa_log("Failed to create algorithm worker thread");
+            pa_semaphore_free(w->semaphore);
+            break;
+        }
+
+        p->n_workers++;
+    }
+
+    if (p->n_workers == 0) {
+        meego_worker_pool_free(p);
+        return NULL;
+    }
+
+    pa_log_debug("Created algorithm worker pool with %u workers", p->n_workers);
+
+    return p;
+}
+
+void meego_worker_pool_free(meego_worker_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(!pa_atomic_load(&p->busy));
+
+    pa_atomic_store(&p->quit, 1);
+
+    for (i = 0; i < p->n_workers; i++) {
+        worker_wakeup(&p->workers[i]);
+        pa_thread_free(p->workers[i].thread);
+        pa_semaphore_free(p->workers[i].semaphore);
+    }
+
+    pa_semaphore_free(p->done);
+    pa_xfree(p);
+}
+
+unsigned meego_worker_pool_size(meego_worker_pool *p) {
+    pa_assert(p);
+
+    return p->n_workers;
+}
+
+/* Called from IO thread context. Sleeps until the lane running in w is done. */
+static void wait_worker(meego_worker_pool *p, worker *w) {
+    while (pa_atomic_load(&w->state) != MAILBOX_IDLE) {
+        pa_atomic_store(&p->waiting, 1);
+
+        if (pa_atomic_load(&w->state) == MAILBOX_IDLE) {
+            /* If the flag is gone the semaphore was posted as well, consume it. */
+            if (!pa_atomic_cmpxchg(&p->waiting, 1, 0))
+                pa_semaphore_wait(p->done);
+            return;
+        }
+
+        /* Any worker finishing wakes us up, check again. */
+        pa_semaphore_wait(p->done);
+    }
+}
+
+/* Called from IO thread context */
+void meego_worker_pool_run(meego_worker_pool *p, unsigned n_lanes, meego_worker_lane_cb_t cb, void *userdata) {
+    unsigned i, lane, n;
+    pa_usec_t start, now, deadline;
+    bool late = false;
+    worker *w;
+
+    pa_assert_fp(p);
+    pa_assert_fp(cb);
+
+    if (n_lanes < 2 || !pa_atomic_cmpxchg(&p->busy, 0, 1)) {
+        for (lane = 0; lane < n_lanes; lane++)
+            cb(lane, userdata);
+        return;
+    }
+
+    if (p->inline_runs > 0) {
+        p->inline_runs--;
+        for (lane = 0; lane < n_lanes; lane++)
+            cb(lane, userdata);
+        pa_atomic_store(&p->busy, 0);
+        return;
+    }
+
+    p->cb = cb;
+    p->userdata = userdata;
+
+    /* Lane 0 and lanes that don't fit in the pool are run here. */
+    n = PA_MIN(n_lanes - 1, p->n_workers);
+
+    for (i = 0; i < n; i++) {
+        w = &p->workers[i];
+        w->lane = i + 1;
+        pa_atomic_store(&w->state, MAILBOX_ASSIGNED);
+        worker_wakeup(w);
+    }
+
+    start = pa_rtclock_now();
+
+    cb(0, userdata);
+
+    for (lane = n + 1; lane < n_lanes; lane++)
+        cb(lane, userdata);
+
+    /* Lanes still waiting for their worker are taken back. */
+    for (i = 0; i < n; i++) {
+        w = &p->workers[i];
+        if (pa_atomic_cmpxchg(&w->state, MAILBOX_ASSIGNED, MAILBOX_IDLE))
+            cb(w->lane, userdata);
+    }
+
+    /* Lanes take about as long as the ones run here, so a worker still
+     * busy well after that has been preempted. Running lanes can't be
+     * taken back, so stop spinning and sleep until they are done. */
+    now = pa_rtclock_now();
+    deadline = now + (now - start) + DEADLINE_MARGIN_USEC;
+
+    for (i = 0; i < n; i++) {
+        w = &p->workers[i];
+
+        while (pa_atomic_load(&w->state) != MAILBOX_IDLE) {
+            if (late || pa_rtclock_now() > deadline) {
+                late = true;
+                wait_worker(p, w);
+                break;
+            }
+            cpu_relax();
+        }
+    }
+
+    if (late) {
+        p->inline_runs = INLINE_RUNS;
+        pa_log_debug("Algorithm worker missed its deadline, running the next %u jobs inline", INLINE_RUNS);
+    }
+
+    pa_atomic_store(&p->busy, 0);
+}
@@ -86,6 +86,10 @@ struct mv_userdata {
     char *route;
 
     pa_shared_data *shared;
+    pa_shared_data_key *call_state_key;
+    pa_shared_data_key *media_state_key;
+    pa_shared_data_key *emergency_call_state_key;
+    pa_shared_data_key *volume_sync_key;
     pa_hook_slot *call_state_hook_slot;
     pa_hook_slot *media_state_hook_slot;
     pa_hook_slot *emergency_call_state_hook_slot;
@@ -248,7 +248,7 @@ static pa_hook_result_t call_state_cb(void *hook_data, void *call_data, void *sl
     pa_assert(u);
     pa_assert(u->current_steps);
 
-    if ((str = pa_shared_data_gets(u->shared, key))) {
+    if ((str = pa_shared_data_key_gets(u->call_state_key))) {
         if (pa_streq(str, PA_NEMO_PROP_CALL_STATE_ACTIVE)) {
             u->call_active = true;
             u->voip_active = false;
@@ -313,7 +313,7 @@ static pa_hook_result_t media_state_cb(void *hook_data, void *call_data, void *s
     pa_assert(key);
     pa_assert(u);
 
-    if (!(str = pa_shared_data_gets(u->shared, key)))
+    if (!(str = pa_shared_data_key_gets(u->media_state_key)))
         return PA_HOOK_OK;
 
     if (!mv_media_state_from_string(str, &state)) {
@@ -361,7 +361,7 @@ static pa_hook_result_t emergency_call_state_cb(void *hook_data, void *call_data
     pa_assert(key);
     pa_assert(u);
 
-    if (!(str = pa_shared_data_gets(u->shared, key)))
+    if (!(str = pa_shared_data_key_gets(u->emergency_call_state_key)))
         return PA_HOOK_OK;
 
     update_emergency_call_state(u, pa_streq(str, PA_NEMO_PROP_EMERGENCY_CALL_STATE_ACTIVE));
@@ -449,14 +449,13 @@ static void volume_sync_delayed_unmute_set(struct mv_userdata *u) {
 }
 
 static pa_hook_result_t volume_sync_cb(void *hook_data, void *call_data, void *slot_data) {
-    const char *key       = call_data;
     struct mv_userdata *u = slot_data;
 
     pa_sink_input *si;
     uint32_t idx;
     int32_t state;
 
-    if (pa_shared_data_get_integer(u->shared, key, &state) == 0) {
+    if (pa_shared_data_key_get_integer(u->volume_sync_key, &state) == 0) {
         if (u->prev_state != PA_SAILFISHOS_MEDIA_VOLUME_IN_SYNC &&
             state         == PA_SAILFISHOS_MEDIA_VOLUME_IN_SYNC) {
 
@@ -530,8 +529,7 @@ static pa_hook_result_t parameters_changed_cb(void *hook_data, void *call_data,
     pa_assert(ua);
     pa_assert(u);
 
-    pa_shared_data_inc_integer(u->shared, PA_SAILFISHOS_MEDIA_VOLUME_SYNC,
-                                          PA_SAILFISHOS_MEDIA_VOLUME_CHANGING);
+    pa_shared_data_key_inc_integer(u->volume_sync_key, PA_SAILFISHOS_MEDIA_VOLUME_CHANGING);
 
     if (u->route)
         pa_xfree(u->route);
@@ -592,8 +590,7 @@ static pa_hook_result_t parameters_changed_cb(void *hook_data, void *call_data,
      * containing the safe step if one is defined */
     check_and_signal_high_volume(u);
 
-    pa_shared_data_inc_integer(u->shared, PA_SAILFISHOS_MEDIA_VOLUME_SYNC,
-                                          PA_SAILFISHOS_MEDIA_VOLUME_CHANGE_DONE);
+    pa_shared_data_key_inc_integer(u->volume_sync_key, PA_SAILFISHOS_MEDIA_VOLUME_CHANGE_DONE);
 
     return PA_HOOK_OK;
 }
@@ -1003,13 +1000,15 @@ int pa__init(pa_module *m) {
     setup_notifier(u, notifier_conf);
 
     u->shared = pa_shared_data_get(u->core);
-    u->call_state_hook_slot = pa_shared_data_connect(u->shared, PA_NEMO_PROP_CALL_STATE, call_state_cb, u);
-    u->media_state_hook_slot = pa_shared_data_connect(u->shared, PA_NEMO_PROP_MEDIA_STATE, media_state_cb, u);
-    u->emergency_call_state_hook_slot = pa_shared_data_connect(u->shared, PA_NEMO_PROP_EMERGENCY_CALL_STATE, emergency_call_state_cb, u);
+    pa_assert_se((u->call_state_key = pa_shared_data_key_register(u->shared, PA_NEMO_PROP_CALL_STATE)));
+    pa_assert_se((u->media_state_key = pa_shared_data_key_register(u->shared, PA_NEMO_PROP_MEDIA_STATE)));
+    pa_assert_se((u->emergency_call_state_key = pa_shared_data_key_register(u->shared, PA_NEMO_PROP_EMERGENCY_CALL_STATE)));
+    pa_assert_se((u->volume_sync_key = pa_shared_data_key_register(u->shared, PA_SAILFISHOS_MEDIA_VOLUME_SYNC)));
+    u->call_state_hook_slot = pa_shared_data_key_connect(u->call_state_key, call_state_cb, u);
+    u->media_state_hook_slot = pa_shared_data_key_connect(u->media_state_key, media_state_cb, u);
+    u->emergency_call_state_hook_slot = pa_shared_data_key_connect(u->emergency_call_state_key, emergency_call_state_cb, u);
     if (u->mute_routing)
-        u->volume_sync_hook_slot = pa_shared_data_connect(u->shared,
-                                                          PA_SAILFISHOS_MEDIA_VOLUME_SYNC,
-                                                          volume_sync_cb, u);
+        u->volume_sync_hook_slot = pa_shared_data_key_connect(u->volume_sync_key, volume_sync_cb, u);
     u->prev_state = PA_SAILFISHOS_MEDIA_VOLUME_IN_SYNC;
 
     u->volume_proxy = pa_volume_proxy_get(u->core);
@@ -25,6 +25,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
 
@@ -41,6 +42,8 @@
 #include <pulsecore/atomic.h>
 #include <pulsecore/thread.h>
 #include <pulsecore/sample-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
 
 #include "module-meego-music-symdef.h"
 
@@ -69,13 +72,30 @@ FILE* outputFile;
 #endif
 
 #define SAMPLE_RATE_HW_HZ (48000)
+/* Length of crossfade when algorithms are enabled or disabled */
+#define CROSSFADE_USEC (10000)
 #define PROPLIST_SINK "sink.hw0"
+/* Enough window starts for a 2 s master buffer in smallest windows */
+#define CHECKPOINTS_MAX (512)
+
+enum {
+    SINK_MESSAGE_UPDATE_MDRC_VOLUME = PA_SINK_MESSAGE_MAX + 1
+};
+
+/* Sink state at a window start, restored when rewinding to it */
+typedef struct music_checkpoint {
+    uint64_t position;
+    bool algorithm_active;
+    unsigned fade_position;
+    unsigned fade_length;
+} music_checkpoint;
 
 struct userdata {
     pa_core *core;
     pa_module *module;
 
     size_t window_size;
+    size_t new_window_size;     /* applied on next pop, IO thread only */
 
     pa_sink *master_sink;
     pa_sink *sink;
@@ -87,39 +107,324 @@ struct userdata {
 
     meego_algorithm_hook *hook_algorithm;
     meego_algorithm_hook *hook_volume;
+    meego_algorithm_hook *hook_checkpoint;
+    meego_algorithm_hook *hook_restore;
+    meego_algorithm_hook *hook_window_bounds;
+    meego_algorithm_hook *hook_window_size;
+
+    /* Frames rendered from sink, used as checkpoint position. IO thread only. */
+    uint64_t position;
+
+    /* Algorithm enable and disable are crossfaded, the hook keeps calling
+     * disabled algorithms for the fade out. fade_length is 0 when not
+     * fading. IO thread only. */
+    bool algorithm_active;
+    unsigned fade_position;
+    unsigned fade_length;
+
+    /* Checkpoints of rendered windows still within max_rewind, oldest at
+     * checkpoint_first. After rewinding to a window start, skip_frames
+     * already played frames are rendered again and dropped. IO thread only. */
+    music_checkpoint checkpoint[CHECKPOINTS_MAX];
+    unsigned checkpoint_first;
+    unsigned checkpoint_count;
+    uint64_t skip_frames;
+
+    /* Volumes of sink inputs playing to our sink, directly or through flat
+     * volume filter sinks, remapped to our channel map. Keyed by sink input.
+     * max_input_volume is their per channel maximum. Main thread only. */
+    pa_hashmap *input_volumes;
+    pa_cvolume max_input_volume;
+
+    pa_hook_slot *sink_input_put_slot;
+    pa_hook_slot *sink_input_unlink_slot;
+    pa_hook_slot *sink_input_volume_changed_slot;
+    pa_hook_slot *sink_input_move_start_slot;
+    pa_hook_slot *sink_input_move_finish_slot;
+
+    /* Sink inputs with MUSIC_PROP_BYPASS are played to master sink directly,
+     * so they are mixed after the algorithm chain. Main thread only. */
+    pa_idxset *bypassed;
+    pa_hook_slot *sink_input_new_slot;
+    pa_hook_slot *sink_input_proplist_changed_slot;
 };
 
 
-static void get_max_input_volume(pa_sink *s, pa_cvolume *max_volume, const pa_channel_map *channel_map) {
+/* Filter sinks sharing volume with master only pass their inputs' volumes
+ * through, their own sink inputs are ignored. */
+static bool is_flat_filter_input(pa_sink_input *i) {
+    return i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER);
+}
+
+static bool input_volume_tracked(struct userdata *u, pa_sink_input *i) {
+    pa_sink *s;
+
+    if (i == u->sink_input || is_flat_filter_input(i))
+        return false;
+
+    for (s = i->sink; s && s != u->sink; s = s->input_to_master->sink)
+        if (!(s->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER) || !s->input_to_master)
+            return false;
+
+    return s == u->sink;
+}
+
+/* Called from main context */
+static void post_mdrc_volume(struct userdata *u, const pa_cvolume *max_volume) {
+    if (pa_cvolume_equal(&u->max_input_volume, max_volume))
+        return;
+
+    u->max_input_volume = *max_volume;
+
+    /* Hook is fired from I/O thread, as algorithms expect. */
+    if (PA_SINK_IS_LINKED(u->sink->state))
+        pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_MDRC_VOLUME,
+                          &u->max_input_volume, 0, NULL);
+}
+
+static void rescan_max_input_volume(struct userdata *u) {
+    pa_cvolume max_volume;
+    pa_cvolume *v;
+    void *state;
+
+    pa_cvolume_mute(&max_volume, u->sink->channel_map.channels);
+    PA_HASHMAP_FOREACH(v, u->input_volumes, state)
+        pa_cvolume_merge(&max_volume, &max_volume, v);
+
+    post_mdrc_volume(u, &max_volume);
+}
+
+/* True if removing old from the set may lower the maximum */
+static bool volume_was_max(struct userdata *u, const pa_cvolume *old, const pa_cvolume *new) {
+    unsigned c;
+
+    for (c = 0; c < old->channels; c++)
+        if (old->values[c] == u->max_input_volume.values[c] && (!new || new->values[c] < old->values[c]))
+            return true;
+
+    return false;
+}
+
+static void update_input_volume(struct userdata *u, pa_sink_input *i) {
+    pa_cvolume remapped_volume;
+    pa_cvolume max_volume;
+    pa_cvolume *v;
+    bool lowered = false;
+
+    remapped_volume = i->volume;
+    pa_cvolume_remap(&remapped_volume, &i->channel_map, &u->sink->channel_map);
+
+    if ((v = pa_hashmap_get(u->input_volumes, i))) {
+        lowered = volume_was_max(u, v, &remapped_volume);
+        *v = remapped_volume;
+    } else
+        pa_hashmap_put(u->input_volumes, i, pa_xnewdup(pa_cvolume, &remapped_volume, 1));
+
+    if (lowered)
+        rescan_max_input_volume(u);
+    else {
+        pa_cvolume_merge(&max_volume, &u->max_input_volume, &remapped_volume);
+        post_mdrc_volume(u, &max_volume);
+    }
+}
+
+static void remove_input_volume(struct userdata *u, pa_sink_input *i) {
+    pa_cvolume *v;
+
+    if (!(v = pa_hashmap_remove(u->input_volumes, i)))
+        return;
+
+    if (volume_was_max(u, v, NULL))
+        rescan_max_input_volume(u);
+
+    pa_xfree(v);
+}
+
+/* Stores input volumes without posting them, see rebuild_input_volumes() */
+static void collect_input_volumes(struct userdata *u, pa_sink *s) {
+    pa_cvolume remapped_volume;
     pa_sink_input *i;
     uint32_t idx;
-    pa_assert(max_volume);
-    pa_sink_assert_ref(s);
 
     PA_IDXSET_FOREACH(i, s->inputs, idx) {
-        pa_cvolume remapped_volume;
-
-        if (i->origin_sink && (i->origin_sink->flags & PA_SINK_SHARE_VOLUME_WITH_MASTER)) {
-            /* go recursively on slaved flatten sink
-             * and ignore this intermediate sink-input. (This is not really needed) */
-            get_max_input_volume(i->origin_sink, max_volume, channel_map);
+        if (is_flat_filter_input(i)) {
+            /* go recursively on slaved flatten sink */
+            collect_input_volumes(u, i->origin_sink);
             continue;
         }
 
+        if (!input_volume_tracked(u, i))
+            continue;
+
         remapped_volume = i->volume;
-        pa_cvolume_remap(&remapped_volume, &i->channel_map, channel_map);
-        pa_cvolume_merge(max_volume, max_volume, &remapped_volume);
+        pa_cvolume_remap(&remapped_volume, &i->channel_map, &u->sink->channel_map);
+        pa_hashmap_put(u->input_volumes, i, pa_xnewdup(pa_cvolume, &remapped_volume, 1));
     }
 }
 
-static void update_mdrc_volume(struct userdata *u) {
-    pa_cvolume max_input_volume;
+/* Filter sinks moving in or out of our sink take their inputs along,
+ * this is rare enough to just start over. The new maximum is posted once,
+ * algorithms don't see the intermediate volumes. */
+static void rebuild_input_volumes(struct userdata *u) {
+    pa_hashmap_remove_all(u->input_volumes);
+    collect_input_volumes(u, u->sink);
+    rescan_max_input_volume(u);
+}
+
+static bool bypass_requested(pa_proplist *p) {
+    const char *v;
+
+    return (v = pa_proplist_gets(p, MUSIC_PROP_BYPASS)) && pa_parse_boolean(v) > 0;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_new_cb(pa_core *c, pa_sink_input_new_data *data, struct userdata *u) {
+    pa_sink *sink;
+
     pa_assert(u);
+    pa_assert(data);
 
-    pa_cvolume_mute(&max_input_volume, u->sink->channel_map.channels);
-    get_max_input_volume(u->sink, &max_input_volume, &u->sink->channel_map);
+    /* Streams without a sink go to the default sink, which is filled in
+     * only after this hook. */
+    sink = data->sink ? data->sink : pa_namereg_get(c, NULL, PA_NAMEREG_SINK);
+
+    if (sink == u->sink && bypass_requested(data->proplist)) {
+#if PULSEAUDIO_VERSION >= 12
+        if (pa_sink_input_new_data_set_sink(data, u->master_sink, false, false))
+#else
+        if (pa_sink_input_new_data_set_sink(data, u->master_sink, false))
+#endif
+            pa_log_debug("Stream bypasses %s, playing to %s", u->sink->name, u->master_sink->name);
+    }
 
-    meego_algorithm_hook_fire(u->hook_volume, &max_input_volume);
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_proplist_changed_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    if (!PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(i)))
+        return PA_HOOK_OK;
+
+    if (i->sink == u->sink && bypass_requested(i->proplist)) {
+        if (pa_sink_input_may_move_to(i, u->master_sink) && pa_sink_input_move_to(i, u->master_sink, false) >= 0)
+            pa_idxset_put(u->bypassed, i, NULL);
+    } else if (pa_idxset_get_by_data(u->bypassed, i, NULL) && !bypass_requested(i->proplist)) {
+        pa_idxset_remove_by_data(u->bypassed, i, NULL);
+        if (pa_sink_input_may_move_to(i, u->sink))
+            pa_sink_input_move_to(i, u->sink, false);
+    }
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_put_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    /* Redirected in sink_input_new_cb() */
+    if (i->sink == u->master_sink && bypass_requested(i->proplist))
+        pa_idxset_put(u->bypassed, i, NULL);
+
+    if (input_volume_tracked(u, i))
+        update_input_volume(u, i);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_unlink_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    pa_idxset_remove_by_data(u->bypassed, i, NULL);
+    remove_input_volume(u, i);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_volume_changed_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    if (input_volume_tracked(u, i))
+        update_input_volume(u, i);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_move_start_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    /* Moved elsewhere by someone else, forget bypass */
+    pa_idxset_remove_by_data(u->bypassed, i, NULL);
+    remove_input_volume(u, i);
+
+    return PA_HOOK_OK;
+}
+
+/* Called from main context */
+static pa_hook_result_t sink_input_move_finish_cb(pa_core *c, pa_sink_input *i, struct userdata *u) {
+    pa_assert(u);
+    pa_sink_input_assert_ref(i);
+
+    if (is_flat_filter_input(i))
+        rebuild_input_volumes(u);
+    else if (input_volume_tracked(u, i))
+        update_input_volume(u, i);
+
+    return PA_HOOK_OK;
+}
+
+static void connect_core_hooks(struct userdata *u) {
+    u->input_volumes = pa_hashmap_new_full(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func,
+                                           NULL, pa_xfree);
+    pa_cvolume_mute(&u->max_input_volume, u->sink->channel_map.channels);
+    u->bypassed = pa_idxset_new(NULL, NULL);
+
+    u->sink_input_put_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT],
+                                             PA_HOOK_LATE, (pa_hook_cb_t) sink_input_put_cb, u);
+    u->sink_input_unlink_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK],
+                                                PA_HOOK_LATE, (pa_hook_cb_t) sink_input_unlink_cb, u);
+    u->sink_input_volume_changed_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_VOLUME_CHANGED],
+                                                        PA_HOOK_LATE, (pa_hook_cb_t) sink_input_volume_changed_cb, u);
+    u->sink_input_move_start_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_START],
+                                                    PA_HOOK_LATE, (pa_hook_cb_t) sink_input_move_start_cb, u);
+    u->sink_input_move_finish_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_MOVE_FINISH],
+                                                     PA_HOOK_LATE, (pa_hook_cb_t) sink_input_move_finish_cb, u);
+    u->sink_input_new_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_NEW],
+                                             PA_HOOK_LATE, (pa_hook_cb_t) sink_input_new_cb, u);
+    u->sink_input_proplist_changed_slot = pa_hook_connect(&u->core->hooks[PA_CORE_HOOK_SINK_INPUT_PROPLIST_CHANGED],
+                                                          PA_HOOK_LATE, (pa_hook_cb_t) sink_input_proplist_changed_cb, u);
+}
+
+static void disconnect_core_hooks(struct userdata *u) {
+    if (u->sink_input_put_slot)
+        pa_hook_slot_free(u->sink_input_put_slot);
+    if (u->sink_input_unlink_slot)
+        pa_hook_slot_free(u->sink_input_unlink_slot);
+    if (u->sink_input_volume_changed_slot)
+        pa_hook_slot_free(u->sink_input_volume_changed_slot);
+    if (u->sink_input_move_start_slot)
+        pa_hook_slot_free(u->sink_input_move_start_slot);
+    if (u->sink_input_move_finish_slot)
+        pa_hook_slot_free(u->sink_input_move_finish_slot);
+
+    if (u->sink_input_new_slot)
+        pa_hook_slot_free(u->sink_input_new_slot);
+    if (u->sink_input_proplist_changed_slot)
+        pa_hook_slot_free(u->sink_input_proplist_changed_slot);
+
+    if (u->input_volumes)
+        pa_hashmap_free(u->input_volumes);
+    if (u->bypassed)
+        pa_idxset_free(u->bypassed, NULL);
 }
 
 /*** sink callbacks ***/
@@ -140,10 +445,9 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             *((pa_usec_t*) data) = usec;
             return 0;
         }
-        case PA_SINK_MESSAGE_SET_VOLUME: {
-            update_mdrc_volume(u);
-            // Pass trough to pa_sink_process_msg
-            break;
+        case SINK_MESSAGE_UPDATE_MDRC_VOLUME: {
+            meego_algorithm_hook_fire(u->hook_volume, data);
+            return 0;
         }
         case PA_SINK_MESSAGE_ADD_INPUT: {
             pa_sink_input *i = PA_SINK_INPUT(data);
@@ -192,17 +496,187 @@ static void sink_request_rewind(pa_sink *s) {
         pa_sink_input_request_rewind(u->sink_input, s->thread_info.rewind_nbytes, true, false, false);
 }
 
+/* Called from I/O thread context */
+static void update_window_size(struct userdata *u, pa_usec_t latency) {
+    music_window_bounds bounds;
+    pa_usec_t window;
+    size_t align;
+
+    bounds.min_usec = MUSIC_WINDOW_MIN_USEC;
+    bounds.max_usec = MUSIC_WINDOW_MAX_USEC;
+    meego_algorithm_hook_fire(u->hook_window_bounds, &bounds);
+
+    /* Process half of requested latency at a time, so that there is always
+     * a window in the master sink while next one is being rendered. */
+    if (latency == (pa_usec_t) -1)
+        window = MUSIC_WINDOW_DEFAULT_USEC;
+    else
+        window = latency / 2;
+
+    if (bounds.min_usec > bounds.max_usec) {
+        pa_log_warn("Algorithms declared conflicting window bounds %" PRIu64 " > %" PRIu64,
+                    bounds.min_usec, bounds.max_usec);
+        bounds.max_usec = bounds.min_usec;
+    }
+    window = PA_CLAMP(window, bounds.min_usec, bounds.max_usec);
+
+    /* deinterleave works in blocks of 8 frames */
+    align = 8 * pa_frame_size(&u->sink->sample_spec);
+    u->new_window_size = PA_MAX(align, (pa_usec_to_bytes(window, &u->sink->sample_spec) / align) * align);
+}
+
 /* Called from I/O thread context */
 static void sink_update_requested_latency(pa_sink *s) {
     struct userdata *u;
+    pa_usec_t latency;
 
     pa_sink_assert_ref(s);
     pa_assert_se(u = s->userdata);
 
+    latency = pa_sink_get_requested_latency_within_thread(s);
+
+    update_window_size(u, latency);
+
     /* Just hand this one over to the master sink */
     pa_sink_input_set_requested_latency_within_thread(
             u->sink_input,
-            pa_sink_get_requested_latency_within_thread(s));
+            latency);
+}
+
+/* Called from I/O thread context */
+static uint64_t oldest_rewind_position(struct userdata *u) {
+    uint64_t max_rewind = u->sink->thread_info.max_rewind / pa_frame_size(&u->sink->sample_spec);
+
+    return u->position > max_rewind ? u->position - max_rewind : 0;
+}
+
+/* Called from I/O thread context */
+static void save_checkpoint(struct userdata *u) {
+    music_checkpoint *cp;
+    uint64_t oldest = oldest_rewind_position(u);
+
+    /* Keep the newest checkpoint at or before oldest, rewinds all the way
+     * back still start from it. */
+    while (u->checkpoint_count > 1 &&
+           u->checkpoint[(u->checkpoint_first + 1) % CHECKPOINTS_MAX].position <= oldest) {
+        u->checkpoint_first = (u->checkpoint_first + 1) % CHECKPOINTS_MAX;
+        u->checkpoint_count--;
+    }
+
+    if (u->checkpoint_count == CHECKPOINTS_MAX) {
+        u->checkpoint_first = (u->checkpoint_first + 1) % CHECKPOINTS_MAX;
+        u->checkpoint_count--;
+    }
+
+    cp = &u->checkpoint[(u->checkpoint_first + u->checkpoint_count++) % CHECKPOINTS_MAX];
+    cp->position = u->position;
+    cp->algorithm_active = u->algorithm_active;
+    cp->fade_position = u->fade_position;
+    cp->fade_length = u->fade_length;
+
+    if (meego_algorithm_hook_enabled(u->hook_checkpoint)) {
+        music_rewind_data rewind_data;
+
+        rewind_data.position = u->position;
+        rewind_data.oldest_position = oldest;
+        meego_algorithm_hook_fire(u->hook_checkpoint, &rewind_data);
+    }
+}
+
+/* Called from I/O thread context. Restores the newest checkpoint at or
+ * before position and returns its position. With no checkpoint that old,
+ * fading is stopped and position is returned as is. */
+static uint64_t restore_checkpoint(struct userdata *u, uint64_t position) {
+    music_checkpoint *cp;
+
+    while (u->checkpoint_count > 0) {
+        cp = &u->checkpoint[(u->checkpoint_first + --u->checkpoint_count) % CHECKPOINTS_MAX];
+        if (cp->position > position)
+            continue;
+
+        /* Not kept, saved again when the window is rendered again */
+        u->algorithm_active = cp->algorithm_active;
+        u->fade_position = cp->fade_position;
+        u->fade_length = cp->fade_length;
+        return cp->position;
+    }
+
+    u->fade_length = 0;
+    return position;
+}
+
+/* Called from I/O thread context */
+static void process_window(struct userdata *u, const pa_memchunk *chunk, pa_memchunk *out_chunk) {
+    meego_algorithm_hook_data data;
+    meego_algorithm_hook_format format;
+    unsigned c;
+
+    /* Convert sample format only when entering and leaving the chain,
+     * algorithm hook converts between slots only where formats differ. */
+    data.channels = u->sink->sample_spec.channels;
+    format = meego_algorithm_hook_input_format(u->hook_algorithm);
+    if (format == MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32)
+        pa_optimized_deinterleave_to_float(chunk, data.channel, data.channels);
+    else
+        pa_optimized_deinterleave(chunk, data.channel, data.channels);
+
+    meego_algorithm_hook_fire_data(u->hook_algorithm, &data, &format);
+
+    if (format == MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32)
+        pa_optimized_interleave_from_float(data.channel, out_chunk, data.channels);
+    else
+        pa_optimized_interleave(data.channel, out_chunk, data.channels);
+
+    for (c = 0; c < data.channels; c++)
+        pa_memblock_unref(data.channel[c].memblock);
+}
+
+/* Called from I/O thread context */
+static void render_window(struct userdata *u, pa_memchunk *chunk) {
+    bool enabled;
+    unsigned frames;
+    pa_memchunk out_chunk;
+
+    save_checkpoint(u);
+
+    pa_sink_render_full(u->sink, u->window_size, chunk);
+    frames = chunk->length / pa_frame_size(&u->sink->sample_spec);
+
+    enabled = meego_algorithm_hook_enabled(u->hook_algorithm);
+    if (enabled != u->algorithm_active) {
+        u->algorithm_active = enabled;
+        u->fade_position = 0;
+        u->fade_length = pa_usec_to_bytes(CROSSFADE_USEC, &u->sink->sample_spec) /
+                         pa_frame_size(&u->sink->sample_spec);
+        pa_log_debug("Algorithms %s, crossfading %u frames", enabled ? "enabled" : "disabled", u->fade_length);
+    }
+
+    if ((enabled || u->fade_length > 0) && !pa_memblock_is_silence(chunk->memblock)) {
+
+        process_window(u, chunk, &out_chunk);
+
+        if (enabled) {
+            /* Fade in from unprocessed signal */
+            if (u->fade_length > 0)
+                pa_optimized_crossfade(chunk, &out_chunk, u->sink->sample_spec.channels,
+                                       u->fade_position, u->fade_length);
+
+            pa_memblock_unref(chunk->memblock);
+            *chunk = out_chunk;
+        } else {
+            /* Fade out to unprocessed signal, the hook still calls the
+             * algorithms that were enabled. */
+            pa_memchunk_make_writable(chunk, 0);
+            pa_optimized_crossfade(&out_chunk, chunk, u->sink->sample_spec.channels,
+                                   u->fade_position, u->fade_length);
+            pa_memblock_unref(out_chunk.memblock);
+        }
+    }
+
+    if (u->fade_length > 0 && (u->fade_position += frames) >= u->fade_length)
+        u->fade_length = 0;
+
+    u->position += frames;
 }
 
 /*** sink_input callbacks ***/
@@ -216,6 +690,17 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
     if (u->sink->thread_info.rewind_requested)
         pa_sink_process_rewind(u->sink, 0);
 
+    /* Window changes only between windows, rendered data stays continuous. */
+    if (u->new_window_size != u->window_size) {
+        music_window_size size;
+
+        u->window_size = u->new_window_size;
+        size.frames = u->window_size / pa_frame_size(&u->sink->sample_spec);
+        size.usec = pa_bytes_to_usec(u->window_size, &u->sink->sample_spec);
+        pa_log_debug("window size: %zu (%" PRIu64 " usec)", u->window_size, size.usec);
+        meego_algorithm_hook_fire(u->hook_window_size, &size);
+    }
+
     if (!PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
         /* There are no clients playing to music sink,
            let's just cut out silence and be done with it. */
@@ -225,35 +710,24 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk
                                 &i->sample_spec,
                                 length);
     } else {
-        pa_sink_render_full(u->sink, u->window_size, chunk);
-
-        if (!pa_memblock_is_silence(chunk->memblock)
-            && meego_algorithm_hook_enabled(u->hook_algorithm)) {
-
-            meego_algorithm_hook_data data;
-            short *dst;
-            const short *s_bufs[2];
-
-            pa_memchunk_make_writable(chunk, 0);
+        size_t frame_size = pa_frame_size(&u->sink->sample_spec);
+        size_t skip;
 
-            data.channels = 2;
-            pa_optimized_deinterleave_stereo_to_mono(chunk, &data.channel[0], &data.channel[1]);
+        /* Frames up to the rewind position are still in master sink, they
+         * are rendered again only to bring algorithms to the same state. */
+        for (;;) {
+            render_window(u, chunk);
 
-            meego_algorithm_hook_fire(u->hook_algorithm, &data);
+            skip = PA_MIN(u->skip_frames * frame_size, chunk->length);
+            u->skip_frames -= skip / frame_size;
+            if (skip < chunk->length)
+                break;
 
-            dst = pa_memblock_acquire(chunk->memblock);
-            dst += chunk->index / sizeof(short);
-            s_bufs[0] = pa_memblock_acquire(data.channel[0].memblock);
-            s_bufs[1] = pa_memblock_acquire(data.channel[1].memblock);
-
-            interleave_mono_to_stereo(s_bufs, dst, data.channel[0].length / sizeof(short));
-
-            pa_memblock_release(chunk->memblock);
-            pa_memblock_release(data.channel[0].memblock);
-            pa_memblock_release(data.channel[1].memblock);
-            pa_memblock_unref(data.channel[0].memblock);
-            pa_memblock_unref(data.channel[1].memblock);
+            pa_memblock_unref(chunk->memblock);
         }
+
+        chunk->index += skip;
+        chunk->length -= skip;
     }
 
     return 0;
@@ -276,9 +750,42 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
     }
 
+    if (amount > 0) {
+        size_t frame_size = pa_frame_size(&u->sink->sample_spec);
+        uint64_t played, position, start;
+
+        /* Master sink holds our output up to played, skipped frames included */
+        played = u->position + u->skip_frames;
+        position = played > amount / frame_size ? played - amount / frame_size : 0;
+
+        /* Rewind further to the start of the window the stream continues
+         * in, so that it is processed from the state saved there. */
+        start = PA_MIN(restore_checkpoint(u, position), u->position);
+        amount = (u->position - start) * frame_size;
+        u->skip_frames = position - start;
+        u->position = start;
+
+        /* Roll algorithm state back to where rendering continues from */
+        if (meego_algorithm_hook_enabled(u->hook_restore)) {
+            music_rewind_data rewind_data;
+
+            rewind_data.position = start;
+            rewind_data.oldest_position = oldest_rewind_position(u);
+            meego_algorithm_hook_fire(u->hook_restore, &rewind_data);
+        }
+    }
+
     pa_sink_process_rewind(u->sink, amount);
 }
 
+/* Called from I/O thread context */
+static void update_max_rewind(struct userdata *u, size_t nbytes) {
+    /* Music sink renders up to a window ahead of master sink, and rewinds
+     * back to a window start, see sink_input_process_rewind_cb(). */
+    pa_sink_set_max_rewind_within_thread(u->sink, nbytes +
+                                         2 * pa_usec_to_bytes(MUSIC_WINDOW_MAX_USEC, &u->sink->sample_spec));
+}
+
 /* Called from I/O thread context */
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
@@ -289,7 +796,7 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     if (!u->sink || !PA_SINK_IS_LINKED(u->sink->thread_info.state))
         return;
 
-    pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
+    update_max_rewind(u, nbytes);
 }
 
 /* Called from I/O thread context */
@@ -379,7 +886,7 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     else
         pa_sink_set_fixed_latency_within_thread(u->sink, i->sink->thread_info.fixed_latency);
     pa_sink_set_max_request_within_thread(u->sink, pa_sink_input_get_max_request(i));
-    pa_sink_set_max_rewind_within_thread(u->sink, i->sink->thread_info.max_rewind);
+    update_max_rewind(u, i->sink->thread_info.max_rewind);
     pa_log_debug("%s (flags=0x%04x) updated min_l=%" PRIu64 " max_l=%" PRIu64 " fixed_l=%" PRIu64 " max_req=%zu max_rew=%zu",
                  u->sink->name, u->sink->flags,
                  u->sink->thread_info.min_latency, u->sink->thread_info.max_latency,
@@ -468,12 +975,21 @@ static void sink_input_state_change_cb(pa_sink_input *i, pa_sink_input_state_t s
 static void set_hooks(struct userdata *u) {
     u->algorithm = meego_algorithm_hook_api_get(u->core);
     u->hook_algorithm   = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE);
+    meego_algorithm_hook_set_fade_out(u->hook_algorithm, true);
     u->hook_volume      = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE_VOLUME);
+    u->hook_checkpoint  = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE_CHECKPOINT);
+    u->hook_restore     = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE_RESTORE);
+    u->hook_window_bounds = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE_WINDOW_BOUNDS);
+    u->hook_window_size = meego_algorithm_hook_init(u->algorithm, MUSIC_HOOK_DYNAMIC_ENHANCE_WINDOW_SIZE);
 }
 
 static void unset_hooks(struct userdata *u) {
     meego_algorithm_hook_done(u->hook_algorithm);
     meego_algorithm_hook_done(u->hook_volume);
+    meego_algorithm_hook_done(u->hook_checkpoint);
+    meego_algorithm_hook_done(u->hook_restore);
+    meego_algorithm_hook_done(u->hook_window_bounds);
+    meego_algorithm_hook_done(u->hook_window_size);
 
     meego_algorithm_hook_api_unref(u->algorithm);
     u->algorithm = NULL;
@@ -520,17 +1036,19 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    /*
-      ss = master_sink->sample_spec;
-      map = master_sink->channel_map;
-    */
+    ss = master_sink->sample_spec;
+    map = master_sink->channel_map;
 
     ss.format = PA_SAMPLE_S16LE;
 
     //ss.format = master_sink->sample_spec.format;
     ss.rate = SAMPLE_RATE_HW_HZ;
-    ss.channels = 2;
-    pa_channel_map_init_stereo(&map);
+    if (ss.channels > MEEGO_ALGORITHM_HOOK_CHANNELS_MAX) {
+        pa_log_warn("Master sink has %u channels, algorithms support up to %u, using stereo",
+                    ss.channels, MEEGO_ALGORITHM_HOOK_CHANNELS_MAX);
+        ss.channels = 2;
+        pa_channel_map_init_stereo(&map);
+    }
 
     m->userdata = u;
     u->core = m->core;
@@ -541,7 +1059,8 @@ int pa__init(pa_module*m) {
     // The result is rounded down incorrectly thus 5001...
     // 5000 us = 5 ms
     // 20000 us = 20 ms
-    u->window_size = pa_usec_to_bytes(20001, &ss);
+    u->window_size = pa_usec_to_bytes(MUSIC_WINDOW_DEFAULT_USEC + 1, &ss);
+    u->new_window_size = u->window_size;
     //u->window_size = 160;
     //u->window_size = 960;
     pa_log_debug("window size: %zu frame size: %zu",  u->window_size, pa_frame_size(&ss));
@@ -625,6 +1144,8 @@ int pa__init(pa_module*m) {
 
     u->sink->input_to_master = u->sink_input;
 
+    connect_core_hooks(u);
+
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
 
@@ -648,6 +1169,8 @@ void pa__done(pa_module*m) {
     if (!(u = m->userdata))
         return;
 
+    disconnect_core_hooks(u);
+
     unset_hooks(u);
 
     if (u->sink_input) {
@@ -22,14 +22,84 @@
 #ifndef module_music_api_h
 #define module_music_api_h
 
-#define MUSIC_API_VERSION "0.1"
+#include <stdint.h>
+#include <stddef.h>
 
-/* Type: meego_algorithm_hook_data      Channels: 2 */
+#define MUSIC_API_VERSION "0.3"
+
+/* Sink inputs with this property set to true are played to the master sink
+ * directly instead of through music sink, so they are mixed after the
+ * algorithm chain (for example already mastered content). Can be changed
+ * while playing, the stream is moved accordingly. */
+#define MUSIC_PROP_BYPASS                       "x-meego.music.bypass"
+
+/* Type: meego_algorithm_hook_data      Channels: as master sink, 1 to
+ * MEEGO_ALGORITHM_HOOK_CHANNELS_MAX. Masters with more channels fall back
+ * to stereo. Implementors read the count from meego_algorithm_hook_data
+ * channels and the map from the music sink. */
 #define MUSIC_HOOK_DYNAMIC_ENHANCE              "x-meego.music.dynamic_enhance"
 
 /* Type: pa_cvolume                     Channels: > 0 */
 #define MUSIC_HOOK_DYNAMIC_ENHANCE_VOLUME       "x-meego.music.dynamic_enhance_volume"
 
+/* Rewind support for MUSIC_HOOK_DYNAMIC_ENHANCE implementors.
+ *
+ * Before each rendered window, silent ones and ones with algorithms
+ * disabled included, music sink fires the checkpoint hook with the stream
+ * position (in frames) of the first frame of the window. Implementors save
+ * their processing state keyed by that position. Saved states older than
+ * oldest_position can't be rewound to anymore and may be dropped.
+ *
+ * When music sink is rewound, it rolls back to the start of the window
+ * the stream continues in, fires the restore hook with that position and
+ * renders from there again, dropping the frames master sink already has.
+ * The restore position is therefore always a checkpointed one, and the
+ * output is the same as without the rewind. Only when rewinding past the
+ * oldest checkpoint kept, implementors find no saved state and reset.
+ *
+ * Music sink advertises the max_rewind of the master sink plus two windows
+ * of MUSIC_WINDOW_MAX_USEC, one rendered ahead of master sink and one to
+ * reach a window start. Rewinding further than that needs a master sink
+ * with a long max_rewind (tsched).
+ *
+ * Type: music_rewind_data */
+#define MUSIC_HOOK_DYNAMIC_ENHANCE_CHECKPOINT   "x-meego.music.dynamic_enhance_checkpoint"
+#define MUSIC_HOOK_DYNAMIC_ENHANCE_RESTORE      "x-meego.music.dynamic_enhance_restore"
+
+typedef struct music_rewind_data {
+    uint64_t position;
+    uint64_t oldest_position;
+} music_rewind_data;
+
+/* Processing window follows requested latency of music sink, between
+ * MUSIC_WINDOW_MIN_USEC (low latency) and MUSIC_WINDOW_MAX_USEC (power save).
+ * Without latency requests MUSIC_WINDOW_DEFAULT_USEC is used.
+ *
+ * Before choosing a new window, music sink fires the bounds hook with
+ * its own limits. Implementors that can't handle the whole range narrow
+ * min_usec and max_usec, but never widen them.
+ *
+ * When the window changes, the size hook is fired from IO thread before
+ * the first window of new size is processed.
+ *
+ * Type: music_window_bounds / music_window_size */
+#define MUSIC_HOOK_DYNAMIC_ENHANCE_WINDOW_BOUNDS "x-meego.music.dynamic_enhance_window_bounds"
+#define MUSIC_HOOK_DYNAMIC_ENHANCE_WINDOW_SIZE  "x-meego.music.dynamic_enhance_window_size"
+
+#define MUSIC_WINDOW_MIN_USEC       (5000)
+#define MUSIC_WINDOW_DEFAULT_USEC   (20000)
+#define MUSIC_WINDOW_MAX_USEC       (200000)
+
+typedef struct music_window_bounds {
+    uint64_t min_usec;
+    uint64_t max_usec;
+} music_window_bounds;
+
+typedef struct music_window_size {
+    size_t frames;      /* frames per channel in each processed window */
+    uint64_t usec;
+} music_window_size;
+
 #define PA_PROP_SINK_MUSIC_API_EXTENSION_PROPERTY_NAME "sink.api-extension.meego.music"
 #define PA_PROP_SINK_MUSIC_API_EXTENSION_PROPERTY_VALUE MUSIC_API_VERSION
 
@@ -33,6 +33,10 @@
 #include <meego/parameter-hook-implementor.h>
 #include <meego/shared-data.h>
 
+#include "parameter-store.h"
+#include "parameter-loader.h"
+#include "parameter-watcher.h"
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -40,14 +44,23 @@ struct userdata {
 
     pa_hook mode_hook;
     const char *mode;
-    unsigned hash;
 
     struct parameters {
         const char *directory;
         bool cache;
         bool use_voice;
+        bool watch;
+        parameter_store *store; /* contents of all loaded sets */
+        parameter_loader *loader;
+        char *pending_mode; /* switch waiting for the loader to scan the mode */
+        parameter_watcher *watcher;
+        char *modes_directory; /* canonical path, set when watching */
         PA_LLIST_HEAD(struct mode, modes); /* list of all modes */
         PA_LLIST_HEAD(struct algorithm, algorithms); /* list of all algorithms */
+        pa_hashmap *mode_map; /* mode name -> struct mode */
+        pa_hashmap *algorithm_map; /* algorithm name -> struct algorithm */
+        pa_hashmap *plans; /* "from\nto" mode names -> struct transition_plan */
+        unsigned plan_generation; /* bumped whenever plans are invalidated */
     } parameters;
 
     meego_parameter_hook_implementor_args implementor_args;
@@ -40,7 +40,8 @@ PA_MODULE_DESCRIPTION("Meego parameters module");
 PA_MODULE_USAGE("directory=<parameter directory> "
                 "cache=<boolean> "
                 "initial_mode=<the mode in which to start> "
-                "use_voice=<true/false use voice module for mode detection, default true>");
+                "use_voice=<true/false use voice module for mode detection, default true> "
+                "watch=<true/false reload changed parameter files automatically, default false>");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 
 static const char* const valid_modargs[] = {
@@ -48,6 +49,7 @@ static const char* const valid_modargs[] = {
     "cache",
     "initial_mode",
     "use_voice",
+    "watch",
     NULL,
 };
 
@@ -155,6 +157,11 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "watch", &u->parameters.watch) < 0) {
+        pa_log("watch= expects a boolean argument.");
+        goto fail;
+    }
+
     if (!(u->shared = pa_shared_data_get(u->core))) {
         pa_log("Failed to get shared data object.");
         goto fail;
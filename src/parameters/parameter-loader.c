@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <dirent.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/thread.h>
+
+#include "parameter-loader.h"
+
+struct request {
+    char *mode;
+
+    PA_LLIST_FIELDS(struct request);
+};
+
+struct parameter_loader {
+    char *directory;
+    bool load_sets;
+
+    pa_mainloop_api *api;
+    pa_io_event *io_event;
+    int pipe[2];
+
+    parameter_loader_cb_t cb;
+    void *userdata;
+
+    pa_thread *thread;
+    pa_mutex *mutex;
+    pa_cond *cond;
+
+    /* Protected by mutex */
+    bool quit;
+    bool prefetch;
+    PA_LLIST_HEAD(struct request, urgent);
+    PA_LLIST_HEAD(struct request, prefetched);
+    PA_LLIST_HEAD(parameter_scan, done);
+};
+
+static char *readlink_malloc(const char *filename) {
+    int size = 100;
+    char *buffer = NULL;
+
+    while (1) {
+        buffer = (char *)realloc(buffer, size);
+        int nchars = readlink(filename, buffer, size);
+        if (nchars < 0) {
+            free(buffer);
+            return NULL;
+        }
+        if (nchars < (size - 1)) {
+            buffer[nchars] = '\0';
+            return buffer;
+        }
+        size *= 2;
+    }
+}
+
+char *parameter_set_path(const char *path, const char *sym) {
+    char *name;
+    char *sym_value;
+    char *abs_name;
+
+    name = pa_sprintf_malloc("%s/%s", path, sym);
+    sym_value = readlink_malloc(name);
+    pa_xfree(name);
+
+    if (!sym_value)
+        return NULL;
+
+    name = pa_sprintf_malloc("%s/%s", path, sym_value);
+    free(sym_value);
+
+    abs_name = canonicalize_file_name(name);
+    pa_xfree(name);
+
+    return abs_name;
+}
+
+static int file_select(const struct dirent *entry) {
+    return entry->d_name[0] != '.';
+}
+
+parameter_scan *parameter_scan_mode(const char *directory, const char *mode, bool load_sets) {
+    parameter_scan *scan;
+    parameter_scan_entry *entry;
+    struct dirent **namelist;
+    char *path;
+    char *setname;
+    int n;
+
+    pa_assert(directory);
+    pa_assert(mode);
+
+    scan = pa_xnew0(parameter_scan, 1);
+    scan->mode = pa_xstrdup(mode);
+
+    path = pa_sprintf_malloc("%s/modes/%s", directory, mode);
+
+    pa_log_debug("Scanning mode from %s", path);
+
+    if ((n = scandir(path, &namelist, file_select, alphasort)) >= 0) {
+        scan->found = true;
+        scan->entries = pa_xnew0(parameter_scan_entry, n > 0 ? n : 1);
+
+        while (n--) {
+            if ((setname = parameter_set_path(path, namelist[n]->d_name)) != NULL) {
+                entry = &scan->entries[scan->n_entries++];
+                entry->algorithm = pa_xstrdup(namelist[n]->d_name);
+                entry->set = setname;
+
+                if (load_sets)
+                    entry->blob = parameter_blob_load(setname, &entry->file_id);
+            } else
+                pa_log_debug("%s is not a symlink", namelist[n]->d_name);
+
+            free(namelist[n]);
+        }
+        free(namelist);
+    }
+
+    pa_xfree(path);
+
+    return scan;
+}
+
+void parameter_scan_free(parameter_scan *scan) {
+    unsigned i;
+
+    pa_assert(scan);
+
+    for (i = 0; i < scan->n_entries; i++) {
+        pa_xfree(scan->entries[i].algorithm);
+        free(scan->entries[i].set);
+        if (scan->entries[i].blob)
+            parameter_blob_free(scan->entries[i].blob);
+    }
+
+    pa_xfree(scan->entries);
+    pa_xfree(scan->mode);
+    pa_xfree(scan);
+}
+
+/* Called with mutex held */
+static struct request *find_request(struct request *head, const char *mode) {
+    struct request *r;
+
+    PA_LLIST_FOREACH(r, head) {
+        if (pa_streq(r->mode, mode))
+            return r;
+    }
+
+    return NULL;
+}
+
+/* Called from loader thread context */
+static void queue_prefetch(parameter_loader *l) {
+    struct dirent **namelist;
+    struct request *r;
+    char *path;
+    int n;
+
+    path = pa_sprintf_malloc("%s/modes", l->directory);
+
+    if ((n = scandir(path, &namelist, file_select, alphasort)) >= 0) {
+        pa_mutex_lock(l->mutex);
+        while (n--) {
+            if (!find_request(l->urgent, namelist[n]->d_name) &&
+                !find_request(l->prefetched, namelist[n]->d_name)) {
+                r = pa_xnew0(struct request, 1);
+                r->mode = pa_xstrdup(namelist[n]->d_name);
+                PA_LLIST_PREPEND(struct request, l->prefetched, r);
+            }
+            free(namelist[n]);
+        }
+        pa_mutex_unlock(l->mutex);
+        free(namelist);
+    } else
+        pa_log_warn("Failed to scan %s for prefetch", path);
+
+    pa_xfree(path);
+}
+
+/* Called from loader thread context. Loads the set files of scan. A
+ * prefetch gives way to urgent requests between set files, in which case
+ * false is returned and the scan is left incomplete. */
+static bool load_sets(parameter_loader *l, parameter_scan *scan, bool urgent) {
+    parameter_scan_entry *entry;
+    bool preempt;
+    unsigned i;
+
+    for (i = 0; i < scan->n_entries; i++) {
+        if (!urgent) {
+            pa_mutex_lock(l->mutex);
+            preempt = l->urgent || l->quit;
+            pa_mutex_unlock(l->mutex);
+
+            if (preempt)
+                return false;
+        }
+
+        entry = &scan->entries[i];
+        entry->blob = parameter_blob_load(entry->set, &entry->file_id);
+    }
+
+    return true;
+}
+
+/* Called from loader thread context */
+static void thread_func(void *userdata) {
+    parameter_loader *l = userdata;
+    parameter_scan *scan;
+    struct request *r;
+    bool urgent;
+    char c = 1;
+
+    pa_log_debug("Parameter loader thread starting up");
+
+    pa_mutex_lock(l->mutex);
+
+    for (;;) {
+        while (!l->quit && !l->urgent && !l->prefetched && !l->prefetch)
+            pa_cond_wait(l->cond, l->mutex);
+
+        if (l->quit)
+            break;
+
+        if (l->prefetch && !l->urgent) {
+            l->prefetch = false;
+            pa_mutex_unlock(l->mutex);
+            queue_prefetch(l);
+            pa_mutex_lock(l->mutex);
+            continue;
+        }
+
+        if ((r = l->urgent)) {
+            PA_LLIST_REMOVE(struct request, l->urgent, r);
+            urgent = true;
+        } else if ((r = l->prefetched)) {
+            PA_LLIST_REMOVE(struct request, l->prefetched, r);
+            urgent = false;
+        } else
+            continue;
+
+        pa_mutex_unlock(l->mutex);
+
+        scan = parameter_scan_mode(l->directory, r->mode, false);
+
+        if (l->load_sets && !load_sets(l, scan, urgent)) {
+            /* Redo the prefetch after the urgent request, unless that one
+             * is for the same mode */
+            parameter_scan_free(scan);
+            pa_mutex_lock(l->mutex);
+            if (!find_request(l->urgent, r->mode))
+                PA_LLIST_PREPEND(struct request, l->prefetched, r);
+            else {
+                pa_xfree(r->mode);
+                pa_xfree(r);
+            }
+            continue;
+        }
+
+        pa_xfree(r->mode);
+        pa_xfree(r);
+
+        pa_mutex_lock(l->mutex);
+
+        PA_LLIST_PREPEND(parameter_scan, l->done, scan);
+
+        /* The pipe is non-blocking. If it's full a wakeup is pending anyway. */
+        if (write(l->pipe[1], &c, 1) < 0 && errno != EAGAIN)
+            pa_log_warn("Failed to wake up main loop: %s", pa_cstrerror(errno));
+    }
+
+    pa_mutex_unlock(l->mutex);
+
+    pa_log_debug("Parameter loader thread shutting down");
+}
+
+static void io_cb(pa_mainloop_api *api, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    parameter_loader *l = userdata;
+    parameter_scan *done, *scan;
+    char buf[32];
+
+    pa_assert(l);
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    pa_mutex_lock(l->mutex);
+    done = l->done;
+    PA_LLIST_HEAD_INIT(parameter_scan, l->done);
+    pa_mutex_unlock(l->mutex);
+
+    if (!done)
+        return;
+
+    /* Deliver in the order the scans finished */
+    while (done->next)
+        done = done->next;
+
+    while ((scan = done)) {
+        done = scan->prev;
+        scan->next = scan->prev = NULL;
+        l->cb(scan, l->userdata);
+    }
+}
+
+parameter_loader *parameter_loader_new(pa_mainloop_api *api, const char *directory, bool load_sets,
+                                       parameter_loader_cb_t cb, void *userdata) {
+    parameter_loader *l;
+
+    pa_assert(api);
+    pa_assert(directory);
+    pa_assert(cb);
+
+    l = pa_xnew0(parameter_loader, 1);
+    l->directory = pa_xstrdup(directory);
+    l->load_sets = load_sets;
+    l->api = api;
+    l->cb = cb;
+    l->userdata = userdata;
+    l->pipe[0] = l->pipe[1] = -1;
+    l->mutex = pa_mutex_new(false, false);
+    l->cond = pa_cond_new();
+    PA_LLIST_HEAD_INIT(struct request, l->urgent);
+    PA_LLIST_HEAD_INIT(struct request, l->prefetched);
+    PA_LLIST_HEAD_INIT(parameter_scan, l->done);
+
+    if (pa_pipe_cloexec(l->pipe) < 0) {
+        pa_log("Failed to create pipe: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    pa_make_fd_nonblock(l->pipe[0]);
+    pa_make_fd_nonblock(l->pipe[1]);
+
+    l->io_event = api->io_new(api, l->pipe[0], PA_IO_EVENT_INPUT, io_cb, l);
+
+    if (!(l->thread = pa_thread_new("param-loader", thread_func, l))) {
+        pa_log("Failed to create parameter loader thread");
+        goto fail;
+    }
+
+    return l;
+
+fail:
+    parameter_loader_free(l);
+    return NULL;
+}
+
+void parameter_loader_free(parameter_loader *l) {
+    struct request *r;
+    parameter_scan *scan;
+
+    pa_assert(l);
+
+    if (l->thread) {
+        pa_mutex_lock(l->mutex);
+        l->quit = true;
+        pa_cond_signal(l->cond, false);
+        pa_mutex_unlock(l->mutex);
+
+        pa_thread_free(l->thread);
+    }
+
+    if (l->io_event)
+        l->api->io_free(l->io_event);
+
+    if (l->pipe[0] >= 0)
+        pa_close_pipe(l->pipe);
+
+    while ((r = l->urgent)) {
+        PA_LLIST_REMOVE(struct request, l->urgent, r);
+        pa_xfree(r->mode);
+        pa_xfree(r);
+    }
+
+    while ((r = l->prefetched)) {
+        PA_LLIST_REMOVE(struct request, l->prefetched, r);
+        pa_xfree(r->mode);
+        pa_xfree(r);
+    }
+
+    while ((scan = l->done)) {
+        PA_LLIST_REMOVE(parameter_scan, l->done, scan);
+        parameter_scan_free(scan);
+    }
+
+    pa_cond_free(l->cond);
+    pa_mutex_free(l->mutex);
+    pa_xfree(l->directory);
+    pa_xfree(l);
+}
+
+void parameter_loader_request(parameter_loader *l, const char *mode, bool urgent) {
+    struct request *r;
+
+    pa_assert(l);
+    pa_assert(mode);
+
+    pa_mutex_lock(l->mutex);
+
+    if (find_request(l->urgent, mode))
+        goto finish;
+
+    if ((r = find_request(l->prefetched, mode))) {
+        if (!urgent)
+            goto finish;
+        PA_LLIST_REMOVE(struct request, l->prefetched, r);
+    } else {
+        r = pa_xnew0(struct request, 1);
+        r->mode = pa_xstrdup(mode);
+    }
+
+    if (urgent)
+        PA_LLIST_PREPEND(struct request, l->urgent, r);
+    else
+        PA_LLIST_PREPEND(struct request, l->prefetched, r);
+
+    pa_cond_signal(l->cond, false);
+
+finish:
+    pa_mutex_unlock(l->mutex);
+}
+
+void parameter_loader_prefetch(parameter_loader *l) {
+    pa_assert(l);
+
+    pa_mutex_lock(l->mutex);
+    l->prefetch = true;
+    pa_cond_signal(l->cond, false);
+    pa_mutex_unlock(l->mutex);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef _parameter_loader_h_
+#define _parameter_loader_h_
+
+#include <pulse/mainloop-api.h>
+#include <pulsecore/llist.h>
+
+#include "parameter-store.h"
+
+/*
+ * Scanning of mode directories, either synchronously or in a background
+ * loader thread.
+ *
+ * A mode directory <directory>/modes/<mode> contains a symlink for every
+ * algorithm enabled in the mode, named after the algorithm and pointing
+ * to the parameter set file.
+ */
+
+typedef struct parameter_scan_entry {
+    char *algorithm;
+    char *set;              /* canonical path of the set file */
+    parameter_blob *blob;   /* loaded contents, not yet in any store, or NULL */
+    parameter_file_id file_id;
+} parameter_scan_entry;
+
+typedef struct parameter_scan parameter_scan;
+
+struct parameter_scan {
+    char *mode;
+    bool found;             /* false if the mode directory could not be read */
+    unsigned n_entries;
+    parameter_scan_entry *entries;
+
+    PA_LLIST_FIELDS(parameter_scan);
+};
+
+/* Canonical path of the set that symlink sym in directory path points to,
+ * or NULL if sym is not a symlink to an existing file. Free with pa_xfree. */
+char *parameter_set_path(const char *path, const char *sym);
+
+/* Scans a mode directory. If load_sets is true the set files are loaded
+ * as well. Always returns a scan, check found. */
+parameter_scan *parameter_scan_mode(const char *directory, const char *mode, bool load_sets);
+void parameter_scan_free(parameter_scan *scan);
+
+typedef struct parameter_loader parameter_loader;
+
+/* Called from main loop context for every finished scan. The callback
+ * takes ownership of the scan. */
+typedef void (*parameter_loader_cb_t)(parameter_scan *scan, void *userdata);
+
+/* Scans are done with load_sets, see parameter_scan_mode(). */
+parameter_loader *parameter_loader_new(pa_mainloop_api *api, const char *directory, bool load_sets,
+                                       parameter_loader_cb_t cb, void *userdata);
+void parameter_loader_free(parameter_loader *l);
+
+/* Queue mode for scanning. Urgent requests are served before prefetches,
+ * and a prefetch still loading set files is interrupted and redone later. */
+void parameter_loader_request(parameter_loader *l, const char *mode, bool urgent);
+
+/* Queue every mode found under <directory>/modes for scanning. */
+void parameter_loader_prefetch(parameter_loader *l);
+
+#endif
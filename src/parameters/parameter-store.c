@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "parameter-store.h"
+
+struct parameter_blob {
+    unsigned hash;
+    unsigned ref;
+    void *data;
+    size_t length;
+    /* Next blob with the same content hash. */
+    struct parameter_blob *next;
+};
+
+struct parameter_store {
+    /* content hash -> chain of blobs */
+    pa_hashmap *blobs;
+};
+
+/* 32-bit FNV-1a */
+static unsigned content_hash(const void *data, size_t length) {
+    const uint8_t *p = data;
+    uint32_t h = 2166136261U;
+
+    while (length--) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+parameter_store *parameter_store_new(void) {
+    parameter_store *st;
+
+    st = pa_xnew0(parameter_store, 1);
+    st->blobs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    return st;
+}
+
+void parameter_store_free(parameter_store *st) {
+    pa_assert(st);
+
+    /* All sets hold a reference to their blob, so they must be gone by now. */
+    pa_assert(pa_hashmap_isempty(st->blobs));
+
+    pa_hashmap_free(st->blobs);
+    pa_xfree(st);
+}
+
+static void blob_release_data(parameter_blob *b) {
+    pa_xfree(b->data);
+    b->data = NULL;
+}
+
+/* Contents are always copied to heap. A mapping would not be a snapshot:
+ * files truncated and rewritten in place (cp, shell redirection) would
+ * raise SIGBUS on access, and pages not yet read would show the new bytes,
+ * changing deduplicated blobs and invalidating their content hash. */
+static int blob_read(parameter_blob *b, int fd, size_t length) {
+    b->length = length;
+    b->data = pa_xmalloc(length + 1);
+
+    if (length > 0 && pa_loop_read(fd, b->data, length, NULL) != (ssize_t) length) {
+        pa_xfree(b->data);
+        b->data = NULL;
+        return -1;
+    }
+
+    ((char *) b->data)[length] = '\0';
+
+    return 0;
+}
+
+static parameter_blob *blob_find(parameter_store *st, const parameter_blob *b) {
+    parameter_blob *i;
+
+    for (i = pa_hashmap_get(st->blobs, PA_UINT_TO_PTR(b->hash)); i; i = i->next) {
+        if (i->length == b->length && memcmp(i->data, b->data, b->length) == 0)
+            return i;
+    }
+
+    return NULL;
+}
+
+parameter_blob *parameter_blob_load(const char *file, parameter_file_id *id) {
+    parameter_blob *b;
+    struct stat buf;
+    int fd;
+
+    pa_assert(file);
+
+    if ((fd = pa_open_cloexec(file, O_RDONLY, 0)) < 0) {
+        pa_log_warn("Failed to open %s: %s", file, pa_cstrerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &buf) < 0 || !S_ISREG(buf.st_mode)) {
+        pa_log_warn("%s is not a readable file", file);
+        pa_close(fd);
+        return NULL;
+    }
+
+    b = pa_xnew0(parameter_blob, 1);
+
+    if (blob_read(b, fd, (size_t) buf.st_size) < 0) {
+        pa_log_warn("Failed to read %s", file);
+        pa_close(fd);
+        pa_xfree(b);
+        return NULL;
+    }
+
+    pa_close(fd);
+
+    if (id) {
+        id->dev = buf.st_dev;
+        id->ino = buf.st_ino;
+        id->size = buf.st_size;
+        id->mtime = buf.st_mtime;
+    }
+
+    b->hash = content_hash(b->data, b->length);
+
+    return b;
+}
+
+void parameter_blob_free(parameter_blob *b) {
+    pa_assert(b);
+    pa_assert(b->ref == 0);
+
+    blob_release_data(b);
+    pa_xfree(b);
+}
+
+parameter_blob *parameter_store_add(parameter_store *st, parameter_blob *b) {
+    parameter_blob *shared, *head;
+
+    pa_assert(st);
+    pa_assert(b);
+    pa_assert(b->ref == 0);
+
+    if ((shared = blob_find(st, b))) {
+        pa_log_debug("Sharing %zu bytes of identical set contents", b->length);
+        parameter_blob_free(b);
+        shared->ref++;
+        return shared;
+    }
+
+    b->ref = 1;
+
+    if ((head = pa_hashmap_remove(st->blobs, PA_UINT_TO_PTR(b->hash))))
+        b->next = head;
+    pa_hashmap_put(st->blobs, PA_UINT_TO_PTR(b->hash), b);
+
+    return b;
+}
+
+parameter_blob *parameter_store_get(parameter_store *st, const char *file, parameter_file_id *id) {
+    parameter_blob *b;
+
+    pa_assert(st);
+
+    if (!(b = parameter_blob_load(file, id)))
+        return NULL;
+
+    return parameter_store_add(st, b);
+}
+
+void parameter_store_put(parameter_store *st, parameter_blob *b) {
+    parameter_blob *head, **i;
+
+    pa_assert(st);
+    pa_assert(b);
+    pa_assert(b->ref > 0);
+
+    if (--b->ref > 0)
+        return;
+
+    head = pa_hashmap_remove(st->blobs, PA_UINT_TO_PTR(b->hash));
+    pa_assert(head);
+
+    for (i = &head; *i != b; i = &(*i)->next)
+        pa_assert(*i);
+    *i = b->next;
+
+    if (head)
+        pa_hashmap_put(st->blobs, PA_UINT_TO_PTR(b->hash), head);
+
+    parameter_blob_free(b);
+}
+
+parameter_blob *parameter_blob_ref(parameter_blob *b) {
+    pa_assert(b);
+    pa_assert(b->ref > 0);
+
+    b->ref++;
+
+    return b;
+}
+
+const void *parameter_blob_data(const parameter_blob *b) {
+    pa_assert(b);
+
+    return b->data;
+}
+
+unsigned parameter_blob_length(const parameter_blob *b) {
+    pa_assert(b);
+
+    return (unsigned) b->length;
+}
+
+bool parameter_file_unchanged(const char *file, const parameter_file_id *id) {
+    struct stat buf;
+
+    pa_assert(file);
+    pa_assert(id);
+
+    if (stat(file, &buf) < 0)
+        return false;
+
+    return buf.st_dev == id->dev &&
+           buf.st_ino == id->ino &&
+           buf.st_size == id->size &&
+           buf.st_mtime == id->mtime;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef _parameter_store_h_
+#define _parameter_store_h_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+
+/*
+ * Read-only store for parameter set contents.
+ *
+ * Set files are read to heap once, and sets with identical contents share
+ * one copy. Blob data is always followed by a terminating '\0' that is not
+ * included in the length, so text parameters can be parsed in place. Blob
+ * data must never be written to.
+ */
+
+typedef struct parameter_store parameter_store;
+typedef struct parameter_blob parameter_blob;
+
+/* Identifies the file a blob was loaded from, used for detecting changes. */
+typedef struct parameter_file_id {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+} parameter_file_id;
+
+parameter_store *parameter_store_new(void);
+void parameter_store_free(parameter_store *st);
+
+/* Returns a referenced blob holding the contents of file, or NULL if the
+ * file can not be read. If id is not NULL it is filled with the identity
+ * of the file that was read. */
+parameter_blob *parameter_store_get(parameter_store *st, const char *file, parameter_file_id *id);
+void parameter_store_put(parameter_store *st, parameter_blob *b);
+parameter_blob *parameter_blob_ref(parameter_blob *b);
+
+/* parameter_store_get() in two steps. parameter_blob_load() does all the
+ * file access and doesn't touch the store, so it may be called from any
+ * thread. parameter_store_add() takes ownership of the loaded blob and
+ * returns a referenced blob, which may be an already stored one with the
+ * same contents. Loaded blobs that are never added are freed with
+ * parameter_blob_free(). */
+parameter_blob *parameter_blob_load(const char *file, parameter_file_id *id);
+parameter_blob *parameter_store_add(parameter_store *st, parameter_blob *b);
+void parameter_blob_free(parameter_blob *b);
+
+const void *parameter_blob_data(const parameter_blob *b);
+unsigned parameter_blob_length(const parameter_blob *b);
+
+/* Returns true if file still has the identity id. */
+bool parameter_file_unchanged(const char *file, const parameter_file_id *id);
+
+#endif
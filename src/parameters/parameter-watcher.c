@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#include "parameter-watcher.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* A burst of events is reported at the latest this many delays after it began. */
+#define MAX_DELAYS 4
+
+struct parameter_watcher {
+    pa_core *core;
+    int fd;
+    pa_io_event *io_event;
+
+    pa_usec_t delay;
+    pa_usec_t first_event;
+    pa_time_event *time_event;
+
+    /* wd -> watched directory path */
+    pa_hashmap *watches;
+
+    pa_idxset *changed;
+    bool overflow;
+
+    parameter_watcher_cb_t cb;
+    void *userdata;
+};
+
+static void flush_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    parameter_watcher *w = userdata;
+    pa_idxset *changed;
+    bool overflow;
+
+    pa_assert(w);
+    pa_assert(e == w->time_event);
+
+    w->core->mainloop->time_free(w->time_event);
+    w->time_event = NULL;
+
+    /* The callback may add watches, so hand over a fresh batch first */
+    changed = w->changed;
+    overflow = w->overflow;
+    w->changed = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    w->overflow = false;
+
+    pa_log_debug("Reporting %u changed parameter paths%s", pa_idxset_size(changed),
+                 overflow ? " (event queue overflow)" : "");
+
+    w->cb(w, changed, overflow, w->userdata);
+
+    pa_idxset_free(changed, pa_xfree);
+}
+
+static void schedule_flush(parameter_watcher *w) {
+    pa_usec_t now, when;
+
+    now = pa_rtclock_now();
+
+    if (!w->time_event) {
+        w->first_event = now;
+        w->time_event = pa_core_rttime_new(w->core, now + w->delay, flush_cb, w);
+        return;
+    }
+
+    when = PA_MIN(now + w->delay, w->first_event + MAX_DELAYS * w->delay);
+    pa_core_rttime_restart(w->core, w->time_event, when);
+}
+
+static void mark_changed(parameter_watcher *w, char *path) {
+    if (pa_idxset_put(w->changed, path, NULL) < 0)
+        pa_xfree(path);
+}
+
+static void io_cb(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    parameter_watcher *w = userdata;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    const char *directory;
+    ssize_t r;
+    char *p;
+
+    pa_assert(w);
+
+    while ((r = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + r; p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) p;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                pa_log_warn("Parameter watch event queue overflow");
+                w->overflow = true;
+                continue;
+            }
+
+            if (!(directory = pa_hashmap_get(w->watches, PA_INT_TO_PTR(event->wd))))
+                continue;
+
+            if (event->mask & IN_IGNORED) {
+                pa_log_debug("Stopped watching %s", directory);
+                pa_xfree(pa_hashmap_remove(w->watches, PA_INT_TO_PTR(event->wd)));
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                mark_changed(w, pa_xstrdup(directory));
+            else if (event->len > 0 && event->name[0] != '.')
+                mark_changed(w, pa_sprintf_malloc("%s/%s", directory, event->name));
+        }
+    }
+
+    if (r < 0 && errno != EAGAIN)
+        pa_log_warn("Failed to read parameter watch events: %s", pa_cstrerror(errno));
+
+    if (w->overflow || pa_idxset_size(w->changed) > 0)
+        schedule_flush(w);
+}
+
+parameter_watcher *parameter_watcher_new(pa_core *core, pa_usec_t delay, parameter_watcher_cb_t cb, void *userdata) {
+    parameter_watcher *w;
+    int fd;
+
+    pa_assert(core);
+    pa_assert(cb);
+
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        pa_log("inotify_init1() failed: %s", pa_cstrerror(errno));
+        return NULL;
+    }
+
+    w = pa_xnew0(parameter_watcher, 1);
+    w->core = core;
+    w->fd = fd;
+    w->delay = delay;
+    w->cb = cb;
+    w->userdata = userdata;
+    w->watches = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    w->changed = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    w->io_event = core->mainloop->io_new(core->mainloop, fd, PA_IO_EVENT_INPUT, io_cb, w);
+
+    return w;
+}
+
+void parameter_watcher_free(parameter_watcher *w) {
+    char *directory;
+
+    pa_assert(w);
+
+    if (w->time_event)
+        w->core->mainloop->time_free(w->time_event);
+
+    if (w->io_event)
+        w->core->mainloop->io_free(w->io_event);
+
+    while ((directory = pa_hashmap_steal_first(w->watches)))
+        pa_xfree(directory);
+
+    pa_hashmap_free(w->watches);
+    pa_idxset_free(w->changed, pa_xfree);
+    pa_close(w->fd);
+    pa_xfree(w);
+}
+
+int parameter_watcher_add(parameter_watcher *w, const char *directory) {
+    int wd;
+
+    pa_assert(w);
+    pa_assert(directory);
+
+    if ((wd = inotify_add_watch(w->fd, directory, WATCH_MASK)) < 0) {
+        pa_log_debug("Can not watch %s: %s", directory, pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (!pa_hashmap_get(w->watches, PA_INT_TO_PTR(wd))) {
+        pa_log_debug("Watching %s for parameter changes", directory);
+        pa_hashmap_put(w->watches, PA_INT_TO_PTR(wd), pa_xstrdup(directory));
+    }
+
+    return 0;
+}
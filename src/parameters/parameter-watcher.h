@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef _parameter_watcher_h_
+#define _parameter_watcher_h_
+
+#include <pulsecore/core.h>
+#include <pulsecore/idxset.h>
+
+/*
+ * inotify based watcher for parameter directories.
+ *
+ * Changes to entries of watched directories are collected and reported in
+ * batches, once no new changes have arrived for the batching delay. The
+ * reported paths are the watched directory path joined with the entry
+ * name, or the directory path itself if the directory was removed.
+ */
+
+typedef struct parameter_watcher parameter_watcher;
+
+/* changed is a set of path strings, owned by the watcher. If the kernel
+ * event queue overflowed overflow is true, and changed may be incomplete. */
+typedef void (*parameter_watcher_cb_t)(parameter_watcher *w, pa_idxset *changed, bool overflow, void *userdata);
+
+parameter_watcher *parameter_watcher_new(pa_core *core, pa_usec_t delay, parameter_watcher_cb_t cb, void *userdata);
+void parameter_watcher_free(parameter_watcher *w);
+
+/* Start watching directory. Adding an already watched directory is a no-op. */
+int parameter_watcher_add(parameter_watcher *w, const char *directory);
+
+#endif
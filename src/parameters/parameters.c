@@ -26,43 +26,75 @@
 #include <config.h>
 #endif
 
-#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
 
 #include <pulsecore/llist.h>
 #include <pulsecore/hook-list.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/core-util.h>
 
 #include "module-meego-parameters-userdata.h"
 #include "parameters.h"
+#include "parameter-store.h"
+#include "parameter-loader.h"
+#include "parameter-watcher.h"
 
 #include <meego/parameter-hook-implementor.h>
 #include <meego/parameter-modifier.h>
 
 #include <meego/proplist-meego.h>
 
+/* File events are reported to listeners once they have settled this long */
+#define WATCH_DELAY_USEC (200 * PA_USEC_PER_MSEC)
+
+/* Deltas computed per algorithm that are kept for reuse */
+#define DELTA_CACHE_SIZE 8
+/* Changed byte runs closer than this are sent as one range */
+#define DELTA_MERGE_GAP 8
+
 struct set {
     char *name;
-    unsigned hash;
-    void *data;
+    parameter_blob *blob;
+    parameter_file_id file_id;
+    const void *data;
     unsigned length;
 
     PA_LLIST_FIELDS(struct set);
 };
 
+/* Difference between two set contents of an algorithm. Holds references
+ * to both blobs, so the pointers identify the contents for as long as the
+ * entry exists. usable is false if the delta wouldn't pay off. */
+struct delta_entry {
+    parameter_blob *from;
+    parameter_blob *to;
+    bool usable;
+    meego_parameter_delta delta;
+    meego_parameter_delta_range *ranges;
+
+    PA_LLIST_FIELDS(struct delta_entry);
+};
+
 struct algorithm {
     char *name;
-    unsigned hash;
     bool enabled:1;
     bool full_updates:1;
     bool fired:1;
     pa_hook hook;
     struct set *active_set;
     PA_LLIST_HEAD(struct set, sets);
+    pa_hashmap *set_map; /* set name -> struct set */
+
+    pa_idxset *delta_slots; /* hook slots of listeners that want deltas */
+    parameter_blob *delivered; /* contents of the last update, if from a set */
+    PA_LLIST_HEAD(struct delta_entry, deltas); /* most recently used first */
+    unsigned n_deltas;
 
     PA_LLIST_FIELDS(struct algorithm);
 };
@@ -77,196 +109,295 @@ struct algorithm_enabler {
 
 struct mode {
     char *name;
-    unsigned hash;
     PA_LLIST_HEAD(struct algorithm_enabler, algorithm_enablers);
+    pa_hashmap *enabler_map; /* algorithm name -> struct algorithm_enabler */
 
     PA_LLIST_FIELDS(struct mode);
 };
 
-static char *readlink_malloc(const char *filename) {
-    int size = 100;
-    char *buffer = NULL;
-
-    while (1) {
-        buffer = (char *)realloc(buffer, size);
-        int nchars = readlink(filename, buffer, size);
-        if (nchars < 0) {
-            free(buffer);
-            return NULL;
-        }
-        if (nchars < (size - 1)) {
-            buffer[nchars] = '\0';
-            return buffer;
-        }
-        size *= 2;
-    }
-}
+/* Everything switch_mode() needs to look at when moving between two modes.
+ * Steps with an enabler are the algorithms of the target mode, in enabler
+ * order. Steps without one are the algorithms that may need disabling or
+ * a mode update: those of the source mode that are not in the target mode,
+ * and those with full updates. When the source mode is unknown all other
+ * algorithms are included. Any change to modes, enablers or algorithms
+ * invalidates all plans. */
+struct plan_step {
+    struct algorithm *a;
+    struct algorithm_enabler *e;
+};
 
-static char *set_readlink_abs(const char *path, const char *sym) {
-    char *name;
-    char *sym_value;
-    char *abs_name;
+struct transition_plan {
+    unsigned n_steps;
+    struct plan_step steps[];
+};
 
-    name = pa_sprintf_malloc("%s/%s", path, sym);
-    sym_value = readlink_malloc(name);
-    pa_xfree(name);
+/* All lookup maps are keyed by the name owned by the looked up object. */
 
-    name = pa_sprintf_malloc("%s/%s", path, sym_value);
-    pa_xfree(sym_value);
+static struct mode *find_mode_by_name(struct userdata *u, const char *name) {
+    return pa_hashmap_get(u->parameters.mode_map, name);
+}
 
-    abs_name = canonicalize_file_name(name);
-    pa_xfree(name);
+static struct algorithm *find_algorithm_by_name(struct userdata *u, const char *name) {
+    return pa_hashmap_get(u->parameters.algorithm_map, name);
+}
 
-    return abs_name;
+static struct set *find_set_by_name(struct algorithm *a, const char *name) {
+    return pa_hashmap_get(a->set_map, name);
 }
 
-static struct mode *find_mode_by_name(struct mode **m_head, const char *name) {
-    struct mode *m;
-    unsigned hash = pa_idxset_string_hash_func(name);
+static struct algorithm_enabler *find_enabler_by_name(struct mode *m, const char *name) {
+    return pa_hashmap_get(m->enabler_map, name);
+}
 
-    PA_LLIST_FOREACH(m, *m_head) {
-        if (hash == m->hash) {
-            pa_assert(pa_streq(m->name, name));
-            return m;
-        }
-    }
+static void plans_invalidate(struct userdata *u) {
+    u->parameters.plan_generation++;
 
-    return NULL;
+    if (u->parameters.plans)
+        pa_hashmap_remove_all(u->parameters.plans);
 }
 
-static struct algorithm *find_algorithm_by_name(struct algorithm **a_head, const char *name) {
-    struct algorithm *a;
-    unsigned hash = pa_idxset_string_hash_func(name);
-
-    PA_LLIST_FOREACH(a, *a_head) {
-        if (hash == a->hash) {
-            pa_assert(pa_streq(a->name, name));
-            return a;
-        }
-    }
+static void enabler_add(struct userdata *u, struct mode *m, struct algorithm_enabler *e) {
+    plans_invalidate(u);
+    pa_assert_se(pa_hashmap_put(m->enabler_map, e->a->name, e) == 0);
+    PA_LLIST_PREPEND(struct algorithm_enabler, m->algorithm_enablers, e);
+}
 
-    return NULL;
+static void enabler_remove(struct userdata *u, struct mode *m, struct algorithm_enabler *e) {
+    plans_invalidate(u);
+    pa_assert_se(pa_hashmap_remove(m->enabler_map, e->a->name) == e);
+    PA_LLIST_REMOVE(struct algorithm_enabler, m->algorithm_enablers, e);
 }
 
-static struct set *find_set_by_name(struct set **s_head, const char *name) {
-    struct set *s;
-    unsigned hash = pa_idxset_string_hash_func(name);
+static void set_unload(struct userdata *u, struct set *s) {
+    if (!s->blob)
+        return;
 
-    PA_LLIST_FOREACH(s, *s_head) {
-        if (hash == s->hash) {
-            pa_assert(pa_streq(s->name, name));
-            return s;
-        }
-    }
+    pa_log_debug("Unloading set %s", s->name);
 
-    return NULL;
+    parameter_store_put(u->parameters.store, s->blob);
+    s->blob = NULL;
+    s->data = NULL;
+    s->length = 0;
 }
 
-static struct algorithm_enabler *find_enabler_by_name(struct algorithm_enabler **e_head, const char *name) {
-    struct algorithm_enabler *e;
-    unsigned hash = pa_idxset_string_hash_func(name);
+/* With cache a set stays loaded once loaded. Without cache sets are loaded
+ * for each use and released with set_release() once listeners have the
+ * data, so only the sets being delivered are resident. */
+static void set_load(struct userdata *u, struct set *s) {
+    if (s->blob)
+        return;
 
-    PA_LLIST_FOREACH(e, *e_head) {
-        if (hash == e->a->hash) {
-            pa_assert(pa_streq(e->a->name, name));
-            return e;
-        }
-    }
+    pa_log_debug("Loading set %s ", s->name);
 
-    return NULL;
+    if ((s->blob = parameter_store_get(u->parameters.store, s->name, &s->file_id))) {
+        s->data = parameter_blob_data(s->blob);
+        s->length = parameter_blob_length(s->blob);
+    }
 }
 
-static int file_select(const struct dirent *entry) {
-    return entry->d_name[0] != '.';
+static void set_release(struct userdata *u, struct set *s) {
+    if (!u->parameters.cache)
+        set_unload(u, s);
 }
 
-static void *read_parameters_from_file(const char *file, unsigned *length) {
-    FILE *fp;
-    char *s = NULL;
-    struct stat buf;
-    size_t c = 0;
+static void watch_directory_of(struct userdata *u, const char *file) {
+    char *copy;
 
-    if (!stat(file, &buf)) {
-        if ((fp = fopen(file, "r")) != NULL) {
-            s = pa_xmalloc((size_t)(buf.st_size + sizeof(char)));
-            c = fread(s, 1, (size_t)buf.st_size, fp);
-            fclose(fp);
+    if (!u->parameters.watcher)
+        return;
 
-            pa_assert((size_t)buf.st_size ==  c);
-
-            if (c == (size_t)buf.st_size)
-                s[c] = '\0';
-        }
-    }
-
-    *length = c;
-    return s;
+    copy = pa_xstrdup(file);
+    parameter_watcher_add(u->parameters.watcher, dirname(copy));
+    pa_xfree(copy);
 }
 
-static void set_load(struct set *s) {
-    pa_log_debug("Loading set %s ", s->name);
-    pa_assert(!s->data);
-    s->data = read_parameters_from_file(s->name, &s->length);
-}
+static void watch_mode(struct userdata *u, const char *mode) {
+    char *path;
 
-static void set_unload(struct set *s) {
-    pa_log_debug("Unloading set %s", s->name);
+    if (!u->parameters.watcher)
+        return;
 
-    pa_xfree(s->data);
-    s->data = NULL;
-    s->length = 0;
+    path = pa_sprintf_malloc("%s/%s", u->parameters.modes_directory, mode);
+    parameter_watcher_add(u->parameters.watcher, path);
+    pa_xfree(path);
 }
 
-static struct set *set_new(struct userdata *u, struct algorithm *a, const char *name) {
+/* If entry holds already loaded set contents, the set takes them over. */
+static struct set *set_new(struct userdata *u, struct algorithm *a, const char *name, parameter_scan_entry *entry) {
     struct set *s;
 
-    s = pa_xnew(struct set, 1);
+    s = pa_xnew0(struct set, 1);
     s->name = pa_xstrdup(name);
-    s->hash = pa_idxset_string_hash_func(name);
+    s->blob = NULL;
     s->data = NULL;
     s->length = 0;
 
-    if (u->parameters.cache)
-        set_load(s);
+    if (entry && entry->blob) {
+        s->blob = parameter_store_add(u->parameters.store, entry->blob);
+        s->file_id = entry->file_id;
+        s->data = parameter_blob_data(s->blob);
+        s->length = parameter_blob_length(s->blob);
+        entry->blob = NULL;
+    } else if (u->parameters.cache)
+        set_load(u, s);
+
+    watch_directory_of(u, s->name);
 
     pa_log_debug("Adding set: %s to algorithm: %s", s->name, a->name);
     PA_LLIST_PREPEND(struct set, a->sets, s);
+    pa_hashmap_put(a->set_map, s->name, s);
 
     return s;
 }
 
-static void set_free(struct algorithm *a, struct set *s) {
+static void set_free(struct userdata *u, struct algorithm *a, struct set *s) {
     pa_log_debug("Removing set: %s from algorithm: %s", s->name, a->name);
     PA_LLIST_REMOVE(struct set, a->sets, s);
+    pa_hashmap_remove(a->set_map, s->name);
 
     if (s == a->active_set)
         a->active_set = NULL;
 
+    set_unload(u, s);
+
     pa_xfree(s->name);
-    pa_xfree(s->data);
     pa_xfree(s);
 }
 
-static struct algorithm *algorithm_new(pa_core *c, struct algorithm **a_head, const char *name) {
+static struct algorithm *algorithm_new(struct userdata *u, const char *name) {
     struct algorithm *a;
 
     pa_assert(name);
 
     a = pa_xnew(struct algorithm, 1);
     a->name = pa_xstrdup(name);
-    a->hash = pa_idxset_string_hash_func(name);
     a->enabled = true;
     a->full_updates = false;
-    pa_hook_init(&a->hook, c);
+    pa_hook_init(&a->hook, u->core);
     a->active_set = NULL;
     PA_LLIST_HEAD_INIT(struct set, a->sets);
+    a->set_map = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    a->delta_slots = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    a->delivered = NULL;
+    PA_LLIST_HEAD_INIT(struct delta_entry, a->deltas);
+    a->n_deltas = 0;
 
     pa_log_debug("Adding new algorithm: %s", a->name);
-    PA_LLIST_PREPEND(struct algorithm, *a_head, a);
+    plans_invalidate(u);
+    PA_LLIST_PREPEND(struct algorithm, u->parameters.algorithms, a);
+    pa_hashmap_put(u->parameters.algorithm_map, a->name, a);
 
     return a;
 }
 
+static void delta_entry_free(struct userdata *u, struct algorithm *a, struct delta_entry *d) {
+    PA_LLIST_REMOVE(struct delta_entry, a->deltas, d);
+    a->n_deltas--;
+
+    parameter_store_put(u->parameters.store, d->from);
+    parameter_store_put(u->parameters.store, d->to);
+    pa_xfree(d->ranges);
+    pa_xfree(d);
+}
+
+static void delta_compute(struct delta_entry *d) {
+    const uint8_t *p = parameter_blob_data(d->from);
+    const uint8_t *q = parameter_blob_data(d->to);
+    unsigned length = parameter_blob_length(d->to);
+    unsigned allocated = 0, changed = 0;
+    unsigned i = 0, j, end;
+
+    d->usable = false;
+
+    if (parameter_blob_length(d->from) != length)
+        return;
+
+    if (d->from == d->to) {
+        d->usable = true;
+        return;
+    }
+
+    while (i < length) {
+        if (p[i] == q[i]) {
+            i++;
+            continue;
+        }
+
+        for (end = j = i + 1; j < length && j - end < DELTA_MERGE_GAP; j++)
+            if (p[j] != q[j])
+                end = j + 1;
+
+        if (d->delta.n_ranges == allocated) {
+            allocated = allocated ? allocated * 2 : 8;
+            d->ranges = pa_xrealloc(d->ranges, allocated * sizeof(meego_parameter_delta_range));
+        }
+
+        d->ranges[d->delta.n_ranges].offset = i;
+        d->ranges[d->delta.n_ranges].length = end - i;
+        d->delta.n_ranges++;
+        changed += end - i;
+
+        i = end;
+    }
+
+    d->delta.ranges = d->ranges;
+
+    /* Mostly changed parameters are cheaper to take in as a whole */
+    d->usable = changed <= length / 2;
+
+    pa_log_debug("Delta of %u bytes: %u ranges, %u bytes changed%s", length, d->delta.n_ranges, changed,
+                 d->usable ? "" : ", not used");
+}
+
+static const meego_parameter_delta *delta_get(struct userdata *u, struct algorithm *a, parameter_blob *from, parameter_blob *to) {
+    struct delta_entry *d;
+
+    PA_LLIST_FOREACH(d, a->deltas) {
+        if (d->from == from && d->to == to)
+            break;
+    }
+
+    if (d)
+        PA_LLIST_REMOVE(struct delta_entry, a->deltas, d);
+    else {
+        d = pa_xnew0(struct delta_entry, 1);
+        d->from = parameter_blob_ref(from);
+        d->to = parameter_blob_ref(to);
+        delta_compute(d);
+        a->n_deltas++;
+    }
+
+    PA_LLIST_PREPEND(struct delta_entry, a->deltas, d);
+
+    if (a->n_deltas > DELTA_CACHE_SIZE) {
+        struct delta_entry *last = d;
+
+        while (last->next)
+            last = last->next;
+
+        delta_entry_free(u, a, last);
+    }
+
+    return d->usable ? &d->delta : NULL;
+}
+
+/* Remembers what listeners of a got last, as the base of the next delta.
+ * Only kept for algorithms with delta listeners, as it keeps the contents
+ * resident without cache as well. */
+static void algorithm_set_delivered(struct userdata *u, struct algorithm *a, parameter_blob *b) {
+    if (pa_idxset_size(a->delta_slots) == 0)
+        b = NULL;
+
+    if (b)
+        parameter_blob_ref(b);
+
+    if (a->delivered)
+        parameter_store_put(u->parameters.store, a->delivered);
+
+    a->delivered = b;
+}
+
 static pa_hook_result_t algorithm_enable(struct userdata *u, struct algorithm *a) {
     meego_parameter_update_args ua;
 
@@ -278,6 +409,7 @@ static pa_hook_result_t algorithm_enable(struct userdata *u, struct algorithm *a
     ua.status = MEEGO_PARAM_ENABLE;
     ua.parameters = NULL;
     ua.length = 0;
+    ua.delta = NULL;
     a->enabled = true;
 
     pa_log_debug("Enabling %s (%s)", a->name, a->active_set->name);
@@ -295,26 +427,39 @@ static pa_hook_result_t algorithm_disable(struct userdata *u, struct algorithm *
     ua.status = MEEGO_PARAM_DISABLE;
     ua.parameters = NULL;
     ua.length = 0;
+    ua.delta = NULL;
     a->enabled = false;
 
     pa_log_debug("Disabling %s (%s)", a->name, (a->active_set ? a->active_set->name : "not initialized"));
 
+    /* Listeners may drop their parameters while disabled */
+    algorithm_set_delivered(u, a, NULL);
+
     return pa_hook_fire(&a->hook, &ua);
 }
 
-static void algorithm_free(struct userdata *u, struct algorithm **a_head, struct algorithm *a) {
+static void algorithm_free(struct userdata *u, struct algorithm *a) {
     struct set *s;
 
     pa_assert(a);
 
     pa_log_debug("Removing algorithm: %s", a->name);
-    PA_LLIST_REMOVE(struct algorithm, *a_head, a);
+    plans_invalidate(u);
+    PA_LLIST_REMOVE(struct algorithm, u->parameters.algorithms, a);
+    pa_hashmap_remove(u->parameters.algorithm_map, a->name);
 
     algorithm_disable(u, a);
 
     while ((s = a->sets))
-        set_free(a, s);
+        set_free(u, a, s);
 
+    while (a->deltas)
+        delta_entry_free(u, a, a->deltas);
+
+    algorithm_set_delivered(u, a, NULL);
+
+    pa_idxset_free(a->delta_slots, NULL);
+    pa_hashmap_free(a->set_map);
     pa_xfree(a->name);
     pa_hook_done(&a->hook);
     pa_xfree(a);
@@ -330,6 +475,7 @@ static void mode_update(struct userdata *u) {
         ua.status = MEEGO_PARAM_MODE_CHANGE;
         ua.parameters = NULL;
         ua.length = 0;
+        ua.delta = NULL;
 
         pa_hook_fire(&u->mode_hook, &ua);
     }
@@ -344,8 +490,10 @@ static void algorithm_mode_update(struct userdata *u, struct algorithm *a) {
 
     ua.mode = u->mode;
     ua.status = MEEGO_PARAM_MODE_CHANGE;
+    ua.delta = NULL;
 
     if (a->enabled && a->active_set) {
+        set_load(u, a->active_set);
         ua.parameters = a->active_set->data;
         ua.length = a->active_set->length;
     } else {
@@ -358,6 +506,11 @@ static void algorithm_mode_update(struct userdata *u, struct algorithm *a) {
                  ((a->enabled && a->active_set) ? a->active_set->name : "disabled"));
 
     pa_hook_fire(&a->hook, &ua);
+
+    if (a->enabled && a->active_set) {
+        algorithm_set_delivered(u, a, a->active_set->blob);
+        set_release(u, a->active_set);
+    }
 }
 
 /* Update an algorithm using a modifier, if possible.
@@ -371,7 +524,7 @@ static void algorithm_mode_update(struct userdata *u, struct algorithm *a) {
 static bool algorithm_modified_update(struct userdata *u, struct algorithm *a, struct algorithm_enabler *e) {
     meego_parameter_update_args ua;
     void *parameters = NULL;
-    void *base_parameters = NULL;
+    const void *base_parameters = NULL;
     unsigned len_base_parameters = 0;
     bool updated = false;
     meego_parameter_modifier *modifier = NULL;
@@ -386,8 +539,7 @@ static bool algorithm_modified_update(struct userdata *u, struct algorithm *a, s
         return false;
 
     if (e->set) {
-        if (!u->parameters.cache)
-            set_load(e->set);
+        set_load(u, e->set);
         base_parameters = e->set->data;
         len_base_parameters = e->set->length;
     }
@@ -408,16 +560,18 @@ static bool algorithm_modified_update(struct userdata *u, struct algorithm *a, s
         ua.mode = u->mode;
         ua.status = MEEGO_PARAM_UPDATE;
         ua.parameters = parameters;
+        ua.delta = NULL;
         pa_assert(ua.parameters && ua.length > 0);
         a->enabled = true;
         a->active_set = NULL;
         pa_hook_fire(&a->hook, &ua);
+        algorithm_set_delivered(u, a, NULL);
         pa_log_debug("Update from modifier successful");
     } else
         pa_log_warn("Update from modifier failed");
 
-    if (e->set && !u->parameters.cache)
-        set_unload(e->set);
+    if (e->set)
+        set_release(u, e->set);
 
     return updated;
 }
@@ -433,21 +587,24 @@ static pa_hook_result_t algorithm_update(struct userdata *u, struct algorithm *a
         return PA_HOOK_OK;
     }
 
-    if (!u->parameters.cache)
-       set_load(s);
+    set_load(u, s);
 
     ua.mode = u->mode;
     ua.status = MEEGO_PARAM_UPDATE;
     ua.parameters = s->data;
     ua.length = s->length;
+    ua.delta = NULL;
     a->enabled = true;
 
-    pa_log_debug("Updating %s with %s", a->name, s->name);
+    if (pa_idxset_size(a->delta_slots) > 0 && a->delivered && s->blob)
+        ua.delta = delta_get(u, a, a->delivered, s->blob);
+
+    pa_log_debug("Updating %s with %s%s", a->name, s->name, ua.delta ? " (delta)" : "");
 
     r = pa_hook_fire(&a->hook, &ua);
 
-    if (!u->parameters.cache)
-        set_unload(s);
+    algorithm_set_delivered(u, a, s->blob);
+    set_release(u, s);
 
     return r;
 }
@@ -458,41 +615,41 @@ int algorithm_reload(struct userdata *u, const char *alg) {
     struct set *s;
     struct algorithm_enabler *e;
     char *path;
-    const char *setname;
+    char *setname;
 
     pa_assert(u);
     pa_assert(alg);
 
     pa_log_debug("Reloading %s", alg);
 
-    if ((a = find_algorithm_by_name(&u->parameters.algorithms, alg)) == NULL) {
+    if ((a = find_algorithm_by_name(u, alg)) == NULL) {
         pa_log_warn("Can not reload %s, not found", alg);
         return -1;
     }
 
     while ((s = a->sets))
-        set_free(a, s);
+        set_free(u, a, s);
 
     PA_LLIST_FOREACH(m, u->parameters.modes) {
-        if ((e = find_enabler_by_name(&m->algorithm_enablers, alg)) != NULL) {
-            PA_LLIST_REMOVE(struct algorithm_enabler, m->algorithm_enablers, e);
-
+        if ((e = find_enabler_by_name(m, alg)) != NULL) {
             path = pa_sprintf_malloc("%s/modes/%s", u->parameters.directory, m->name);
-            if ((setname = set_readlink_abs(path, alg)) != NULL) {
-                e = pa_xnew(struct algorithm_enabler, 1);
-                e->a = a;
-
-                if ((e->set = find_set_by_name(&a->sets, setname)) == NULL)
-                    e->set = set_new(u, a, setname);
+            if ((setname = parameter_set_path(path, alg)) != NULL) {
+                if ((e->set = find_set_by_name(a, setname)) == NULL)
+                    e->set = set_new(u, a, setname, NULL);
                 else
                     pa_log_debug("%s set: %s already loaded", a->name, e->set->name);
 
-                if (m->hash == u->hash)
+                if (u->mode && pa_streq(m->name, u->mode))
                     algorithm_update(u, a, e->set);
 
-                PA_LLIST_PREPEND(struct algorithm_enabler, m->algorithm_enablers, e);
+                free(setname);
             } else {
                 pa_log_warn("%s reload failed in mode %s", alg, m->name);
+                enabler_remove(u, m, e);
+                pa_xfree(e);
+
+                if (u->mode && pa_streq(m->name, u->mode) && a->enabled)
+                    algorithm_disable(u, a);
             }
             pa_xfree(path);
         }
@@ -501,106 +658,321 @@ int algorithm_reload(struct userdata *u, const char *alg) {
     return 0;
 }
 
-static struct mode *mode_new(struct mode **m_head, const char *name) {
+static struct mode *mode_new(struct userdata *u, const char *name) {
     struct mode *m;
 
     m = pa_xnew0(struct mode, 1);
     PA_LLIST_INIT(struct mode, m);
     m->name = pa_xstrdup(name);
-    m->hash = pa_idxset_string_hash_func(name);
     PA_LLIST_HEAD_INIT(struct algorithm_enabler, m->algorithm_enablers);
+    m->enabler_map = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
 
     pa_log_debug("Adding new mode: %s", m->name);
-    PA_LLIST_PREPEND(struct mode, *m_head, m);
+    plans_invalidate(u);
+    PA_LLIST_PREPEND(struct mode, u->parameters.modes, m);
+    pa_hashmap_put(u->parameters.mode_map, m->name, m);
 
     return m;
 }
 
-static void mode_free(struct userdata *u, struct mode **m_head, struct mode *m) {
+static void mode_free(struct userdata *u, struct mode *m) {
     struct algorithm_enabler *e;
 
     pa_log_debug("Removing mode: %s", m->name);
-    PA_LLIST_REMOVE(struct mode, *m_head, m);
+    plans_invalidate(u);
+    PA_LLIST_REMOVE(struct mode, u->parameters.modes, m);
+    pa_hashmap_remove(u->parameters.mode_map, m->name);
 
     while ((e = m->algorithm_enablers)) {
-        if (pa_streq(m->name, u->mode))
+        if (u->mode && pa_streq(m->name, u->mode))
             algorithm_disable(u, e->a);
 
         pa_log_debug("Removing enabler: %s from mode: %s", e->a->name, m->name);
-        PA_LLIST_REMOVE(struct algorithm_enabler, m->algorithm_enablers, e);
+        enabler_remove(u, m, e);
         pa_xfree(e);
     }
 
+    pa_hashmap_free(m->enabler_map);
     pa_xfree(m->name);
     pa_xfree(m);
 }
 
-static struct mode *add_mode(struct userdata *u, const char *mode) {
-    struct dirent **namelist;
-    int n;
+static struct mode *add_scanned_mode(struct userdata *u, parameter_scan *scan) {
     struct mode *m;
     struct algorithm *a;
     struct algorithm_enabler *e;
-    char *path;
-    char *sym;
-    char *setname;
+    parameter_scan_entry *entry;
+    unsigned i;
+
+    if (!scan->found)
+        return NULL;
+
+    m = mode_new(u, scan->mode);
+    watch_mode(u, m->name);
+
+    for (i = 0; i < scan->n_entries; i++) {
+        entry = &scan->entries[i];
+
+        if ((a = find_algorithm_by_name(u, entry->algorithm)) == NULL)
+            a = algorithm_new(u, entry->algorithm);
+
+        e = pa_xnew0(struct algorithm_enabler, 1);
+        e->a = a;
+
+        if ((e->set = find_set_by_name(a, entry->set)) == NULL)
+            e->set = set_new(u, a, entry->set, entry);
+        else
+            pa_log_debug("%s set: %s already loaded", a->name, e->set->name);
+
+        enabler_add(u, m, e);
+        pa_log_debug("Enabling %s in %s mode", a->name, m->name);
+    }
+
+    return m;
+}
 
-    m = mode_new(&u->parameters.modes, mode);
+static struct mode *add_mode(struct userdata *u, const char *mode) {
+    parameter_scan *scan;
+    struct mode *m;
+
+    scan = parameter_scan_mode(u->parameters.directory, mode, false);
+    m = add_scanned_mode(u, scan);
+    parameter_scan_free(scan);
+
+    return m;
+}
+
+/* Modes scanned in the loader thread arrive here. If a switch to the mode
+ * is waiting for the scan, it is completed now. */
+static void mode_scanned_cb(parameter_scan *scan, struct userdata *u) {
+    struct mode *m;
+    char *mode;
+
+    pa_assert(scan);
+    pa_assert(u);
+
+    if (!(m = find_mode_by_name(u, scan->mode)))
+        m = add_scanned_mode(u, scan);
+    else
+        pa_log_debug("Mode %s already loaded", scan->mode);
+
+    if (u->parameters.pending_mode && pa_streq(u->parameters.pending_mode, scan->mode)) {
+        mode = u->parameters.pending_mode;
+        u->parameters.pending_mode = NULL;
+
+        if (m)
+            switch_mode(u, mode);
+        else
+            pa_log_error("No such mode: %s", mode);
+
+        pa_xfree(mode);
+    }
+
+    parameter_scan_free(scan);
+}
+
+static bool mode_exists(struct userdata *u, const char *mode) {
+    struct stat st;
+    char *path;
+    bool exists;
 
     path = pa_sprintf_malloc("%s/modes/%s", u->parameters.directory, mode);
+    exists = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+    pa_xfree(path);
 
-    pa_log_debug("Scanning mode from %s", path);
+    return exists;
+}
 
-    if ((n = scandir(path, &namelist, file_select, alphasort)) >= 0) {
+/* Reloads a set whose file may have changed. Returns true if the contents
+ * changed. Without cache sets are loaded on use, so only the file is
+ * compared to the one last loaded. */
+static bool set_refresh(struct userdata *u, struct set *s) {
+    parameter_blob *old = s->blob;
 
-        while (n--) {
-            sym = namelist[n]->d_name;
-            pa_log_debug("Checking symlink value %s", sym);
+    if (!u->parameters.cache)
+        return !parameter_file_unchanged(s->name, &s->file_id);
 
-            if ((setname = set_readlink_abs(path, sym)) != NULL) {
-                if ((a = find_algorithm_by_name(&u->parameters.algorithms, sym)) == NULL)
-                    a = algorithm_new(u->core, &u->parameters.algorithms, sym);
+    if (old && parameter_file_unchanged(s->name, &s->file_id))
+        return false;
 
-                e = pa_xnew0(struct algorithm_enabler, 1);
-                e->a = a;
+    /* Load before releasing the old contents, so that identical contents
+     * end up in the same blob and are not reported as a change. */
+    s->blob = NULL;
+    set_load(u, s);
 
-                if ((e->set = find_set_by_name(&a->sets, setname)) == NULL)
-                    e->set = set_new(u, a, setname);
-                else
-                    pa_log_debug("%s set: %s already loaded", a->name, e->set->name);
+    if (!s->blob) {
+        s->data = NULL;
+        s->length = 0;
+    }
 
-                PA_LLIST_PREPEND(struct algorithm_enabler, m->algorithm_enablers, e);
-                pa_log_debug("Enabling %s in %s mode", a->name, mode);
+    if (old)
+        parameter_store_put(u->parameters.store, old);
 
-                pa_xfree(setname);
-            } else {
-                pa_log_debug("%s is not a symlink", sym);
-            }
-            pa_xfree(namelist[n]);
+    return s->blob != old;
+}
+
+static void algorithm_push_set(struct userdata *u, struct algorithm *a, struct algorithm_enabler *e) {
+    if (!a->hook.slots)
+        return;
+
+    if (!algorithm_modified_update(u, a, e) && e->set)
+        algorithm_update(u, a, e->set);
+}
+
+/* Brings a loaded mode in line with its directory, touching only the
+ * algorithms whose set changed. */
+static void mode_apply_changes(struct userdata *u, struct mode *m) {
+    parameter_scan *scan;
+    parameter_scan_entry *entry;
+    struct algorithm *a;
+    struct algorithm_enabler *e, *next;
+    struct set *s;
+    bool current;
+    unsigned i;
+
+    scan = parameter_scan_mode(u->parameters.directory, m->name, false);
+
+    if (!scan->found) {
+        pa_log_warn("Mode %s was removed, keeping its parameters", m->name);
+        parameter_scan_free(scan);
+        return;
+    }
+
+    watch_mode(u, m->name);
+    current = u->mode && pa_streq(u->mode, m->name);
+
+    for (i = 0; i < scan->n_entries; i++) {
+        entry = &scan->entries[i];
+
+        if ((a = find_algorithm_by_name(u, entry->algorithm)) == NULL)
+            a = algorithm_new(u, entry->algorithm);
+
+        e = find_enabler_by_name(m, entry->algorithm);
+
+        if (e && e->set && pa_streq(e->set->name, entry->set))
+            continue;
+
+        if ((s = find_set_by_name(a, entry->set)) == NULL)
+            s = set_new(u, a, entry->set, NULL);
+
+        if (!e) {
+            e = pa_xnew0(struct algorithm_enabler, 1);
+            e->a = a;
+            enabler_add(u, m, e);
         }
-        pa_xfree(namelist);
-    } else {
-        mode_free(u, &u->parameters.modes, m);
-        m = NULL;
+
+        pa_log_info("%s uses set %s in mode %s", a->name, s->name, m->name);
+        e->set = s;
+
+        if (current)
+            algorithm_push_set(u, a, e);
     }
 
-    pa_xfree(path);
+    for (e = m->algorithm_enablers; e; e = next) {
+        next = e->next;
 
-    return m;
+        if (!e->set)
+            continue;
+
+        for (i = 0; i < scan->n_entries; i++)
+            if (pa_streq(scan->entries[i].algorithm, e->a->name))
+                break;
+
+        if (i < scan->n_entries)
+            continue;
+
+        pa_log_info("%s removed from mode %s", e->a->name, m->name);
+        a = e->a;
+        e->set = NULL;
+
+        if (e->modifier) {
+            if (current)
+                algorithm_push_set(u, a, e);
+        } else {
+            enabler_remove(u, m, e);
+            pa_xfree(e);
+
+            if (current && a->enabled)
+                algorithm_disable(u, a);
+        }
+    }
+
+    parameter_scan_free(scan);
+}
+
+/* Returns the mode a changed path under the modes directory belongs to. */
+static char *changed_path_mode(struct userdata *u, const char *path) {
+    size_t l = strlen(u->parameters.modes_directory);
+
+    if (strncmp(path, u->parameters.modes_directory, l) || path[l] != '/')
+        return NULL;
+
+    path += l + 1;
+
+    return pa_xstrndup(path, strcspn(path, "/"));
+}
+
+static void parameters_changed_cb(parameter_watcher *w, pa_idxset *changed, bool overflow, struct userdata *u) {
+    struct mode *m, *current = NULL;
+    struct algorithm *a;
+    struct algorithm_enabler *e;
+    struct set *s;
+    pa_idxset *modes;
+    const char *path;
+    char *mode;
+    uint32_t idx;
+
+    pa_assert(changed);
+    pa_assert(u);
+
+    modes = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    PA_IDXSET_FOREACH(path, changed, idx) {
+        if ((mode = changed_path_mode(u, path)) && pa_idxset_put(modes, mode, NULL) < 0)
+            pa_xfree(mode);
+    }
+
+    /* Set contents first, so that mode changes below push fresh data */
+    if (u->mode)
+        current = find_mode_by_name(u, u->mode);
+
+    PA_LLIST_FOREACH(a, u->parameters.algorithms) {
+        PA_LLIST_FOREACH(s, a->sets) {
+            if (!overflow && !pa_idxset_get_by_data(changed, s->name, NULL))
+                continue;
+
+            if (!set_refresh(u, s))
+                continue;
+
+            pa_log_info("Set %s of %s changed", s->name, a->name);
+
+            if (current && (e = find_enabler_by_name(current, a->name)) && e->set == s)
+                algorithm_push_set(u, a, e);
+        }
+    }
+
+    PA_LLIST_FOREACH(m, u->parameters.modes) {
+        if (overflow || pa_idxset_get_by_data(modes, m->name, NULL))
+            mode_apply_changes(u, m);
+    }
+
+    pa_idxset_free(modes, pa_xfree);
 }
 
 int update_mode(struct userdata *u, const char *mode) {
-    struct mode *m = find_mode_by_name(&u->parameters.modes, mode);
+    struct mode *m = find_mode_by_name(u, mode);
 
     if (!m)
         return -1;
 
-    mode_free(u, &u->parameters.modes, m);
+    mode_free(u, m);
 
     if ((m = add_mode(u, mode)) == NULL)
         return -1;
 
-    u->hash = 0;
+    /* Force switch_mode() to apply the mode again */
+    pa_xfree((void*)u->mode);
+    u->mode = NULL;
 
     return switch_mode(u, mode);
 }
@@ -609,6 +981,7 @@ static pa_hook_result_t update_requests(pa_core *c, meego_parameter_connection_a
     struct algorithm *a = NULL;
     struct mode *m = NULL;
     struct algorithm_enabler *e = NULL;
+    pa_hook_slot *slot;
 
     pa_assert(c);
     pa_assert(args);
@@ -622,17 +995,26 @@ static pa_hook_result_t update_requests(pa_core *c, meego_parameter_connection_a
         return PA_HOOK_OK;
     }
 
-    if ((a = find_algorithm_by_name(&u->parameters.algorithms, args->name)) == NULL)
-        a = algorithm_new(c, &u->parameters.algorithms, args->name);
+    if ((a = find_algorithm_by_name(u, args->name)) == NULL)
+        a = algorithm_new(u, args->name);
+
+    if (a->full_updates != args->full_updates) {
+        a->full_updates = args->full_updates;
+        plans_invalidate(u);
+    }
+
+    slot = pa_hook_connect(&a->hook, args->prio, args->cb, args->userdata);
 
-    a->full_updates = args->full_updates;
+    if (args->delta_updates)
+        pa_idxset_put(a->delta_slots, slot, NULL);
 
-    pa_hook_connect(&a->hook, args->prio, args->cb, args->userdata);
+    /* The new listener has no previous set to apply a delta to */
+    algorithm_set_delivered(u, a, NULL);
 
-    pa_log_debug("Update hook connected for %s", args->name);
+    pa_log_debug("Update hook connected for %s%s", args->name, args->delta_updates ? " (delta updates)" : "");
 
-    if (u->mode && (m = find_mode_by_name(&u->parameters.modes, u->mode)))
-        e = find_enabler_by_name(&m->algorithm_enablers, args->name);
+    if (u->mode && (m = find_mode_by_name(u, u->mode)))
+        e = find_enabler_by_name(m, args->name);
 
     if (e) {
         if (!algorithm_modified_update(u, a, e))
@@ -653,11 +1035,13 @@ static pa_hook_result_t stop_requests(pa_core *c, meego_parameter_connection_arg
 
     if (args->name == NULL)
         slot = u->mode_hook.slots;
-    else if ((a = find_algorithm_by_name(&u->parameters.algorithms, args->name)) != NULL)
+    else if ((a = find_algorithm_by_name(u, args->name)) != NULL)
         slot = a->hook.slots;
 
     while (slot) {
         if (slot->callback == args->cb && slot->data == args->userdata) {
+            if (a)
+                pa_idxset_remove_by_data(a->delta_slots, slot, NULL);
             pa_hook_slot_free(slot);
             pa_log_debug("Stopped requests for %s.", args->name ? args->name : "mode hook");
             return PA_HOOK_OK;
@@ -683,21 +1067,21 @@ static pa_hook_result_t register_modifier(pa_core *c, meego_parameter_modifier *
     pa_assert(modifier->mode_name);
     pa_assert(modifier->algorithm_name);
 
-    if ((m = find_mode_by_name(&u->parameters.modes, modifier->mode_name)) == NULL) {
+    if ((m = find_mode_by_name(u, modifier->mode_name)) == NULL) {
         if ((m = add_mode(u, modifier->mode_name)) == NULL) {
             pa_log_error("Could not add mode %s", modifier->mode_name);
             return PA_HOOK_OK;
         }
     }
 
-    if ((a = find_algorithm_by_name(&u->parameters.algorithms, modifier->algorithm_name)) == NULL)
-        a = algorithm_new(c, &u->parameters.algorithms, modifier->algorithm_name);
+    if ((a = find_algorithm_by_name(u, modifier->algorithm_name)) == NULL)
+        a = algorithm_new(u, modifier->algorithm_name);
 
-    if ((e = find_enabler_by_name(&m->algorithm_enablers, modifier->algorithm_name)) == NULL) {
+    if ((e = find_enabler_by_name(m, modifier->algorithm_name)) == NULL) {
         e = pa_xnew0(struct algorithm_enabler, 1);
         e->a = a;
         e->set = NULL;
-        PA_LLIST_PREPEND(struct algorithm_enabler, m->algorithm_enablers, e);
+        enabler_add(u, m, e);
     }
 
     /* Only one modifier allowed for each (mode, algorithm) pair (more wouldn't make sense) */
@@ -727,8 +1111,8 @@ static pa_hook_result_t unregister_modifier(pa_core *c, meego_parameter_modifier
     pa_assert(modifier);
     pa_assert(u);
 
-    if ((m = find_mode_by_name(&u->parameters.modes, modifier->mode_name)))
-        e = find_enabler_by_name(&m->algorithm_enablers, modifier->algorithm_name);
+    if ((m = find_mode_by_name(u, modifier->mode_name)))
+        e = find_enabler_by_name(m, modifier->algorithm_name);
 
     if (!e || !e->modifier) {
         pa_log_warn("No modifier exists for algorithm %s, mode %s", modifier->algorithm_name, modifier->mode_name);
@@ -746,7 +1130,12 @@ static pa_hook_result_t unregister_modifier(pa_core *c, meego_parameter_modifier
 
     /* Remove the enabler if it was solely using the modifier (i.e. no params from file) */
     if (!e->set) {
-        PA_LLIST_REMOVE(struct algorithm_enabler, m->algorithm_enablers, e);
+        enabler_remove(u, m, e);
+
+        /* Algorithms outside the current mode are kept disabled */
+        if (u->mode && pa_streq(m->name, u->mode) && e->a->enabled)
+            algorithm_disable(u, e->a);
+
         pa_xfree(e);
     }
 
@@ -755,72 +1144,50 @@ static pa_hook_result_t unregister_modifier(pa_core *c, meego_parameter_modifier
     return PA_HOOK_OK;
 }
 
-int initme(struct userdata *u, const char *initial_mode) {
-    PA_LLIST_HEAD_INIT(struct mode, u->parameters.modes);
-    PA_LLIST_HEAD_INIT(struct algorithm, u->parameters.algorithms);
-
-    u->implementor_args.update_request_cb = (pa_hook_cb_t)update_requests;
-    u->implementor_args.stop_request_cb = (pa_hook_cb_t)stop_requests;
-    u->implementor_args.modifier_registration_cb = (pa_hook_cb_t)register_modifier;
-    u->implementor_args.modifier_unregistration_cb = (pa_hook_cb_t)unregister_modifier;
-
-    meego_parameter_receive_requests(u->core, &u->implementor_args, u);
-    pa_log_debug("Connected to update requests %p", (void*)u->implementor_args.update_request_slot);
-    pa_log_debug("Connected to modifier registrations %p", (void*)u->implementor_args.modifier_registration_slot);
-    pa_log_debug("Connected to modifier unregistrations %p", (void*)u->implementor_args.modifier_unregistration_slot);
-
-    u->hash = 0;
-    u->mode = NULL;
-
-    /* Let's start in the initial mode */
-    return switch_mode(u, initial_mode);
+static void plan_free(struct transition_plan *plan) {
+    pa_xfree(plan);
 }
 
-void unloadme(struct userdata *u) {
-    struct mode *m;
+static struct transition_plan *plan_build(struct userdata *u, struct mode *from, struct mode *to) {
+    struct transition_plan *plan;
+    struct algorithm_enabler *e;
     struct algorithm *a;
+    unsigned n = 0;
 
-    pa_assert(u);
+    PA_LLIST_FOREACH(e, to->algorithm_enablers)
+        n++;
+    n += pa_hashmap_size(u->parameters.algorithm_map);
 
-    meego_parameter_discontinue_requests(&u->implementor_args);
-
-    if (u->parameters.directory)
-        pa_xfree((void*)u->parameters.directory);
-
-    while ((m = u->parameters.modes))
-        mode_free(u, &u->parameters.modes, m);
+    plan = pa_xmalloc0(sizeof(struct transition_plan) + n * sizeof(struct plan_step));
 
-    while ((a = u->parameters.algorithms))
-        algorithm_free(u, &u->parameters.algorithms, a);
-}
-
-int switch_mode(struct userdata *u, const char *mode) {
-    struct mode *m;
-    struct algorithm *a;
-    struct algorithm_enabler *e;
-    unsigned hash = pa_idxset_string_hash_func(mode);
-
-    if (hash == u->hash)
-        return 0;
+    PA_LLIST_FOREACH(e, to->algorithm_enablers) {
+        plan->steps[plan->n_steps].a = e->a;
+        plan->steps[plan->n_steps].e = e;
+        plan->n_steps++;
+    }
 
-    if ((m = find_mode_by_name(&u->parameters.modes, mode)) == NULL)
-        m = add_mode(u, mode);
+    PA_LLIST_FOREACH(a, u->parameters.algorithms) {
+        if (find_enabler_by_name(to, a->name))
+            continue;
 
-    if (!m) {
-        pa_log_error("No such mode: %s", mode);
-        return -1;
+        if (!from || a->full_updates || find_enabler_by_name(from, a->name)) {
+            plan->steps[plan->n_steps].a = a;
+            plan->steps[plan->n_steps].e = NULL;
+            plan->n_steps++;
+        }
     }
 
-    u->hash = hash;
-
-    if (u->mode)
-        pa_xfree((void*)u->mode);
+    pa_log_debug("Planned transition %s -> %s, %u steps", from ? from->name : "(none)", to->name, plan->n_steps);
 
-    u->mode = pa_xstrdup(mode);
+    return plan;
+}
 
-    pa_log_debug("Checking mode: %s", mode);
+static void plan_execute(struct userdata *u, struct transition_plan *plan) {
+    struct algorithm_enabler *e;
+    struct algorithm *a;
+    unsigned i;
 
-    PA_LLIST_FOREACH(e, m->algorithm_enablers) {
+    for (i = 0; i < plan->n_steps && (e = plan->steps[i].e); i++) {
         a = e->a;
 
         pa_assert(e->set || e->modifier);
@@ -854,7 +1221,9 @@ int switch_mode(struct userdata *u, const char *mode) {
         a->fired = true;
     }
 
-    PA_LLIST_FOREACH(a, u->parameters.algorithms) {
+    for (i = 0; i < plan->n_steps; i++) {
+        a = plan->steps[i].a;
+
         if (a->fired == false && a->enabled == true)
             algorithm_disable(u, a);
         else if (a->fired == false && a->full_updates)
@@ -864,6 +1233,172 @@ int switch_mode(struct userdata *u, const char *mode) {
     }
 
     mode_update(u);
+}
+
+/* The plan is taken out of the cache while it runs, since listeners may
+ * change modes or algorithms from their hooks. It goes back only if nothing
+ * invalidated the cache meanwhile. */
+static void plan_run(struct userdata *u, struct mode *from, struct mode *to) {
+    struct transition_plan *plan;
+    unsigned generation;
+    char *key;
+
+    key = pa_sprintf_malloc("%s\n%s", from ? from->name : "", to->name);
+
+    if (!(plan = pa_hashmap_remove(u->parameters.plans, key)))
+        plan = plan_build(u, from, to);
+
+    generation = u->parameters.plan_generation;
+
+    plan_execute(u, plan);
+
+    if (generation == u->parameters.plan_generation && u->parameters.plans)
+        pa_hashmap_put(u->parameters.plans, key, plan);
+    else {
+        pa_xfree(key);
+        plan_free(plan);
+    }
+}
+
+int initme(struct userdata *u, const char *initial_mode) {
+    PA_LLIST_HEAD_INIT(struct mode, u->parameters.modes);
+    PA_LLIST_HEAD_INIT(struct algorithm, u->parameters.algorithms);
+    u->parameters.mode_map = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    u->parameters.algorithm_map = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    u->parameters.plans = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                                              pa_xfree, (pa_free_cb_t) plan_free);
+    u->parameters.store = parameter_store_new();
+
+    u->implementor_args.update_request_cb = (pa_hook_cb_t)update_requests;
+    u->implementor_args.stop_request_cb = (pa_hook_cb_t)stop_requests;
+    u->implementor_args.modifier_registration_cb = (pa_hook_cb_t)register_modifier;
+    u->implementor_args.modifier_unregistration_cb = (pa_hook_cb_t)unregister_modifier;
+
+    meego_parameter_receive_requests(u->core, &u->implementor_args, u);
+    pa_log_debug("Connected to update requests %p", (void*)u->implementor_args.update_request_slot);
+    pa_log_debug("Connected to modifier registrations %p", (void*)u->implementor_args.modifier_registration_slot);
+    pa_log_debug("Connected to modifier unregistrations %p", (void*)u->implementor_args.modifier_unregistration_slot);
+
+    u->mode = NULL;
+
+    if (u->parameters.watch) {
+        char *modes = pa_sprintf_malloc("%s/modes", u->parameters.directory);
+
+        if ((u->parameters.modes_directory = canonicalize_file_name(modes)) &&
+            (u->parameters.watcher = parameter_watcher_new(u->core, WATCH_DELAY_USEC,
+                                                           (parameter_watcher_cb_t) parameters_changed_cb, u)))
+            parameter_watcher_add(u->parameters.watcher, u->parameters.modes_directory);
+        else
+            pa_log_warn("Can not watch %s for changes", modes);
+
+        pa_xfree(modes);
+    }
+
+    /* Let's start in the initial mode */
+    if (switch_mode(u, initial_mode) < 0)
+        return -1;
+
+    /* Load the rest of the modes in the background, so that switching to
+     * them doesn't block the main loop later. */
+    if ((u->parameters.loader = parameter_loader_new(u->core->mainloop, u->parameters.directory, u->parameters.cache,
+                                                     (parameter_loader_cb_t) mode_scanned_cb, u)))
+        parameter_loader_prefetch(u->parameters.loader);
+    else
+        pa_log_warn("Failed to start parameter loader, loading modes synchronously");
+
+    return 0;
+}
+
+void unloadme(struct userdata *u) {
+    struct mode *m;
+    struct algorithm *a;
+
+    pa_assert(u);
+
+    meego_parameter_discontinue_requests(&u->implementor_args);
+
+    if (u->parameters.loader)
+        parameter_loader_free(u->parameters.loader);
+
+    if (u->parameters.watcher)
+        parameter_watcher_free(u->parameters.watcher);
+
+    free(u->parameters.modes_directory);
+
+    pa_xfree(u->parameters.pending_mode);
+
+    if (u->parameters.directory)
+        pa_xfree((void*)u->parameters.directory);
+
+    if (u->parameters.plans) {
+        pa_hashmap_free(u->parameters.plans);
+        u->parameters.plans = NULL;
+    }
+
+    while ((m = u->parameters.modes))
+        mode_free(u, m);
+
+    while ((a = u->parameters.algorithms))
+        algorithm_free(u, a);
+
+    if (u->parameters.mode_map)
+        pa_hashmap_free(u->parameters.mode_map);
+
+    if (u->parameters.algorithm_map)
+        pa_hashmap_free(u->parameters.algorithm_map);
+
+    if (u->parameters.store)
+        parameter_store_free(u->parameters.store);
+}
+
+int switch_mode(struct userdata *u, const char *mode) {
+    struct mode *m;
+    struct mode *from = NULL;
+
+    if (u->parameters.pending_mode && pa_streq(u->parameters.pending_mode, mode))
+        return 0;
+
+    /* Any other switch overrides a switch still waiting for its mode */
+    pa_xfree(u->parameters.pending_mode);
+    u->parameters.pending_mode = NULL;
+
+    if (u->mode && pa_streq(u->mode, mode))
+        return 0;
+
+    if ((m = find_mode_by_name(u, mode)) == NULL) {
+        if (u->parameters.loader) {
+            /* Only the directory is checked here, so that unknown modes
+             * fail right away. The scan is done in the loader thread ahead
+             * of prefetching and the switch completes in mode_scanned_cb(). */
+            if (!mode_exists(u, mode)) {
+                pa_log_error("No such mode: %s", mode);
+                return -1;
+            }
+
+            pa_log_debug("Mode %s not loaded yet, switching when loaded", mode);
+            u->parameters.pending_mode = pa_xstrdup(mode);
+            parameter_loader_request(u->parameters.loader, mode, true);
+            return 0;
+        }
+
+        m = add_mode(u, mode);
+    }
+
+    if (!m) {
+        pa_log_error("No such mode: %s", mode);
+        return -1;
+    }
+
+    if (u->mode) {
+        from = find_mode_by_name(u, u->mode);
+        pa_xfree((void*)u->mode);
+    }
+
+    u->mode = pa_xstrdup(mode);
+
+    pa_log_debug("Checking mode: %s", mode);
+
+    plan_run(u, from, m);
 
     return 0;
 }
@@ -24,6 +24,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulse/xmalloc.h>
 #include <pulse/proplist.h>
 
@@ -37,6 +39,7 @@
 #include <pulsecore/mutex.h>
 #include <pulsecore/atomic.h>
 #include <pulsecore/thread.h>
+#include <pulsecore/sconv.h>
 
 #include "module-meego-record-symdef.h"
 
@@ -44,6 +47,8 @@
 #include "pa-optimized.h"
 #include "memory.h"
 #include "algorithm-hook.h"
+#include "src-48-to-16.h"
+#include "src-48-to-8.h"
 
 #include "module-record-api.h"
 
@@ -52,9 +57,11 @@ PA_MODULE_DESCRIPTION("Nokia record module");
 PA_MODULE_USAGE(
     "master_source=<source to connect to> "
     "source_name=<name of created source> "
-    "stereo=<use 2 channels instead of mono, default true>"
+    "stereo=<use 2 channels instead of mono, default follows master source> "
     "rate=<sample rate, default 48000> "
     "samplelength=<sample length in ms, default 20> "
+    "format=<sample format, default follows master source> "
+    "low_latency=<post partial blocks when algorithms are disabled, default false> "
 );
 PA_MODULE_VERSION(PACKAGE_VERSION);
 
@@ -64,6 +71,8 @@ static const char* const valid_modargs[] = {
     "stereo",
     "rate",
     "samplelength",
+    "format",
+    "low_latency",
     NULL,
 };
 
@@ -71,6 +80,17 @@ static const char* const valid_modargs[] = {
 #define DEFAULT_SAMPLELENGTH (20) //ms
 #define DEFAULT_SAMPLERATE   (48000)
 
+/* Rate the speech decimators take in */
+#define SRC_INPUT_RATE       (48000)
+
+/* The speech decimators always write at least one filter memory hop of
+ * output per call, so they must be fed whole hops of input frames. */
+#define SRC_48_TO_16_HOP_FRAMES (96)   /* 32 output frames */
+#define SRC_48_TO_8_HOP_FRAMES  (240)  /* 40 output frames */
+
+/* Length of crossfade when algorithms are enabled or disabled */
+#define CROSSFADE_USEC       (10000)
+
 #define PROPLIST_SINK "sink.hw0"
 
 struct userdata {
@@ -81,7 +101,27 @@ struct userdata {
     pa_source *source;
     pa_source_output *source_output;
 
+    /* Bytes of S16 master data processed at a time. With low_latency
+     * partial blocks of block_align multiples are processed as well. */
     int maxblocksize;
+    size_t block_align;
+    bool low_latency;
+
+    /* 48kHz to 16kHz/8kHz decimation with the speech resamplers, src_factor
+     * is 0 when the source output resamples instead. */
+    unsigned src_factor;
+    src_48_to_16 *src_16[MEEGO_ALGORITHM_HOOK_CHANNELS_MAX];
+    src_48_to_8 *src_8[MEEGO_ALGORITHM_HOOK_CHANNELS_MAX];
+
+    /* Conversion to source format, NULL when source is S16NE. */
+    pa_convert_func_t convert_from_s16;
+
+    /* Algorithm enable and disable are crossfaded, the hook keeps calling
+     * disabled algorithms for the fade out. fade_length is 0 when not
+     * fading. */
+    bool algorithm_active;
+    unsigned fade_position;
+    unsigned fade_length;
 
     /** Algorithm variables */
     meego_algorithm_hook_api *algorithm;
@@ -106,6 +146,9 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
                 PA_MSGOBJECT(u->master_source), PA_SOURCE_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
                 usec = 0;
 
+            /* Plus what is waiting for a full block */
+            usec += pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq), &u->source_output->sample_spec);
+
             *((pa_usec_t*) data) = usec;
             return 0;
         }
@@ -163,12 +206,168 @@ static int source_set_state_in_main_thread(pa_source *s, pa_source_state_t state
   SOURCE OUTPUT CALLBACKS
  *************************/
 
+static unsigned src_hop_frames(unsigned src_factor) {
+    return src_factor == 3 ? SRC_48_TO_16_HOP_FRAMES : SRC_48_TO_8_HOP_FRAMES;
+}
+
+/* Called from I/O thread context */
+static void resample_channel(struct userdata *u, unsigned channel, pa_memchunk *chunk) {
+    pa_memchunk out;
+    short *input, *output;
+    int frames, done, n, max, hop, hops, calls, i;
+
+    frames = chunk->length / sizeof(short);
+    max = u->src_factor == 3 ? SRC_48_TO_16_MAX_INPUT_FRAMES : SRC_48_TO_8_MAX_INPUT_FRAMES;
+    hop = src_hop_frames(u->src_factor);
+    pa_assert(frames > 0 && frames % hop == 0);
+
+    out.index = 0;
+    out.length = chunk->length / u->src_factor;
+    out.memblock = pa_memblock_new(u->core->mempool, out.length);
+
+    input = (short *) pa_memblock_acquire(chunk->memblock) + chunk->index / sizeof(short);
+    output = pa_memblock_acquire(out.memblock);
+
+    /* Split evenly in whole hops, no call gets a short tail. */
+    hops = frames / hop;
+    calls = (frames + max - 1) / max;
+    for (i = 0, done = 0; i < calls; i++, done += n) {
+        n = (hops / calls + (i < hops % calls ? 1 : 0)) * hop;
+        pa_assert(n > 0 && n <= max);
+        if (u->src_factor == 3)
+            output += process_src_48_to_16(u->src_16[channel], output, input + done, n);
+        else
+            output += process_src_48_to_8(u->src_8[channel], output, input + done, n);
+    }
+    pa_assert(done == frames);
+
+    pa_memblock_release(out.memblock);
+    pa_memblock_release(chunk->memblock);
+    pa_memblock_unref(chunk->memblock);
+
+    *chunk = out;
+}
+
+/* Called from I/O thread context */
+static void process_block(struct userdata *u, pa_memchunk *chunk) {
+    meego_algorithm_hook_data data;
+    meego_algorithm_hook_format format;
+    pa_memchunk out_chunk;
+    pa_memchunk dry;
+    bool algorithm;
+    bool fire;
+    unsigned channels = u->source->sample_spec.channels;
+    unsigned c;
+
+    algorithm = meego_algorithm_hook_enabled(u->hook_algorithm);
+    if (algorithm != u->algorithm_active) {
+        u->algorithm_active = algorithm;
+        u->fade_position = 0;
+        u->fade_length = pa_usec_to_bytes(CROSSFADE_USEC, &u->source->sample_spec) /
+                         pa_frame_size(&u->source->sample_spec);
+        pa_log_debug("Algorithms %s, crossfading %u frames", algorithm ? "enabled" : "disabled", u->fade_length);
+    }
+
+    /* While fading out the hook still calls the algorithms that were enabled */
+    fire = algorithm || u->fade_length > 0;
+
+    if (u->src_factor > 0 || fire) {
+
+        data.channels = channels;
+
+        /* Resampling is done in S16, the hook converts to what slots want */
+        if (fire && u->src_factor == 0)
+            format = meego_algorithm_hook_input_format(u->hook_algorithm);
+        else
+            format = MEEGO_ALGORITHM_HOOK_FORMAT_S16;
+
+        if (format == MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32)
+            pa_optimized_deinterleave_to_float(chunk, data.channel, data.channels);
+        else
+            pa_optimized_deinterleave(chunk, data.channel, data.channels);
+
+        if (u->src_factor > 0)
+            for (c = 0; c < data.channels; c++)
+                resample_channel(u, c, &data.channel[c]);
+
+        /* Keep unprocessed signal to fade from or to */
+        pa_memchunk_reset(&dry);
+        if (u->fade_length > 0) {
+            if (u->src_factor > 0)
+                pa_optimized_interleave(data.channel, &dry, data.channels);
+            else {
+                dry = *chunk;
+                pa_memblock_ref(dry.memblock);
+            }
+        }
+
+        if (fire)
+            meego_algorithm_hook_fire_data(u->hook_algorithm, &data, &format);
+
+        if (format == MEEGO_ALGORITHM_HOOK_FORMAT_FLOAT32)
+            pa_optimized_interleave_from_float(data.channel, &out_chunk, data.channels);
+        else
+            pa_optimized_interleave(data.channel, &out_chunk, data.channels);
+
+        /* Fade in from unprocessed signal, or out to it */
+        if (dry.memblock && algorithm) {
+            pa_optimized_crossfade(&dry, &out_chunk, channels, u->fade_position, u->fade_length);
+            pa_memblock_unref(dry.memblock);
+        } else if (dry.memblock) {
+            pa_memchunk_make_writable(&dry, 0);
+            pa_optimized_crossfade(&out_chunk, &dry, channels, u->fade_position, u->fade_length);
+            pa_memblock_unref(out_chunk.memblock);
+            out_chunk = dry;
+        }
+
+        pa_memblock_unref(chunk->memblock);
+        for (c = 0; c < data.channels; c++)
+            pa_memblock_unref(data.channel[c].memblock);
+
+        *chunk = out_chunk;
+    }
+
+    if (u->fade_length > 0 && (u->fade_position += chunk->length / (channels * sizeof(short))) >= u->fade_length)
+        u->fade_length = 0;
+
+    if (u->convert_from_s16) {
+        unsigned n = chunk->length / sizeof(int16_t);
+        void *src, *dst;
+
+        out_chunk.index = 0;
+        out_chunk.length = n * pa_sample_size(&u->source->sample_spec);
+        out_chunk.memblock = pa_memblock_new(u->core->mempool, out_chunk.length);
+
+        src = (uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index;
+        dst = pa_memblock_acquire(out_chunk.memblock);
+        u->convert_from_s16(n, src, dst);
+        pa_memblock_release(out_chunk.memblock);
+        pa_memblock_release(chunk->memblock);
+
+        pa_memblock_unref(chunk->memblock);
+        *chunk = out_chunk;
+    }
+}
+
+/* Called from I/O thread context */
+static size_t block_length(struct userdata *u) {
+    size_t length;
+
+    /* Algorithms are tuned for full blocks, so only go partial without them. */
+    if (!u->low_latency || meego_algorithm_hook_enabled(u->hook_algorithm) || u->fade_length > 0)
+        return u->maxblocksize;
+
+    length = pa_memblockq_get_length(u->memblockq);
+    length = PA_MIN(length, (size_t) u->maxblocksize);
+    length = (length / u->block_align) * u->block_align;
+
+    return length > 0 ? length : u->block_align;
+}
+
 /* Called from I/O thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *new_chunk) {
     struct userdata *u;
     pa_memchunk chunk;
-    meego_algorithm_hook_data data;
-    pa_memchunk out_chunk;
 
     pa_source_output_assert_ref(o);
     pa_assert_se(u = o->userdata);
@@ -180,25 +379,10 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *new_ch
         return;
     }
 
-    while (util_memblockq_to_chunk(u->core->mempool, u->memblockq, &chunk, u->maxblocksize)) {
+    while (util_memblockq_to_chunk(u->core->mempool, u->memblockq, &chunk, block_length(u))) {
 
         if (PA_SOURCE_IS_OPENED(u->source->thread_info.state)) {
-            if (meego_algorithm_hook_enabled(u->hook_algorithm)) {
-
-                data.channels = 2;
-                pa_optimized_deinterleave_stereo_to_mono(&chunk, &data.channel[0], &data.channel[1]);
-
-                meego_algorithm_hook_fire(u->hook_algorithm, &data);
-
-                pa_optimized_interleave_stereo(&data.channel[0], &data.channel[1], &out_chunk);
-
-                pa_memblock_unref(chunk.memblock);
-                pa_memblock_unref(data.channel[0].memblock);
-                pa_memblock_unref(data.channel[1].memblock);
-
-                chunk = out_chunk;
-            }
-
+            process_block(u, &chunk);
             pa_source_post(u->source, &chunk);
         }
 
@@ -366,6 +550,7 @@ static void source_output_kill_cb(pa_source_output *o) {
 static void set_hooks(struct userdata *u) {
     u->algorithm = meego_algorithm_hook_api_get(u->core);
     u->hook_algorithm = meego_algorithm_hook_init(u->algorithm, RECORD_HOOK_DYNAMIC_ENHANCE);
+    meego_algorithm_hook_set_fade_out(u->hook_algorithm, true);
 }
 
 static void unset_hooks(struct userdata *u) {
@@ -382,15 +567,20 @@ int pa__init(pa_module*m) {
     struct userdata *u;
     const char *source_name, *master_source_name;
     pa_source *master_source;
-    pa_sample_spec ss;
+    pa_sample_spec ss, output_ss;
     pa_channel_map map;
     char t[256];
     pa_source_output_new_data source_output_data;
     pa_source_new_data source_data;
-    bool stereo = true;
+    const char *stereo;
+    const char *format;
+    bool low_latency = false;
     unsigned samplerate;
     unsigned samplelength;
-    int maxblocksize;
+    unsigned src_factor = 0;
+    unsigned frames;
+    unsigned align;
+    unsigned c;
 
     pa_assert(m);
 
@@ -402,34 +592,73 @@ int pa__init(pa_module*m) {
     source_name = pa_modargs_get_value(ma, "source_name", NULL);
     master_source_name = pa_modargs_get_value(ma, "master_source", NULL);
 
-    if (pa_modargs_get_value(ma, "stereo", NULL)) {
-        stereo = pa_parse_boolean(pa_modargs_get_value(ma, "stereo", NULL));
-    }
+    stereo = pa_modargs_get_value(ma, "stereo", NULL);
 
     samplerate = DEFAULT_SAMPLERATE;
     samplelength = DEFAULT_SAMPLELENGTH;
     pa_modargs_get_value_u32(ma, "rate", &samplerate);
     pa_modargs_get_value_u32(ma, "samplelength", &samplelength);
+    format = pa_modargs_get_value(ma, "format", NULL);
+
+    if (pa_modargs_get_value_boolean(ma, "low_latency", &low_latency) < 0) {
+        pa_log_error("low_latency= expects a boolean argument");
+        goto fail;
+    }
 
     if (!(master_source = pa_namereg_get(m->core, master_source_name, PA_NAMEREG_SOURCE))) {
         pa_log_error("Master source \"%s\" not found", master_source_name);
         goto fail;
     }
 
-    /* samplerate (Hz) * x channels * 2 (two bytes = 16 bit) * samplelength (s)  */
-    maxblocksize = samplerate * (stereo ? 2:1) * 2 * samplelength / 1000 ;
-
-    /* ss.format = PA_SAMPLE_S16LE; */
     ss.format = master_source->sample_spec.format;
+    if (format && (ss.format = pa_parse_sample_format(format)) == PA_SAMPLE_INVALID) {
+        pa_log_error("Invalid sample format \"%s\"", format);
+        goto fail;
+    }
     ss.rate = samplerate;
     if (stereo) {
+        /* Explicit channel count requested */
+        if (pa_parse_boolean(stereo) != 0) {
+            ss.channels = 2;
+            pa_channel_map_init_stereo(&map);
+        } else {
+            ss.channels = 1;
+            pa_channel_map_init_mono(&map);
+        }
+    } else if (master_source->sample_spec.channels <= MEEGO_ALGORITHM_HOOK_CHANNELS_MAX) {
+        /* Follow master source, so that multi-mic input reaches algorithms as is */
+        ss.channels = master_source->sample_spec.channels;
+        map = master_source->channel_map;
+    } else {
+        pa_log_warn("Master source has %u channels, algorithms support up to %u, using stereo",
+                    master_source->sample_spec.channels, MEEGO_ALGORITHM_HOOK_CHANNELS_MAX);
         ss.channels = 2;
         pa_channel_map_init_stereo(&map);
-    } else {
-        ss.channels = 1;
-        pa_channel_map_init_mono(&map);
     }
 
+    if (!pa_sample_spec_valid(&ss)) {
+        pa_log_error("Invalid sample spec");
+        goto fail;
+    }
+
+    /* Algorithms and decimators work in S16, source output takes care
+     * of converting master format. Speech rates from 48kHz masters use our
+     * own decimators, anything else is resampled by source output. */
+    output_ss = ss;
+    output_ss.format = PA_SAMPLE_S16NE;
+    if (master_source->sample_spec.rate == SRC_INPUT_RATE && (samplerate == 16000 || samplerate == 8000)) {
+        src_factor = SRC_INPUT_RATE / samplerate;
+        output_ss.rate = SRC_INPUT_RATE;
+    }
+
+    /* Whole blocks of 8 output frames for deinterleave. With own
+     * decimation whole decimator hops, which are multiples of 8 as well. */
+    align = src_factor ? src_hop_frames(src_factor) / src_factor : 8;
+    frames = samplerate * samplelength / 1000;
+    frames = PA_MAX(align, (frames + align / 2) / align * align);
+    if (frames != samplerate * samplelength / 1000)
+        pa_log_info("Block of %u ms rounded to %u frames", samplelength, frames);
+
     u = pa_xnew0(struct userdata, 1);
     m->userdata = u;
     u->core = m->core;
@@ -437,9 +666,26 @@ int pa__init(pa_module*m) {
     u->master_source = master_source;
     u->source = NULL;
     u->source_output = NULL;
-    u->maxblocksize = maxblocksize;
+    u->low_latency = low_latency;
+    u->src_factor = src_factor;
+    u->block_align = align * PA_MAX(src_factor, 1u) * pa_frame_size(&output_ss);
+    u->maxblocksize = frames * PA_MAX(src_factor, 1u) * pa_frame_size(&output_ss);
+
+    for (c = 0; src_factor > 0 && c < ss.channels; c++) {
+        if (src_factor == 3)
+            u->src_16[c] = alloc_src_48_to_16();
+        else
+            u->src_8[c] = alloc_src_48_to_8();
+    }
+
+    if (ss.format != PA_SAMPLE_S16NE)
+        u->convert_from_s16 = pa_get_convert_from_s16ne_function(ss.format);
+
+    pa_log_debug("record: %s %uHz (%s decimation) block %d bytes%s",
+                 pa_sample_format_to_string(ss.format), ss.rate, src_factor ? "own" : "no",
+                 u->maxblocksize, low_latency ? ", low latency" : "");
 
-    u->memblockq = pa_memblockq_new("record memblockq", 0, maxblocksize*8, 0, &ss, 0, 0, 0, NULL);
+    u->memblockq = pa_memblockq_new("record memblockq", 0, u->maxblocksize*8, 0, &output_ss, 0, 0, 0, NULL);
     if (!u->memblockq) {
         pa_log_error("couldn't alloc memblockq");
         goto fail;
@@ -491,7 +737,7 @@ int pa__init(pa_module*m) {
     source_output_data.destination_source = u->source;
     source_output_data.driver = __FILE__;
     source_output_data.module = m;
-    pa_source_output_new_data_set_sample_spec(&source_output_data, &ss);
+    pa_source_output_new_data_set_sample_spec(&source_output_data, &output_ss);
     pa_source_output_new_data_set_channel_map(&source_output_data, &map);
 
     pa_source_output_new(&u->source_output, m->core, &source_output_data);
@@ -535,6 +781,7 @@ int pa__init(pa_module*m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
+    unsigned c;
 
     pa_assert(m);
 
@@ -558,5 +805,12 @@ void pa__done(pa_module*m) {
         u->memblockq = NULL;
     }
 
+    for (c = 0; c < MEEGO_ALGORITHM_HOOK_CHANNELS_MAX; c++) {
+        if (u->src_16[c])
+            free_src_48_to_16(u->src_16[c]);
+        if (u->src_8[c])
+            free_src_48_to_8(u->src_8[c]);
+    }
+
     pa_xfree(u);
 }
@@ -22,11 +22,17 @@
 #ifndef module_record_api_h
 #define module_record_api_h
 
-#define RECORD_API_VERSION "0.1"
+#define RECORD_API_VERSION "0.2"
 
-/* Type: meego_algorithm_hook_data      Channels: 2 */
+/* Type: meego_algorithm_hook_data      Channels: as record source, see below */
 #define RECORD_HOOK_DYNAMIC_ENHANCE              "x-meego.record.dynamic_enhance"
 
+/* Record source takes its channel count and map from the master source,
+ * or is mono or stereo if the module is loaded with stereo=. Masters with
+ * more than MEEGO_ALGORITHM_HOOK_CHANNELS_MAX channels fall back to stereo.
+ * Implementors read the count from meego_algorithm_hook_data channels and
+ * the map from the record source. */
+
 #define PA_PROP_SOURCE_RECORD_API_EXTENSION_PROPERTY_NAME "source.api-extension.meego.record"
 #define PA_PROP_SOURCE_RECORD_API_EXTENSION_PROPERTY_VALUE RECORD_API_VERSION
 
@@ -25,6 +25,7 @@
 #endif
 
 #include <pulsecore/macro.h>
+#include <pulsecore/log.h>
 #include <pulse/xmalloc.h>
 #include <asoundlib.h>
 #include "alsa-utils.h"
@@ -34,14 +35,49 @@
 struct ctrl_element {
     snd_mixer_t *mixer;
 
-    /* We'll store the element name and query the element pointer from the
-     * mixer every time we set the element volume. This is how it's done in
-     * PulseAudio, I guess in case the element "disappears", so let's just
-     * follow the same convention. */
+    /* The element may "disappear", so we keep the name for looking it up
+     * again. The resolved element is cached and dropped when the mixer
+     * reports the element removed. */
     char *element_name;
-
+    snd_mixer_elem_t *element;
 };
 
+static int element_cb(snd_mixer_elem_t *element, unsigned int mask) {
+    ctrl_element *ctrl = snd_mixer_elem_get_callback_private(element);
+
+    if (ctrl && mask == SND_CTL_EVENT_MASK_REMOVE && ctrl->element == element) {
+        pa_log_debug("Element %s removed", ctrl->element_name);
+        ctrl->element = NULL;
+    }
+
+    return 0;
+}
+
+static void element_release(ctrl_element *ctrl) {
+    if (ctrl->element) {
+        snd_mixer_elem_set_callback(ctrl->element, NULL);
+        snd_mixer_elem_set_callback_private(ctrl->element, NULL);
+        ctrl->element = NULL;
+    }
+}
+
+/* Returns the cached element, or looks it up if it's not resolved yet
+ * or has been removed. */
+static snd_mixer_elem_t *element_get(ctrl_element *ctrl) {
+    int err;
+
+    /* Deliver pending mixer events, they may invalidate the cached element. */
+    if ((err = snd_mixer_handle_events(ctrl->mixer)) < 0)
+        pa_log_debug("Failed to handle mixer events: %s", snd_strerror(err));
+
+    if (!ctrl->element && (ctrl->element = mixer_get_element(ctrl->mixer, ctrl->element_name))) {
+        snd_mixer_elem_set_callback(ctrl->element, element_cb);
+        snd_mixer_elem_set_callback_private(ctrl->element, ctrl);
+    }
+
+    return ctrl->element;
+}
+
 ctrl_element *ctrl_element_new(snd_mixer_t *mixer, const char* name) {
     pa_assert(mixer);
     pa_assert(name);
@@ -53,7 +89,7 @@ ctrl_element *ctrl_element_new(snd_mixer_t *mixer, const char* name) {
     ctrl->mixer = mixer;
     ctrl->element_name = pa_xstrdup(name);
 
-    element = mixer_get_element(mixer, name);
+    element = element_get(ctrl);
     if(!element) {
         pa_log_error("Unable to open mixer element \"%s\"", name);
         goto fail;
@@ -69,6 +105,8 @@ ctrl_element *ctrl_element_new(snd_mixer_t *mixer, const char* name) {
 
 fail:
 
+    element_release(ctrl);
+    pa_xfree(ctrl->element_name);
     pa_xfree(ctrl);
 
     return NULL;
@@ -76,6 +114,7 @@ fail:
 
 void ctrl_element_free(ctrl_element *ctrl) {
     pa_assert(ctrl);
+    element_release(ctrl);
     pa_xfree(ctrl->element_name);
     pa_xfree(ctrl);
 }
@@ -85,7 +124,7 @@ int ctrl_element_mute(ctrl_element *ctrl) {
 
     snd_mixer_elem_t *element = NULL;
 
-    element = mixer_get_element(ctrl->mixer, ctrl->element_name);
+    element = element_get(ctrl);
     if(!element) {
         pa_log_error("Element %s has disappeared.", ctrl->element_name);
         return -1;
@@ -105,7 +144,7 @@ int set_ctrl_element_volume(ctrl_element *ctrl,int step) {
 
     snd_mixer_elem_t *element = NULL;
 
-    element = mixer_get_element(ctrl->mixer, ctrl->element_name);
+    element = element_get(ctrl);
     if(!element) {
         pa_log_error("Element %s has disappeared.", ctrl->element_name);
         return -1;
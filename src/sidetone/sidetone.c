@@ -51,6 +51,7 @@ struct element_volume {
 
 /* Sidetone object data */
 struct sidetone {
+    pa_core *core;
     /* The mixer that contains the elements of the sidetone loop */
     snd_mixer_t *mixer;
     /* The element used for controlling the sidetone loop volume */
@@ -63,8 +64,10 @@ struct sidetone {
     pa_hook_slot* sink_unlink_slot;
     /* right now not in use but would be needed in future  */
     pa_mutex *mutex;
-    /* subscription for getting current volume*/
-    pa_subscription *sink_subscription;
+    /* Master sink volume changes */
+    pa_hook_slot *sink_volume_changed_slot;
+    /* Writes the latest sidetone step once per main loop iteration */
+    pa_defer_event *write_event;
     /* sink we are interested in*/
     pa_sink *master_sink;
     /* store the current volume , to compare next time */
@@ -73,6 +76,8 @@ struct sidetone {
     struct mv_volume_steps *total_steps;
     /* step used for setting sidetone control element volume */
     int sidetone_step;
+    /* step last written to the control element, -1 if none */
+    int written_step;
 };
 
 
@@ -125,43 +130,51 @@ static int sidetone_volume_get_step(struct sidetone *st) {
     return st->sidetone_step;
 }
 
-/* get the current volume , convert it into millibels , find out the corrosponding volume step , map this
-volume step to sidetone control element volume step. set the sidetone volume using control element volume
-step */
-static void sink_input_subscribe_sidetone_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, sidetone *st) {
-    int sidetone_step = -1;
-    int ret = 0;
-    int old_sidetone_step;
-
-    pa_assert(c);
+static void write_cb(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    sidetone *st = userdata;
+
     pa_assert(st);
 
-    pa_log_debug("subscription event is called  ");
+    m->defer_enable(e, 0);
 
-    if (PA_SUBSCRIPTION_EVENT_SINK_INPUT != (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK)) {
-        pa_log_debug("subscription event not found");
+    if (st->dead || st->sidetone_step == st->written_step)
+        return;
+
+    pa_log_debug(" setting sidetone step %d", st->sidetone_step);
+
+    /* set the sidetone volume using step */
+    if (set_ctrl_element_volume(st->ctrl_element, st->sidetone_step) < 0) {
+        pa_log_warn("can't set sidetone volume");
         return;
     }
 
-    old_sidetone_step = st->sidetone_step;
+    st->written_step = st->sidetone_step;
+}
+
+/* get the current volume , convert it into millibels , find out the corrosponding volume step , map this
+volume step to sidetone control element volume step. The control element volume is set from write_cb(),
+so a burst of volume changes results in one write. */
+static pa_hook_result_t sink_volume_changed_cb(pa_sink *sink, void *call_data, sidetone *st) {
+    int sidetone_step;
+
+    pa_assert(sink);
+    pa_assert(st);
+
+    if (sink != st->master_sink || st->dead)
+        return PA_HOOK_OK;
+
     /* fetch the sidetone step */
-    sidetone_step = sidetone_volume_get_step(st);
-    if (sidetone_step == old_sidetone_step ) {
-            pa_log_debug("volume is same as previous one");
-            return;
-    }
-    if (sidetone_step < 0 ) {
+    if ((sidetone_step = sidetone_volume_get_step(st)) < 0) {
         pa_log_warn("cant fetch the correct sidetone volume step");
-        return;
+        return PA_HOOK_OK;
     }
 
-    pa_log_debug(" setting sidetone step %d", sidetone_step);
+    st->sidetone_step = sidetone_step;
 
-    /* set the sidetone volume using step */
-    ret = set_ctrl_element_volume(st->ctrl_element, sidetone_step);
-    if (ret < 0)
-       pa_log_warn("can't set sidetone volume");
+    if (sidetone_step != st->written_step)
+        st->core->mainloop->defer_enable(st->write_event, 1);
 
+    return PA_HOOK_OK;
 }
 
 
@@ -211,6 +224,8 @@ sidetone *sidetone_new(pa_core *core, const char* argument) {
         goto fail;
 
     st = pa_xnew0(struct sidetone, 1);
+    st->core = core;
+    st->written_step = -1;
     st->volume_current = pa_xnew0(struct pa_cvolume, 1);;
 
     st->total_steps = pa_xnew0(struct mv_volume_steps, 1);
@@ -245,8 +260,12 @@ sidetone *sidetone_new(pa_core *core, const char* argument) {
                                            (pa_hook_cb_t)sink_unlink_cb, st);
 
 
-    /* subscription made for fetching the current main volume */
-    st->sink_subscription = pa_subscription_new(core, PA_SUBSCRIPTION_MASK_SINK_INPUT, (pa_subscription_cb_t) sink_input_subscribe_sidetone_cb, st);
+    st->write_event = core->mainloop->defer_new(core->mainloop, write_cb, st);
+    core->mainloop->defer_enable(st->write_event, 0);
+
+    /* Follow the main volume */
+    st->sink_volume_changed_slot = pa_hook_connect(&core->hooks[PA_CORE_HOOK_SINK_VOLUME_CHANGED], PA_HOOK_NORMAL,
+                                                   (pa_hook_cb_t) sink_volume_changed_cb, st);
 
     st->dead = false;
 
@@ -270,8 +289,19 @@ fail:
 void sidetone_free(sidetone *st) {
     pa_assert(st);
 
+    if (st->sink_volume_changed_slot) {
+        pa_hook_slot_free(st->sink_volume_changed_slot);
+        st->sink_volume_changed_slot = NULL;
+    }
+
+    if (st->write_event) {
+        st->core->mainloop->defer_free(st->write_event);
+        st->write_event = NULL;
+    }
+
     if (st->ctrl_element) {
       ctrl_element_mute(st->ctrl_element);
+      ctrl_element_free(st->ctrl_element);
       st->ctrl_element = NULL;
     }
 
@@ -290,11 +320,6 @@ void sidetone_free(sidetone *st) {
         st->volume_current = NULL;
     }
 
-    if (st->sink_subscription) {
-        pa_subscription_free(st->sink_subscription);
-        st->sink_subscription = NULL;
-    }
-
     if (st->sink_unlink_slot) {
         pa_hook_slot_free(st->sink_unlink_slot);
         st->sink_unlink_slot = NULL;
@@ -36,6 +36,7 @@
 #include "voice-voip-source.h"
 #include "voice-util.h"
 #include "voice-aep-ear-ref.h"
+#include "voice-sidetone.h"
 #include "voice-mainloop-handler.h"
 #include "module-voice-api.h"
 
@@ -51,7 +52,11 @@ PA_MODULE_USAGE("voice_sink_name=<name for the voice sink> "
                 "master_source=<source to connect to> "
                 "raw_sink=<name for raw sink> "
                 "raw_source=<name for raw source> "
-                "max_hw_frag_size=<maximum fragment size of master sink and source in usecs>");
+                "max_hw_frag_size=<maximum fragment size of master sink and source in usecs> "
+                "raw_batch_fragments=<number of master sink fragments rendered per wakeup when not in a call, raises raw sink latency accordingly> "
+                "memchunk_pool_size=<number of DL frames that can be queued for ear reference> "
+                "sidetone_steps=<software sidetone gain:master volume pairs in millibels> "
+                "sidetone_latency_budget=<software sidetone latency budget in usecs>");
 PA_MODULE_VERSION(PACKAGE_VERSION) ;
 
 
@@ -63,6 +68,10 @@ static const char* const valid_modargs[] = {
     "raw_sink_name",
     "raw_source_name",
     "max_hw_frag_size",
+    "raw_batch_fragments",
+    "memchunk_pool_size",
+    "sidetone_steps",
+    "sidetone_latency_budget",
     NULL,
 };
 
@@ -82,6 +91,8 @@ static void voice_update_volumes(struct userdata *u) {
     /* assign the current volume, will be used for the next time*/
     u->previous_volume = *cvol;
 
+    voice_sidetone_volume_changed(u, cvol);
+
     if (voice_voip_source_active(u))
         meego_algorithm_hook_fire(u->hooks[HOOK_CALL_VOLUME], (void*)cvol);
     else
@@ -173,6 +184,10 @@ int pa__init(pa_module*m) {
     const char *voice_source_name;
     const char *max_hw_frag_size_str;
     int max_hw_frag_size = 3840;
+    uint32_t raw_batch_fragments = 1;
+    uint32_t memchunk_pool_size = VOICE_MEMCHUNK_POOL_SIZE;
+    uint32_t sidetone_latency_budget = VOICE_SIDETONE_LATENCY_BUDGET_USEC;
+    unsigned i;
 
     pa_assert(m);
 
@@ -222,6 +237,25 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_u32(ma, "raw_batch_fragments", &raw_batch_fragments) < 0 ||
+        raw_batch_fragments < 1) {
+        pa_log("Bad value for raw_batch_fragments");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "memchunk_pool_size", &memchunk_pool_size) < 0 ||
+        memchunk_pool_size < 1 ||
+        memchunk_pool_size > VOICE_MEMCHUNK_POOL_SIZE_MAX) {
+        pa_log("Bad value for memchunk_pool_size");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "sidetone_latency_budget", &sidetone_latency_budget) < 0 ||
+        sidetone_latency_budget < 1) {
+        pa_log("Bad value for sidetone_latency_budget");
+        goto fail;
+    }
+
     u->modargs = ma;
     u->core = m->core;
     u->module = m;
@@ -254,6 +288,8 @@ int pa__init(pa_module*m) {
     u->hw_fragment_size_max = max_hw_frag_size;
     if (0 != (u->hw_fragment_size_max % u->hw_fragment_size))
         u->hw_fragment_size_max += u->hw_fragment_size - (u->hw_fragment_size_max % u->hw_fragment_size);
+    u->raw_batch_size = PA_MIN(raw_batch_fragments * u->hw_fragment_size, u->hw_fragment_size_max);
+    u->raw_batch_usec = pa_bytes_to_usec(u->raw_batch_size, &u->hw_sample_spec);
     u->aep_hw_mono_fragment_size = pa_usec_to_bytes(VOICE_PERIOD_AEP_USECS+1, &u->hw_mono_sample_spec);
     u->hw_mono_fragment_size = pa_usec_to_bytes(VOICE_PERIOD_MASTER_USECS+1, &u->hw_mono_sample_spec);
 
@@ -264,15 +300,16 @@ int pa__init(pa_module*m) {
                             & u->aep_sample_spec,
                             u->aep_fragment_size);
 
-    voice_memchunk_pool_load(u);
+    voice_memchunk_pool_load(u, memchunk_pool_size);
 
     if (voice_init_raw_sink(u, raw_sink_name))
         goto fail;
 
     u->shared = pa_shared_data_get(m->core);
+    pa_assert_se((u->call_state_key = pa_shared_data_key_register(u->shared, PA_NEMO_PROP_CALL_STATE)));
 
     pa_atomic_store(&u->mixer_state, PROP_MIXER_TUNING_PRI);
-    pa_shared_data_sets(u->shared, PA_NEMO_PROP_CALL_STATE, PA_NEMO_PROP_CALL_STATE_INACTIVE);
+    pa_shared_data_key_sets(u->call_state_key, PA_NEMO_PROP_CALL_STATE_INACTIVE);
     u->alt_mixer_compensation = PA_VOLUME_NORM;
 
     if (voice_init_hw_sink_input(u))
@@ -318,9 +355,14 @@ int pa__init(pa_module*m) {
     u->hw_source_memblockq = // 8 * 5ms = 40ms
         pa_memblockq_new("voice hw_source_memblockq", 0, 2*u->hw_fragment_size_max, 0, &u->hw_sample_spec, 0, 0, 0, NULL);
 
-    u->ul_memblockq =
-        pa_memblockq_new("voice ul_memblockq", 0, 2*u->voice_ul_fragment_size, 0, &u->aep_sample_spec, 0, 0, 0, NULL);
+    for (i = 0; i < VOICE_UL_FRAME_POOL_SIZE; i++)
+        u->ul_frame_pool[i] = pa_memblock_new(u->core->mempool, u->voice_ul_fragment_size);
+    u->ul_frame_pool_next = 0;
+    u->ul_frame.memblock = u->ul_frame_pool[0];
+    u->ul_frame.index = 0;
+    u->ul_frame.length = 0;
 
+    u->dl_sideinfo_ring = pa_xnew0(voice_sideinfo_ring, 1);
     u->dl_sideinfo_queue = pa_queue_new();
 
     u->ul_deadline = 0;
@@ -333,6 +375,10 @@ int pa__init(pa_module*m) {
     if (voice_convert_init(u))
         goto fail;
 
+    if (voice_sidetone_init(u, pa_modargs_get_value(ma, "sidetone_steps", NULL), sidetone_latency_budget) < 0)
+        goto fail;
+    voice_sidetone_volume_changed(u, &u->master_sink->real_volume);
+
     /* IHF mode is the default and this initialization is consistent with it. */
     u->active_mic_channel = MIC_CH0;
 
@@ -26,8 +26,11 @@
 #include <config.h>
 #endif
 
+#include <stdint.h>
+
 #include <pulsecore/sink.h>
 #include <pulsecore/source.h>
+#include <pulsecore/atomic.h>
 
 #define VOICE_SOURCE_FRAMESIZE (20000) /* us */
 #define VOICE_SINK_FRAMESIZE (10000) /* us */
@@ -39,7 +42,7 @@
 #define VOICE_PERIOD_AEP_USECS    10000
 #define VOICE_PERIOD_CMT_USECS    20000
 
-#define VOICE_API_VERSION "0.1"
+#define VOICE_API_VERSION "0.2"
 
 /*      C-name                                  hook name                                   call_data */
 #define VOICE_HOOK_HW_SINK_PROCESS              "x-meego.voice.hw_sink_process"         /* default 2ch */
@@ -76,7 +79,16 @@ enum {
 };
 
 enum {
+    /* Deprecated, data is pa_queue **. Still served for clients of API
+     * version 0.1, new clients should use VOICE_SINK_GET_SIDE_INFO_RING_PTR. */
     VOICE_SINK_GET_SIDE_INFO_QUEUE_PTR = PA_SINK_MESSAGE_MAX + 100,
+    /* data is voice_sideinfo_ring **, see below. Fails while another
+     * client has the ring, until it sends VOICE_SINK_RELEASE_SIDE_INFO. */
+    VOICE_SINK_GET_SIDE_INFO_RING_PTR,
+    /* Sent by the side info client when it stops pushing, data is unused.
+     * Side info is popped and underflows are counted only while a client
+     * has the ring or the queue. */
+    VOICE_SINK_RELEASE_SIDE_INFO,
 };
 
 #define PA_PROP_SINK_API_EXTENSION_PROPERTY_NAME "sink.api-extension.meego.voice"
@@ -91,7 +103,62 @@ enum {
 #define VOICE_SIDEINFO_FLAG_SPEECH (0x0001)
 #define VOICE_SIDEINFO_FLAG_BAD    (0x0002)
 /* Because pa_queue does not like NULL pointers, this flag is added to every
- * set of flags to make the pa_queue entries non null. */
+ * set of flags to make the pa_queue entries non null. Not needed with the
+ * side info ring, ignored by the voice module. */
 #define VOICE_SIDEINFO_FLAG_BOGUS  (0x8000)
 
+/* Downlink side info ring. Single producer (the client pushing one set of
+ * spc flags per AEP fragment written to voice sink) and single consumer
+ * (voice module DL processing in master sink IO thread). Storage is
+ * preallocated, push and pop never allocate or block.
+ *
+ * Read and write indices run modulo 2 * VOICE_SIDEINFO_RING_SIZE so that
+ * full and empty ring can be told apart without a separate counter. */
+#define VOICE_SIDEINFO_RING_SIZE (64) /* must be power of two */
+#define VOICE_SIDEINFO_RING_INDEX_MASK (2 * VOICE_SIDEINFO_RING_SIZE - 1)
+
+typedef struct voice_sideinfo_ring {
+    pa_atomic_t write_index;
+    pa_atomic_t read_index;
+    pa_atomic_t overflow_count;     /* pushes dropped because ring was full */
+    pa_atomic_t underflow_count;    /* pops from an empty ring */
+    uint32_t flags[VOICE_SIDEINFO_RING_SIZE];
+} voice_sideinfo_ring;
+
+static inline unsigned voice_sideinfo_ring_depth(voice_sideinfo_ring *r) {
+    return (unsigned) (pa_atomic_load(&r->write_index) - pa_atomic_load(&r->read_index)) &
+        VOICE_SIDEINFO_RING_INDEX_MASK;
+}
+
+/* Called by producer. Returns false and counts an overflow if ring is full. */
+static inline bool voice_sideinfo_ring_push(voice_sideinfo_ring *r, uint32_t spc_flags) {
+    int w = pa_atomic_load(&r->write_index);
+
+    if ((unsigned) (w - pa_atomic_load(&r->read_index)) & VOICE_SIDEINFO_RING_SIZE) {
+        pa_atomic_inc(&r->overflow_count);
+        return false;
+    }
+
+    r->flags[w & (VOICE_SIDEINFO_RING_SIZE - 1)] = spc_flags;
+    /* pa_atomic_store() is a full barrier, flags entry is visible before index. */
+    pa_atomic_store(&r->write_index, (w + 1) & VOICE_SIDEINFO_RING_INDEX_MASK);
+
+    return true;
+}
+
+/* Called by consumer. Returns false and counts an underflow if ring is empty. */
+static inline bool voice_sideinfo_ring_pop(voice_sideinfo_ring *r, uint32_t *spc_flags) {
+    int rd = pa_atomic_load(&r->read_index);
+
+    if (rd == pa_atomic_load(&r->write_index)) {
+        pa_atomic_inc(&r->underflow_count);
+        return false;
+    }
+
+    *spc_flags = r->flags[rd & (VOICE_SIDEINFO_RING_SIZE - 1)];
+    pa_atomic_store(&r->read_index, (rd + 1) & VOICE_SIDEINFO_RING_INDEX_MASK);
+
+    return true;
+}
+
 #endif /* module_voice_api_h */
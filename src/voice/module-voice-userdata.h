@@ -36,15 +36,29 @@
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/semaphore.h>
 #include <pulsecore/fdsem.h>
+#include <pulsecore/queue.h>
 
 #include "shared-data.h"
 #include "src-48-to-8.h"
+#ifdef X86
+#include "src-48-to-8-stereo.h"
+#endif
 #include "src-8-to-48.h"
 
 #include "algorithm-hook.h"
+#include "module-voice-api.h"
 
 #include <voice-hooks.h>
 
+/* Mic resampling with channel selection in one pass is portable C. On ARM
+ * the prebuilt NEON resampler is used on a separated mono channel instead,
+ * see voice_convert_run_48_stereo_to_8_mic(). */
+#ifdef X86
+typedef src_48_to_8_stereo voice_mic_resampler;
+#else
+typedef src_48_to_8 voice_mic_resampler;
+#endif
+
 /* This is a copy/paste from module-alsa-sink-volume.c, keep it up to date!*/
 /* String with single integer defining which mixer
  * tuning table is used. Currently only two different tables
@@ -66,6 +80,29 @@ typedef enum {
 } call_mic_ch_t;
 
 
+/* Free list of pa_memchunk entries used to pass DL frames to ear reference
+ * loop. Entries are linked by table index and list head carries a change
+ * tag in its upper half, so a stale head fails the cmpxchg instead of
+ * corrupting the list (ABA). See voice_memchunk_pool_get/free(). */
+typedef struct voice_memchunk_pool_entry {
+    pa_memchunk chunk;      /* must be first */
+    pa_atomic_t next;       /* index + 1 of next free entry, 0 terminates */
+} voice_memchunk_pool_entry;
+
+typedef struct voice_sidetone voice_sidetone;
+
+typedef struct voice_memchunk_pool {
+    voice_memchunk_pool_entry *table;
+    unsigned size;
+    unsigned low_water;         /* warn when free entries drop below this */
+    pa_atomic_t head;           /* tag << 16 | (index + 1) of first free entry */
+    pa_atomic_t in_use;
+    pa_atomic_t in_use_max;     /* high-water mark */
+    pa_atomic_t exhausted;      /* failed gets */
+    pa_atomic_t low_water_hit;  /* times free entries went below low_water */
+    pa_atomic_t low_water_active;
+} voice_memchunk_pool;
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -89,6 +126,8 @@ struct userdata {
     size_t aep_hw_fragment_size;
     size_t hw_fragment_size;
     size_t hw_fragment_size_max;
+    size_t raw_batch_size;  /* N * hw_fragment_size rendered per pop when not in a call */
+    pa_usec_t raw_batch_usec;
     size_t hw_mono_fragment_size;
     size_t aep_hw_mono_fragment_size;
 
@@ -96,7 +135,7 @@ struct userdata {
 
     pa_memchunk aep_silence_memchunk;
 
-    pa_atomic_ptr_t memchunk_pool;
+    voice_memchunk_pool memchunk_pool;
 
     pa_sink *master_sink;
     pa_source *master_source;
@@ -123,17 +162,29 @@ struct userdata {
 
     pa_memblockq *hw_source_memblockq;
 
-    pa_memblockq *ul_memblockq;
+    pa_memchunk ul_frame;  /* UL frame being collected, length is bytes collected so far */
+    /* Blocks ul_frame is collected to. Posted frames stay referenced by
+     * source outputs for a while, a block is reused once they let go. */
+#define VOICE_UL_FRAME_POOL_SIZE (4)
+    pa_memblock *ul_frame_pool[VOICE_UL_FRAME_POOL_SIZE];
+    unsigned ul_frame_pool_next;
 
     int64_t ul_deadline;   /* Comparabel to pa_rtclock_now() */
 
     int16_t linear_q15_master_volume_L;
     int16_t linear_q15_master_volume_R;
 
+    voice_sideinfo_ring *dl_sideinfo_ring;
+    /* Deprecated pa_queue side info, kept for clients of API version 0.1 */
     pa_queue *dl_sideinfo_queue;
+    /* Which one of the above has a client, master sink IO thread only */
+    bool dl_sideinfo_ring_attached;
+    bool dl_sideinfo_queue_attached;
+
+    voice_sidetone *sidetone; /* NULL unless software sidetone is configured */
 
-    src_48_to_8 *hw_source_to_aep_resampler;
-    src_48_to_8 *hw_source_to_aep_amb_resampler;
+    voice_mic_resampler *hw_source_to_aep_resampler;
+    voice_mic_resampler *hw_source_to_aep_amb_resampler;
     src_8_to_48 *aep_to_hw_sink_resampler;
     src_48_to_8 *ear_to_aep_resampler;
     src_48_to_8 *raw_sink_to_hw8khz_sink_resampler;
@@ -153,6 +204,7 @@ struct userdata {
     pa_subscription *sink_subscription;
 
     pa_shared_data *shared;
+    pa_shared_data_key *call_state_key;
 
     unsigned current_audio_mode_hwid_hash;
     meego_algorithm_hook *hooks[HOOK_MAX];
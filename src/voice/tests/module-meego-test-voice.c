@@ -0,0 +1,827 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+/*
+ * Synthetic voice call for module-meego-voice, see voice-test.pa.
+ *
+ * Voice module master source is the monitor of its master sink, so whatever
+ * is played out comes straight back as mic signal. Bursts of known PCM are
+ * written to voice sink (positive) and raw sink (negative), and their onsets
+ * are detected at the master sink monitor and at voice and raw sources:
+ *
+ *   DL latency     sink input pop -> master sink monitor
+ *   UL latency     master sink monitor -> voice/raw source
+ *   ear ref error  onset in AEP uplink mic vs. ear reference signal
+ *   CPU per frame  master IO thread CPU time per AEP uplink frame
+ *
+ * AEP and EQ hooks are run through pass-through stub algorithms. When the
+ * test duration has passed results are logged and, with exit=true, the
+ * daemon is told to exit with 0 if all limits were met and 1 otherwise.
+ * Limits apply to the 90th percentile of each measurement, the maximum is
+ * only logged, so that a few late wakeups on a loaded host don't fail the
+ * test.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/modargs.h>
+#include <pulsecore/module.h>
+#include <pulsecore/namereg.h>
+#include <pulsecore/sink-input.h>
+#include <pulsecore/source-output.h>
+
+#include "algorithm-hook.h"
+#include "module-voice-api.h"
+
+#include "module-meego-test-voice-symdef.h"
+
+PA_MODULE_AUTHOR("Nokia");
+PA_MODULE_DESCRIPTION("Synthetic voice call test for module-meego-voice");
+PA_MODULE_USAGE(
+        "master_sink=<master sink of voice module, its monitor must be the master source> "
+        "voice_sink=<voice sink name> "
+        "voice_source=<voice source name> "
+        "raw_sink=<raw sink name> "
+        "raw_source=<raw source name> "
+        "latency=<requested latency of test streams in usecs> "
+        "duration=<test duration in seconds> "
+        "settle_time=<seconds before measuring starts> "
+        "max_dl_latency=<90th percentile limit in usecs> "
+        "max_ul_latency=<90th percentile limit in usecs> "
+        "max_ear_ref_error=<90th percentile limit in usecs> "
+        "max_cpu_per_frame=<90th percentile limit in usecs> "
+        "exit=<exit daemon with test result, true/false>");
+PA_MODULE_VERSION(PACKAGE_VERSION);
+
+static const char* const valid_modargs[] = {
+    "master_sink",
+    "voice_sink",
+    "voice_source",
+    "raw_sink",
+    "raw_source",
+    "latency",
+    "duration",
+    "settle_time",
+    "max_dl_latency",
+    "max_ul_latency",
+    "max_ear_ref_error",
+    "max_cpu_per_frame",
+    "exit",
+    NULL,
+};
+
+#define BURST_AMPLITUDE (12000)
+#define BURST_THRESHOLD (BURST_AMPLITUDE / 4)
+#define BURST_USEC (2000)
+#define BURST_PERIOD_USEC (400000)
+/* Raw sink bursts are played half a period after voice sink bursts */
+#define BURST_RAW_PHASE_USEC (BURST_PERIOD_USEC / 2)
+/* Detector is armed again after this long below threshold */
+#define QUIET_USEC (20000)
+
+#define EVENT_RING_SIZE (32)
+
+enum {
+    MEASURE_DL_VOICE,
+    MEASURE_DL_RAW,
+    MEASURE_UL_VOICE,
+    MEASURE_UL_RAW,
+    MEASURE_EAR_REF,
+    MEASURE_CPU,
+    MEASURE_MAX
+};
+
+static const char *const measure_names[MEASURE_MAX] = {
+    "voice sink DL latency",
+    "raw sink DL latency",
+    "voice source UL latency",
+    "raw source UL latency",
+    "ear reference alignment error",
+    "CPU time per AEP frame",
+};
+
+/* Values kept per measurement for the percentile, enough for CPU time of
+ * every AEP frame over a minute. Later values only count to avg and max. */
+#define MEASURE_VALUES_MAX (6000)
+#define MEASURE_PERCENTILE (90)
+
+struct measure {
+    unsigned n;
+    pa_usec_t sum;
+    pa_usec_t max;
+    pa_usec_t limit;
+    pa_usec_t values[MEASURE_VALUES_MAX];
+};
+
+/* Burst onsets, written and read from the master IO thread only. */
+struct event_ring {
+    pa_usec_t time[EVENT_RING_SIZE];
+    int sign[EVENT_RING_SIZE];
+    unsigned count;
+};
+
+struct detector {
+    unsigned quiet;
+    unsigned quiet_needed;
+    bool armed;
+};
+
+struct userdata;
+
+struct generator {
+    struct userdata *u;
+    pa_sink_input *sink_input;
+    int sign;
+    uint64_t position;
+    unsigned phase;
+    unsigned period;
+    unsigned burst;
+};
+
+struct observer {
+    struct userdata *u;
+    pa_source_output *source_output;
+    struct detector detector;
+    unsigned reader;
+    int measure;
+};
+
+struct userdata {
+    pa_core *core;
+    pa_module *module;
+
+    pa_usec_t start;
+    pa_usec_t measure_start;
+    pa_time_event *done_event;
+    bool exit;
+
+    struct generator voice_gen;
+    struct generator raw_gen;
+    struct observer monitor;
+    struct observer voice_obs;
+    struct observer raw_obs;
+
+    struct event_ring injected;
+    struct event_ring monitored;
+
+    meego_algorithm_hook_api *algorithm;
+    meego_algorithm_hook_slot *aep_dl_slot;
+    meego_algorithm_hook_slot *aep_ul_slot;
+    meego_algorithm_hook_slot *ear_eq_slot;
+    meego_algorithm_hook_slot *mic_eq_slot;
+    meego_algorithm_hook_slot *xprot_slot;
+
+    /* AEP uplink state, master source IO thread */
+    struct detector mic_detector;
+    struct detector ref_detector;
+    int64_t ul_position;
+    int64_t mic_onset;
+    int64_t ref_onset;
+    unsigned ul_period;
+    struct timespec cpu_last;
+    bool cpu_valid;
+
+    unsigned dl_frames;
+
+    struct measure measure[MEASURE_MAX];
+};
+
+static bool measuring(struct userdata *u, pa_usec_t now) {
+    return now >= u->measure_start;
+}
+
+static void measure_add(struct userdata *u, int m, pa_usec_t value) {
+    struct measure *s = &u->measure[m];
+
+    if (s->n < MEASURE_VALUES_MAX)
+        s->values[s->n] = value;
+    s->n++;
+    s->sum += value;
+    if (value > s->max)
+        s->max = value;
+}
+
+static int usec_compare(const void *a, const void *b) {
+    pa_usec_t x = *(const pa_usec_t *) a, y = *(const pa_usec_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts the kept values, call only once measuring has stopped. */
+static pa_usec_t measure_percentile(struct measure *s, unsigned percentile) {
+    unsigned n = PA_MIN(s->n, (unsigned) MEASURE_VALUES_MAX);
+
+    if (n == 0)
+        return 0;
+
+    qsort(s->values, n, sizeof(s->values[0]), usec_compare);
+
+    return s->values[(n * percentile + 99) / 100 - 1];
+}
+
+static void event_push(struct event_ring *r, pa_usec_t time, int sign) {
+    r->time[r->count % EVENT_RING_SIZE] = time;
+    r->sign[r->count % EVENT_RING_SIZE] = sign;
+    r->count++;
+}
+
+/* Find the next event with sign that is not older than one burst period. */
+static bool event_match(struct event_ring *r, unsigned *reader, int sign, pa_usec_t now, pa_usec_t *time) {
+    unsigned i;
+
+    if (r->count - *reader > EVENT_RING_SIZE)
+        *reader = r->count - EVENT_RING_SIZE;
+
+    while (*reader != r->count) {
+        i = (*reader)++ % EVENT_RING_SIZE;
+
+        if (r->sign[i] == sign && now - r->time[i] < BURST_PERIOD_USEC) {
+            *time = r->time[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void detector_init(struct detector *d, const pa_sample_spec *ss) {
+    d->quiet_needed = (unsigned) (pa_usec_to_bytes(QUIET_USEC, ss) / pa_frame_size(ss));
+    d->quiet = 0;
+    d->armed = false;
+}
+
+/* Returns +1 or -1 on burst onset, 0 otherwise. */
+static int detector_feed(struct detector *d, int16_t v) {
+    if (v < BURST_THRESHOLD && v > -BURST_THRESHOLD) {
+        if (d->quiet < d->quiet_needed && ++d->quiet == d->quiet_needed)
+            d->armed = true;
+        return 0;
+    }
+
+    d->quiet = 0;
+
+    if (!d->armed)
+        return 0;
+
+    d->armed = false;
+
+    return v > 0 ? 1 : -1;
+}
+
+/*** Generators ***/
+
+/* Called from IO thread context */
+static int generator_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
+    struct generator *g;
+    size_t frame_size;
+    unsigned channels, n, k, c, p;
+    pa_usec_t now;
+    int16_t *d;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(g = i->userdata);
+    pa_assert(chunk);
+
+    now = pa_rtclock_now();
+    channels = i->sample_spec.channels;
+    frame_size = pa_frame_size(&i->sample_spec);
+    n = (unsigned) PA_MAX(length / frame_size, (size_t) 1);
+
+    chunk->memblock = pa_memblock_new(g->u->core->mempool, n * frame_size);
+    chunk->index = 0;
+    chunk->length = n * frame_size;
+
+    d = pa_memblock_acquire(chunk->memblock);
+
+    for (k = 0; k < n; k++) {
+        int16_t v;
+
+        p = (unsigned) ((g->position + k + g->phase) % g->period);
+        v = p < g->burst ? (int16_t) (g->sign * BURST_AMPLITUDE) : 0;
+
+        if (p == 0)
+            event_push(&g->u->injected, now, g->sign);
+
+        for (c = 0; c < channels; c++)
+            d[k * channels + c] = v;
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    g->position += n;
+
+    return 0;
+}
+
+/* Called from IO thread context. Signal is generated on the fly, nothing to rewind. */
+static void generator_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
+    pa_sink_input_assert_ref(i);
+}
+
+static void generator_kill_cb(pa_sink_input *i) {
+    struct generator *g;
+
+    pa_sink_input_assert_ref(i);
+    pa_assert_se(g = i->userdata);
+
+    pa_log("Test stream on %s was killed", i->sink->name);
+    pa_module_unload_request(g->u->module, true);
+}
+
+static int generator_init(struct userdata *u, struct generator *g, const char *sink_name,
+                          int sign, pa_usec_t phase, pa_usec_t latency) {
+    pa_sink_input_new_data data;
+    pa_sink *sink;
+    size_t frame_size;
+
+    if (!(sink = pa_namereg_get(u->core, sink_name, PA_NAMEREG_SINK))) {
+        pa_log("Sink %s not found", sink_name);
+        return -1;
+    }
+
+    if (sink->sample_spec.format != PA_SAMPLE_S16NE) {
+        pa_log("Sink %s is not S16NE", sink_name);
+        return -1;
+    }
+
+    frame_size = pa_frame_size(&sink->sample_spec);
+
+    g->u = u;
+    g->sign = sign;
+    g->period = (unsigned) (pa_usec_to_bytes(BURST_PERIOD_USEC, &sink->sample_spec) / frame_size);
+    g->burst = (unsigned) (pa_usec_to_bytes(BURST_USEC, &sink->sample_spec) / frame_size);
+    /* Phase is counted backwards so that the first burst starts after phase */
+    g->phase = g->period - (unsigned) (pa_usec_to_bytes(phase, &sink->sample_spec) / frame_size) % g->period;
+
+    pa_sink_input_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = u->module;
+    data.sink = sink;
+    pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "Voice test signal");
+    pa_sink_input_new_data_set_sample_spec(&data, &sink->sample_spec);
+    pa_sink_input_new_data_set_channel_map(&data, &sink->channel_map);
+
+    pa_sink_input_new(&g->sink_input, u->core, &data);
+    pa_sink_input_new_data_done(&data);
+
+    if (!g->sink_input) {
+        pa_log("Failed to create sink input to %s", sink_name);
+        return -1;
+    }
+
+    g->sink_input->pop = generator_pop_cb;
+    g->sink_input->process_rewind = generator_process_rewind_cb;
+    g->sink_input->kill = generator_kill_cb;
+    g->sink_input->userdata = g;
+
+    pa_sink_input_put(g->sink_input);
+    pa_sink_input_set_requested_latency(g->sink_input, latency);
+
+    return 0;
+}
+
+static void generator_done(struct generator *g) {
+    if (!g->sink_input)
+        return;
+
+    pa_sink_input_unlink(g->sink_input);
+    pa_sink_input_unref(g->sink_input);
+    g->sink_input = NULL;
+}
+
+/*** Observers ***/
+
+/* Called from IO thread context */
+static void observer_onset(struct observer *o, int sign, pa_usec_t now) {
+    struct userdata *u = o->u;
+    pa_usec_t then;
+
+    if (o == &u->monitor) {
+        if (event_match(&u->injected, &o->reader, sign, now, &then) && measuring(u, now))
+            measure_add(u, sign > 0 ? MEASURE_DL_VOICE : MEASURE_DL_RAW, now - then);
+
+        event_push(&u->monitored, now, sign);
+    } else if (event_match(&u->monitored, &o->reader, sign, now, &then) && measuring(u, now))
+        measure_add(u, o->measure, now - then);
+}
+
+/* Called from IO thread context */
+static void observer_push_cb(pa_source_output *so, const pa_memchunk *chunk) {
+    struct observer *o;
+    const int16_t *s;
+    unsigned channels, n, k;
+    pa_usec_t now;
+    int sign;
+
+    pa_source_output_assert_ref(so);
+    pa_assert_se(o = so->userdata);
+    pa_assert(chunk);
+
+    now = pa_rtclock_now();
+    channels = so->sample_spec.channels;
+    n = chunk->length / pa_frame_size(&so->sample_spec);
+
+    s = (const int16_t *) ((const uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+    for (k = 0; k < n; k++)
+        if ((sign = detector_feed(&o->detector, s[k * channels])))
+            observer_onset(o, sign, now);
+
+    pa_memblock_release(chunk->memblock);
+}
+
+static void observer_kill_cb(pa_source_output *so) {
+    struct observer *o;
+
+    pa_source_output_assert_ref(so);
+    pa_assert_se(o = so->userdata);
+
+    pa_log("Test stream on %s was killed", so->source->name);
+    pa_module_unload_request(o->u->module, true);
+}
+
+static int observer_init(struct userdata *u, struct observer *o, pa_source *source,
+                         int measure, pa_usec_t latency) {
+    pa_source_output_new_data data;
+
+    if (source->sample_spec.format != PA_SAMPLE_S16NE) {
+        pa_log("Source %s is not S16NE", source->name);
+        return -1;
+    }
+
+    o->u = u;
+    o->measure = measure;
+    detector_init(&o->detector, &source->sample_spec);
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = u->module;
+    data.source = source;
+    pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "Voice test capture");
+    pa_source_output_new_data_set_sample_spec(&data, &source->sample_spec);
+    pa_source_output_new_data_set_channel_map(&data, &source->channel_map);
+
+    pa_source_output_new(&o->source_output, u->core, &data);
+    pa_source_output_new_data_done(&data);
+
+    if (!o->source_output) {
+        pa_log("Failed to create source output to %s", source->name);
+        return -1;
+    }
+
+    o->source_output->push = observer_push_cb;
+    o->source_output->kill = observer_kill_cb;
+    o->source_output->userdata = o;
+
+    pa_source_output_put(o->source_output);
+    pa_source_output_set_requested_latency(o->source_output, latency);
+
+    return 0;
+}
+
+static int observer_init_by_name(struct userdata *u, struct observer *o, const char *source_name,
+                                 int measure, pa_usec_t latency) {
+    pa_source *source;
+
+    if (!(source = pa_namereg_get(u->core, source_name, PA_NAMEREG_SOURCE))) {
+        pa_log("Source %s not found", source_name);
+        return -1;
+    }
+
+    return observer_init(u, o, source, measure, latency);
+}
+
+static void observer_done(struct observer *o) {
+    if (!o->source_output)
+        return;
+
+    pa_source_output_unlink(o->source_output);
+    pa_source_output_unref(o->source_output);
+    o->source_output = NULL;
+}
+
+/*** Stub algorithms ***/
+
+/* Called from IO thread context */
+static pa_hook_result_t pass_through_cb(pa_core *c, void *call_data, struct userdata *u) {
+    return PA_HOOK_OK;
+}
+
+/* Called from IO thread context */
+static pa_hook_result_t aep_downlink_cb(pa_core *c, aep_downlink *params, struct userdata *u) {
+    pa_assert(params);
+    pa_assert(params->chunk);
+
+    u->dl_frames++;
+
+    return PA_HOOK_OK;
+}
+
+static void scan_onsets(struct detector *d, const pa_memchunk *chunk, int64_t position, int64_t *onset) {
+    const int16_t *s;
+    unsigned n, k;
+
+    n = chunk->length / sizeof(int16_t);
+    s = (const int16_t *) ((const uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+    for (k = 0; k < n; k++)
+        if (detector_feed(d, s[k]) > 0)
+            *onset = position + k;
+
+    pa_memblock_release(chunk->memblock);
+}
+
+/* Called from IO thread context. Mic is passed through as is. */
+static pa_hook_result_t aep_uplink_cb(pa_core *c, aep_uplink *params, struct userdata *u) {
+    struct timespec cpu;
+    pa_usec_t now;
+    int64_t diff;
+
+    pa_assert(params);
+    pa_assert(params->chunk);
+    pa_assert(params->rchunk);
+
+    now = pa_rtclock_now();
+
+    /* Everything from master sink rendering to voice source posting runs
+     * in the master IO thread, so its CPU time per AEP frame is the cost of
+     * the voice call. */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    if (u->cpu_valid && measuring(u, now))
+        measure_add(u, MEASURE_CPU,
+                    (pa_usec_t) ((cpu.tv_sec - u->cpu_last.tv_sec) * PA_USEC_PER_SEC +
+                                 (cpu.tv_nsec - u->cpu_last.tv_nsec) / PA_NSEC_PER_USEC));
+    u->cpu_last = cpu;
+    u->cpu_valid = true;
+
+    scan_onsets(&u->mic_detector, params->chunk, u->ul_position, &u->mic_onset);
+    scan_onsets(&u->ref_detector, params->rchunk, u->ul_position, &u->ref_onset);
+    u->ul_position += params->chunk->length / sizeof(int16_t);
+
+    if (u->mic_onset >= 0 && u->ref_onset >= 0) {
+        diff = u->mic_onset - u->ref_onset;
+
+        if (diff < 0)
+            diff = -diff;
+
+        if (diff < u->ul_period / 2) {
+            if (measuring(u, now))
+                measure_add(u, MEASURE_EAR_REF, (pa_usec_t) diff * PA_USEC_PER_SEC / VOICE_SAMPLE_RATE_AEP_HZ);
+            u->mic_onset = u->ref_onset = -1;
+        } else if (u->mic_onset < u->ref_onset)
+            u->mic_onset = -1;
+        else
+            u->ref_onset = -1;
+    }
+
+    return PA_HOOK_OK;
+}
+
+static meego_algorithm_hook_slot *stub_connect(struct userdata *u, const char *name, pa_hook_cb_t cb) {
+    meego_algorithm_hook_slot *slot;
+
+    if (!(slot = meego_algorithm_hook_connect(u->algorithm, name, PA_HOOK_NORMAL, cb, u))) {
+        pa_log("Hook %s not found, module-meego-voice must be loaded first", name);
+        return NULL;
+    }
+
+    meego_algorithm_hook_slot_set_enabled(slot, true);
+
+    return slot;
+}
+
+static void stub_free(meego_algorithm_hook_slot **slot) {
+    if (*slot) {
+        meego_algorithm_hook_slot_free(*slot);
+        *slot = NULL;
+    }
+}
+
+/*** Results ***/
+
+static void stop_streams(struct userdata *u) {
+    generator_done(&u->voice_gen);
+    generator_done(&u->raw_gen);
+    observer_done(&u->monitor);
+    observer_done(&u->voice_obs);
+    observer_done(&u->raw_obs);
+}
+
+static bool report(struct userdata *u) {
+    unsigned expected, i;
+    bool ok = true;
+
+    /* Allow for bursts cut by the start and end of the measurement */
+    expected = (unsigned) ((pa_rtclock_now() - u->measure_start) / BURST_PERIOD_USEC);
+    expected = expected > 2 ? expected - 2 : 1;
+
+    pa_log_info("%u AEP downlink frames processed", u->dl_frames);
+
+    for (i = 0; i < MEASURE_MAX; i++) {
+        struct measure *s = &u->measure[i];
+        pa_usec_t percentile;
+        bool pass;
+
+        percentile = measure_percentile(s, MEASURE_PERCENTILE);
+        pass = percentile <= s->limit && s->n >= (i == MEASURE_CPU ? 1 : expected);
+
+        pa_log_info("%s %s: %u measurements, avg %llu p%u %llu max %llu usec, limit %llu usec",
+                    pass ? "PASS" : "FAIL", measure_names[i], s->n,
+                    (unsigned long long) (s->n ? s->sum / s->n : 0),
+                    MEASURE_PERCENTILE, (unsigned long long) percentile,
+                    (unsigned long long) s->max,
+                    (unsigned long long) s->limit);
+
+        ok = ok && pass;
+    }
+
+    return ok;
+}
+
+static void done_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *t, void *userdata) {
+    struct userdata *u = userdata;
+    bool ok;
+
+    pa_assert(u);
+
+    u->core->mainloop->time_free(u->done_event);
+    u->done_event = NULL;
+
+    /* Unlinking synchronizes with the IO threads, measurements are stable after this. */
+    stop_streams(u);
+
+    ok = report(u);
+    pa_log_info("Voice test %s", ok ? "passed" : "failed");
+
+    if (u->exit)
+        pa_core_exit(u->core, true, ok ? 0 : 1);
+    else
+        pa_module_unload_request(u->module, true);
+}
+
+int pa__init(pa_module *m) {
+    pa_modargs *ma = NULL;
+    struct userdata *u;
+    const char *master_sink_name;
+    pa_sink *master_sink;
+    uint32_t latency = 10000;
+    uint32_t duration = 10;
+    uint32_t settle_time = 2;
+    uint32_t limit;
+    bool exit_daemon = true;
+    pa_sample_spec aep_spec;
+
+    pa_assert(m);
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments");
+        goto fail;
+    }
+
+    m->userdata = u = pa_xnew0(struct userdata, 1);
+    u->core = m->core;
+    u->module = m;
+    u->mic_onset = u->ref_onset = -1;
+
+    if (pa_modargs_get_value_u32(ma, "latency", &latency) < 0 ||
+        pa_modargs_get_value_u32(ma, "duration", &duration) < 0 || duration < 1 ||
+        pa_modargs_get_value_u32(ma, "settle_time", &settle_time) < 0 ||
+        pa_modargs_get_value_boolean(ma, "exit", &exit_daemon) < 0) {
+        pa_log("Bad test timing arguments");
+        goto fail;
+    }
+
+    limit = 60000;
+    if (pa_modargs_get_value_u32(ma, "max_dl_latency", &limit) < 0)
+        goto fail;
+    u->measure[MEASURE_DL_VOICE].limit = u->measure[MEASURE_DL_RAW].limit = limit;
+
+    limit = 60000;
+    if (pa_modargs_get_value_u32(ma, "max_ul_latency", &limit) < 0)
+        goto fail;
+    u->measure[MEASURE_UL_VOICE].limit = u->measure[MEASURE_UL_RAW].limit = limit;
+
+    limit = 10000;
+    if (pa_modargs_get_value_u32(ma, "max_ear_ref_error", &limit) < 0)
+        goto fail;
+    u->measure[MEASURE_EAR_REF].limit = limit;
+
+    limit = VOICE_PERIOD_AEP_USECS / 2;
+    if (pa_modargs_get_value_u32(ma, "max_cpu_per_frame", &limit) < 0)
+        goto fail;
+    u->measure[MEASURE_CPU].limit = limit;
+
+    u->exit = exit_daemon;
+
+    master_sink_name = pa_modargs_get_value(ma, "master_sink", NULL);
+    if (!(master_sink = pa_namereg_get(m->core, master_sink_name, PA_NAMEREG_SINK))) {
+        pa_log("Master sink %s not found", master_sink_name ? master_sink_name : "(default)");
+        goto fail;
+    }
+
+    aep_spec.format = PA_SAMPLE_S16NE;
+    aep_spec.rate = VOICE_SAMPLE_RATE_AEP_HZ;
+    aep_spec.channels = 1;
+    detector_init(&u->mic_detector, &aep_spec);
+    detector_init(&u->ref_detector, &aep_spec);
+    u->ul_period = (unsigned) (pa_usec_to_bytes(BURST_PERIOD_USEC, &aep_spec) / pa_frame_size(&aep_spec));
+
+    u->algorithm = meego_algorithm_hook_api_get(m->core);
+
+    if (!(u->aep_dl_slot = stub_connect(u, VOICE_HOOK_AEP_DOWNLINK, (pa_hook_cb_t) aep_downlink_cb)) ||
+        !(u->aep_ul_slot = stub_connect(u, VOICE_HOOK_AEP_UPLINK, (pa_hook_cb_t) aep_uplink_cb)) ||
+        !(u->ear_eq_slot = stub_connect(u, VOICE_HOOK_NARROWBAND_EAR_EQU_MONO, (pa_hook_cb_t) pass_through_cb)) ||
+        !(u->mic_eq_slot = stub_connect(u, VOICE_HOOK_NARROWBAND_MIC_EQ_MONO, (pa_hook_cb_t) pass_through_cb)) ||
+        !(u->xprot_slot = stub_connect(u, VOICE_HOOK_XPROT_MONO, (pa_hook_cb_t) pass_through_cb)))
+        goto fail;
+
+    u->start = pa_rtclock_now();
+    u->measure_start = u->start + settle_time * PA_USEC_PER_SEC;
+
+    /* Capture first, so that no onsets are missed */
+    if (observer_init(u, &u->monitor, master_sink->monitor_source, MEASURE_MAX, latency) < 0 ||
+        observer_init_by_name(u, &u->voice_obs, pa_modargs_get_value(ma, "voice_source", "source.voice"),
+                              MEASURE_UL_VOICE, latency) < 0 ||
+        observer_init_by_name(u, &u->raw_obs, pa_modargs_get_value(ma, "raw_source", "source.voice.raw"),
+                              MEASURE_UL_RAW, latency) < 0)
+        goto fail;
+
+    if (generator_init(u, &u->voice_gen, pa_modargs_get_value(ma, "voice_sink", "sink.voice"),
+                       1, 0, latency) < 0 ||
+        generator_init(u, &u->raw_gen, pa_modargs_get_value(ma, "raw_sink", "sink.voice.raw"),
+                       -1, BURST_RAW_PHASE_USEC, latency) < 0)
+        goto fail;
+
+    u->done_event = pa_core_rttime_new(m->core, u->measure_start + duration * PA_USEC_PER_SEC, done_cb, u);
+
+    pa_log_info("Voice test running for %u seconds after %u seconds settle time", duration, settle_time);
+
+    pa_modargs_free(ma);
+
+    return 0;
+
+fail:
+    if (ma)
+        pa_modargs_free(ma);
+
+    pa__done(m);
+
+    return -1;
+}
+
+void pa__done(pa_module *m) {
+    struct userdata *u;
+
+    pa_assert(m);
+
+    if (!(u = m->userdata))
+        return;
+
+    if (u->done_event)
+        u->core->mainloop->time_free(u->done_event);
+
+    stop_streams(u);
+
+    stub_free(&u->aep_dl_slot);
+    stub_free(&u->aep_ul_slot);
+    stub_free(&u->ear_eq_slot);
+    stub_free(&u->mic_eq_slot);
+    stub_free(&u->xprot_slot);
+
+    if (u->algorithm)
+        meego_algorithm_hook_api_unref(u->algorithm);
+
+    pa_xfree(u);
+    m->userdata = NULL;
+}
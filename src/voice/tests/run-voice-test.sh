@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# Runs voice-test.pa in a private pulseaudio daemon. The daemon exit status
+# is the test result. Skipped if pulseaudio is not installed.
+
+PULSEAUDIO=${PULSEAUDIO:-$(command -v pulseaudio)}
+
+if [ -z "$PULSEAUDIO" ]; then
+    echo "pulseaudio not found, skipping voice test"
+    exit 77
+fi
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+HOME=$tmp XDG_RUNTIME_DIR=$tmp XDG_CONFIG_HOME=$tmp PULSE_RUNTIME_PATH=$tmp PULSE_STATE_PATH=$tmp \
+timeout 60 "$PULSEAUDIO" -n --daemonize=no --use-pid-file=no --system=no \
+    --exit-idle-time=-1 --realtime=no --high-priority=no --disable-shm=yes \
+    --log-target=stderr --log-level=info \
+    --dl-search-path="$VOICE_TEST_MODULE_PATH" \
+    -F "${srcdir:-.}/voice-test.pa"
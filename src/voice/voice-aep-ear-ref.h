@@ -85,7 +85,7 @@ void voice_aep_ear_ref_unload(struct userdata *u) {
 static inline
 int voice_aep_ear_ref_check_dl_xrun(struct userdata *u) {
     struct voice_aep_ear_ref *r = &u->ear_ref;
-    bool underrun;
+    bool underrun = false;
 
     if (u->master_sink) {
         PA_MSGOBJECT(u->master_sink)->process_msg(
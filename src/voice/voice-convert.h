@@ -23,6 +23,7 @@
 #define voice_aep_convert_h
 
 #include "module-voice-userdata.h"
+#include "pa-optimized.h"
 
 /* TODO: Move init and free calls to pa__init and pa__done. The src wrappers should be
          moved to common */
@@ -31,9 +32,15 @@ static inline
 int voice_convert_init(struct userdata *u) {
     pa_assert(u);
 
+#ifdef X86
+    u->hw_source_to_aep_resampler = alloc_src_48_to_8_stereo();
+
+    u->hw_source_to_aep_amb_resampler = alloc_src_48_to_8_stereo();
+#else
     u->hw_source_to_aep_resampler = alloc_src_48_to_8();
 
     u->hw_source_to_aep_amb_resampler = alloc_src_48_to_8();
+#endif
 
     u->aep_to_hw_sink_resampler = alloc_src_8_to_48();
 
@@ -50,9 +57,15 @@ static inline
 int voice_convert_free(struct userdata *u) {
     pa_assert(u);
 
+#ifdef X86
+    free_src_48_to_8_stereo(u->hw_source_to_aep_resampler);
+
+    free_src_48_to_8_stereo(u->hw_source_to_aep_amb_resampler);
+#else
     free_src_48_to_8(u->hw_source_to_aep_resampler);
 
     free_src_48_to_8(u->hw_source_to_aep_amb_resampler);
+#endif
 
     free_src_8_to_48(u->aep_to_hw_sink_resampler);
 
@@ -128,6 +141,165 @@ int voice_convert_run_48_stereo_to_8(struct userdata *u, src_48_to_8 *s, const p
     return 0;
 }
 
+#ifdef X86
+
+/* Resample 48kHz stereo mic input to 8kHz mono mic (and ambient) stream
+ * according to active mic channel in one pass. amb_ochunk is reset if the
+ * mode has no ambient channel. */
+static inline
+int voice_convert_run_48_stereo_to_8_mic(struct userdata *u, call_mic_ch_t mode, const pa_memchunk *ichunk,
+                                         pa_memchunk *mic_ochunk, pa_memchunk *amb_ochunk) {
+    pa_assert(u);
+    pa_assert(mic_ochunk);
+    pa_assert(amb_ochunk);
+    pa_assert(ichunk);
+    pa_assert(ichunk->memblock);
+    int input_frames = ichunk->length/(2*sizeof(short));
+    int output_frames = output_frames_src_48_to_8_total(input_frames);
+    short *amb_output = NULL;
+    bool split = (mode == MIC_CH0_AMB_CH1 || mode == MIC_CH1_AMB_CH0);
+
+    pa_assert(output_frames > 0);
+
+    mic_ochunk->length = output_frames*sizeof(short);
+    mic_ochunk->memblock = pa_memblock_new(u->core->mempool, mic_ochunk->length);
+    mic_ochunk->index = 0;
+    short *mic_output = pa_memblock_acquire(mic_ochunk->memblock);
+
+    pa_memchunk_reset(amb_ochunk);
+    if (split) {
+        amb_ochunk->length = mic_ochunk->length;
+        amb_ochunk->memblock = pa_memblock_new(u->core->mempool, amb_ochunk->length);
+        amb_output = pa_memblock_acquire(amb_ochunk->memblock);
+    }
+
+    short *input = (short *)pa_memblock_acquire(ichunk->memblock) + ichunk->index/sizeof(short);
+    int i = 0;
+    int o = 0;
+    while (i < input_frames) {
+        int iframes = input_frames - i;
+        if (iframes > SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES)
+            iframes = SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES;
+        switch (mode) {
+            case MIC_BOTH:
+                process_src_48_to_8_stereo_select(u->hw_source_to_aep_resampler, mic_output + o, input + 2*i, iframes,
+                                                  SRC_48_TO_8_STEREO_DOWNMIX);
+                break;
+            case MIC_CH0:
+                process_src_48_to_8_stereo_select(u->hw_source_to_aep_resampler, mic_output + o, input + 2*i, iframes,
+                                                  SRC_48_TO_8_STEREO_CH0);
+                break;
+            case MIC_CH1:
+                process_src_48_to_8_stereo_select(u->hw_source_to_aep_resampler, mic_output + o, input + 2*i, iframes,
+                                                  SRC_48_TO_8_STEREO_CH1);
+                break;
+            case MIC_CH0_AMB_CH1:
+            case MIC_CH1_AMB_CH0:
+                process_src_48_to_8_stereo_split(u->hw_source_to_aep_resampler, u->hw_source_to_aep_amb_resampler,
+                                                 mic_output + o, amb_output + o, input + 2*i, iframes,
+                                                 mode == MIC_CH1_AMB_CH0);
+                break;
+        }
+        i += iframes;
+        o = output_frames_src_48_to_8_total(i);
+    }
+    pa_memblock_release(ichunk->memblock);
+    if (split)
+        pa_memblock_release(amb_ochunk->memblock);
+    pa_memblock_release(mic_ochunk->memblock);
+
+    return 0;
+}
+
+/* Resample 48kHz mono to 8kHz with a mic resampler. */
+static inline
+int voice_convert_run_48_to_8_mono(struct userdata *u, voice_mic_resampler *s, const pa_memchunk *ichunk,
+                                   pa_memchunk *ochunk) {
+    pa_assert(u);
+    pa_assert(ochunk);
+    pa_assert(ichunk);
+    pa_assert(ichunk->memblock);
+    int input_frames = ichunk->length/sizeof(short);
+    int output_frames = output_frames_src_48_to_8_total(input_frames);
+    pa_assert(output_frames > 0);
+
+    ochunk->length = output_frames*sizeof(short);
+    ochunk->memblock = pa_memblock_new(u->core->mempool, ochunk->length);
+    ochunk->index = 0;
+    short *output = pa_memblock_acquire(ochunk->memblock);
+    short *input = (short *)pa_memblock_acquire(ichunk->memblock) + ichunk->index/sizeof(short);
+    int i = 0;
+    int o = 0;
+    while (i < input_frames) {
+        int iframes = input_frames - i;
+        if (iframes > SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES)
+            iframes = SRC_48_TO_8_STEREO_MAX_INPUT_FRAMES;
+        process_src_48_to_8_stereo_mono(s, output + o, input + i, iframes);
+        i += iframes;
+        o = output_frames_src_48_to_8_total(i);
+    }
+    pa_memblock_release(ochunk->memblock);
+    pa_memblock_release(ichunk->memblock);
+
+    return 0;
+}
+
+#else /* X86 */
+
+/* On ARM the mic channel is separated first and resampled with the NEON
+ * resampler, which is faster than the portable one pass C filter even with
+ * the 48kHz mono intermediate. */
+static inline
+int voice_convert_run_48_stereo_to_8_mic(struct userdata *u, call_mic_ch_t mode, const pa_memchunk *ichunk,
+                                         pa_memchunk *mic_ochunk, pa_memchunk *amb_ochunk) {
+    pa_memchunk mic_chunk, amb_chunk;
+
+    pa_assert(u);
+    pa_assert(mic_ochunk);
+    pa_assert(amb_ochunk);
+    pa_assert(ichunk);
+
+    pa_memchunk_reset(amb_ochunk);
+
+    switch (mode) {
+        case MIC_BOTH:
+            pa_optimized_downmix_to_mono(ichunk, &mic_chunk);
+            break;
+        case MIC_CH0:
+            pa_optimized_take_channel(ichunk, &mic_chunk, 0);
+            break;
+        case MIC_CH1:
+            pa_optimized_take_channel(ichunk, &mic_chunk, 1);
+            break;
+        case MIC_CH0_AMB_CH1:
+            pa_optimized_deinterleave_stereo_to_mono(ichunk, &mic_chunk, &amb_chunk);
+            break;
+        case MIC_CH1_AMB_CH0:
+            pa_optimized_deinterleave_stereo_to_mono(ichunk, &amb_chunk, &mic_chunk);
+            break;
+        default:
+            pa_assert_not_reached();
+    }
+
+    voice_convert_run_48_to_8(u, u->hw_source_to_aep_resampler, &mic_chunk, mic_ochunk);
+    pa_memblock_unref(mic_chunk.memblock);
+
+    if (mode == MIC_CH0_AMB_CH1 || mode == MIC_CH1_AMB_CH0) {
+        voice_convert_run_48_to_8(u, u->hw_source_to_aep_amb_resampler, &amb_chunk, amb_ochunk);
+        pa_memblock_unref(amb_chunk.memblock);
+    }
+
+    return 0;
+}
+
+static inline
+int voice_convert_run_48_to_8_mono(struct userdata *u, voice_mic_resampler *s, const pa_memchunk *ichunk,
+                                   pa_memchunk *ochunk) {
+    return voice_convert_run_48_to_8(u, s, ichunk, ochunk);
+}
+
+#endif /* X86 */
+
 static inline
 int voice_convert_run_8_to_48(struct userdata *u, src_8_to_48 *s, const pa_memchunk *ichunk, pa_memchunk *ochunk) {
     pa_assert(u);
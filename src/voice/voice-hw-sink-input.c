@@ -52,18 +52,25 @@
 #include "optimized.h"
 #include "memory.h"
 #include "voice-voip-source.h"
+#include "voice-sidetone.h"
 
 #include "module-voice-api.h"
 #include "voice-hooks.h"
 
 static unsigned int voice_dl_sideinfo_pop(struct userdata *u, int length) {
-    unsigned int spc_flags = 0;
+    uint32_t spc_flags = 0;
 
     pa_assert(u);
     pa_assert(length % u->aep_fragment_size == 0);
 
+    /* Without a client there is nothing to pop and nothing to count as
+     * underflow. */
     while (length) {
-        spc_flags = PA_PTR_TO_UINT(pa_queue_pop(u->dl_sideinfo_queue));
+        if (u->dl_sideinfo_ring_attached) {
+            if (!voice_sideinfo_ring_pop(u->dl_sideinfo_ring, &spc_flags))
+                spc_flags = 0;
+        } else if (u->dl_sideinfo_queue_attached)
+            spc_flags = PA_PTR_TO_UINT(pa_queue_pop(u->dl_sideinfo_queue));
         length -= u->aep_fragment_size;
     }
 
@@ -106,6 +113,82 @@ static void voice_aep_sink_process(struct userdata *u, pa_memchunk *chunk) {
     }
 }
 
+/* Called from IO thread context. Channels are S16 again on return, per-channel
+ * slots of the hook may process the channels in parallel. */
+static void voice_hw_sink_fire_process(struct userdata *u, meego_algorithm_hook_data *hook_data) {
+    meego_algorithm_hook_format format = MEEGO_ALGORITHM_HOOK_FORMAT_S16;
+    pa_memchunk converted;
+    unsigned i;
+
+    meego_algorithm_hook_fire_data(u->hooks[HOOK_HW_SINK_PROCESS], hook_data, &format);
+
+    if (format == MEEGO_ALGORITHM_HOOK_FORMAT_S16)
+        return;
+
+    for (i = 0; i < hook_data->channels; i++) {
+        pa_optimized_float_to_s16(&hook_data->channel[i], &converted);
+        pa_memblock_unref(hook_data->channel[i].memblock);
+        hook_data->channel[i] = converted;
+    }
+}
+
+/* Called from IO thread context. */
+static void voice_hw_sink_process_fragment(struct userdata *u, pa_memchunk *chunk) {
+    meego_algorithm_hook_data hook_data;
+    const short *src_bufs[2];
+    short *dst;
+
+    pa_memchunk_reset(&hook_data.channel[0]);
+    pa_memchunk_reset(&hook_data.channel[1]);
+    hook_data.channels = 2;
+
+    pa_optimized_deinterleave_stereo_to_mono(chunk, &hook_data.channel[0], &hook_data.channel[1]);
+
+    voice_hw_sink_fire_process(u, &hook_data);
+
+    /* interleave */
+    dst = pa_memblock_acquire(chunk->memblock);
+    dst += chunk->index / sizeof(short);
+
+    src_bufs[0] = pa_memblock_acquire(hook_data.channel[0].memblock);
+    src_bufs[1] = pa_memblock_acquire(hook_data.channel[1].memblock);
+    interleave_mono_to_stereo(src_bufs, dst, hook_data.channel[0].length / sizeof(short));
+    pa_memblock_release(chunk->memblock);
+    pa_memblock_release(hook_data.channel[0].memblock);
+    pa_memblock_release(hook_data.channel[1].memblock);
+    pa_memblock_unref(hook_data.channel[0].memblock);
+    pa_memblock_unref(hook_data.channel[1].memblock);
+}
+
+/* Called from IO thread context. */
+static void voice_hw_sink_process(struct userdata *u, pa_memchunk *chunk) {
+    pa_memchunk fragment;
+    size_t offset;
+
+    pa_assert(u);
+    pa_assert(chunk);
+
+    if (!meego_algorithm_hook_enabled(u->hooks[HOOK_HW_SINK_PROCESS]))
+        return;
+
+    pa_memchunk_make_writable(chunk, 0);
+
+    /* Without batching the chunk is processed as is. With batching, slots that
+     * haven't declared multi-fragment support get one hw fragment at a time. */
+    if (u->raw_batch_size <= u->hw_fragment_size ||
+        meego_algorithm_hook_multi_fragment(u->hooks[HOOK_HW_SINK_PROCESS])) {
+        voice_hw_sink_process_fragment(u, chunk);
+        return;
+    }
+
+    for (offset = 0; offset < chunk->length; offset += u->hw_fragment_size) {
+        fragment = *chunk;
+        fragment.index += offset;
+        fragment.length = PA_MIN(u->hw_fragment_size, chunk->length - offset);
+        voice_hw_sink_process_fragment(u, &fragment);
+    }
+}
+
 /*** sink_input callbacks ***/
 static int hw_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
     struct userdata *u;
@@ -133,6 +216,13 @@ static int hw_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *ch
     else if (length % u->hw_fragment_size)
         length += u->hw_fragment_size - (length % u->hw_fragment_size);
 
+    /* In media only operation render raw_batch_size at once, master sink
+     * latency has been raised to match (see
+     * voice_hw_sink_input_update_requested_latency()). Calls stay at one AEP
+     * fragment per pop. */
+    if (length < u->raw_batch_size && voice_raw_batch_enabled(u, i->sink))
+        length = u->raw_batch_size;
+
     if (u->aep_sink_input && PA_SINK_INPUT_IS_LINKED(
             u->aep_sink_input->thread_info.state)) {
         aep_volume = u->aep_sink_input->thread_info.muted ?
@@ -211,7 +301,7 @@ static int hw_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *ch
 
                 pa_optimized_deinterleave_stereo_to_mono(chunk, &hook_data.channel[0], &hook_data.channel[1]);
 
-                meego_algorithm_hook_fire(u->hooks[HOOK_HW_SINK_PROCESS], &hook_data);
+                voice_hw_sink_fire_process(u, &hook_data);
 
                 /* interleave */
                 dst = pa_memblock_acquire(chunk->memblock);
@@ -245,33 +335,7 @@ static int hw_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *ch
         *chunk = rawchunk;
         pa_memchunk_reset(&rawchunk);
 
-        if (meego_algorithm_hook_enabled(u->hooks[HOOK_HW_SINK_PROCESS])) {
-            const short *src_bufs[2];
-            short *dst;
-
-            pa_memchunk_reset(&hook_data.channel[0]);
-            pa_memchunk_reset(&hook_data.channel[1]);
-            hook_data.channels = 2;
-
-            pa_memchunk_make_writable(chunk, 0);
-
-            pa_optimized_deinterleave_stereo_to_mono(chunk, &hook_data.channel[0], &hook_data.channel[1]);
-
-            meego_algorithm_hook_fire(u->hooks[HOOK_HW_SINK_PROCESS], &hook_data);
-
-            /* interleave */
-            dst = pa_memblock_acquire(chunk->memblock);
-            dst += chunk->index / sizeof(short);
-
-            src_bufs[0] = pa_memblock_acquire(hook_data.channel[0].memblock);
-            src_bufs[1] = pa_memblock_acquire(hook_data.channel[1].memblock);
-            interleave_mono_to_stereo(src_bufs, dst, hook_data.channel[0].length / sizeof(short));
-            pa_memblock_release(chunk->memblock);
-            pa_memblock_release(hook_data.channel[0].memblock);
-            pa_memblock_release(hook_data.channel[1].memblock);
-            pa_memblock_unref(hook_data.channel[0].memblock);
-            pa_memblock_unref(hook_data.channel[1].memblock);
-        }
+        voice_hw_sink_process(u, chunk);
 
     } else {
         pa_silence_memchunk_get(&u->core->silence_cache,
@@ -311,6 +375,10 @@ static int hw_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *ch
         pa_memblock_unref(earref.memblock);
     }
 
+    /* Sidetone is mixed in after the ear reference is taken, AEP must not
+     * see the near end speech as echo. */
+    voice_sidetone_dl(u, chunk);
+
 #ifdef SINK_TIMING_DEBUG_ON
     pa_rtclock_get(&tv_new);
     pa_usec_t process_delay = pa_timeval_diff(&tv_last, &tv_new);
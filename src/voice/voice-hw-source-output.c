@@ -24,6 +24,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/namereg.h>
 #include <pulse/rtclock.h>
 
@@ -32,6 +34,7 @@
 #include "voice-aep-ear-ref.h"
 #include "voice-util.h"
 #include "voice-voip-source.h"
+#include "voice-sidetone.h"
 #include "pa-optimized.h"
 #include "optimized.h"
 #include "voice-convert.h"
@@ -40,35 +43,79 @@
 #include "module-voice-api.h"
 #include "voice-hooks.h"
 
+/* Pick a block for the next UL frame from ul_frame_pool. Blocks referenced
+ * only by the pool are free, if source outputs still hold all of them the
+ * oldest one is replaced with a new block. */
+static void voice_ul_frame_next(struct userdata *u) {
+    unsigned i, j;
+
+    for (i = 0; i < VOICE_UL_FRAME_POOL_SIZE; i++) {
+        j = (u->ul_frame_pool_next + i) % VOICE_UL_FRAME_POOL_SIZE;
+        if (pa_memblock_ref_is_one(u->ul_frame_pool[j]))
+            break;
+    }
+
+    if (i == VOICE_UL_FRAME_POOL_SIZE) {
+        j = u->ul_frame_pool_next;
+        pa_memblock_unref(u->ul_frame_pool[j]);
+        u->ul_frame_pool[j] = pa_memblock_new(u->core->mempool, u->voice_ul_fragment_size);
+    }
+
+    u->ul_frame.memblock = u->ul_frame_pool[j];
+    u->ul_frame.index = 0;
+    u->ul_frame.length = 0;
+    u->ul_frame_pool_next = (j + 1) % VOICE_UL_FRAME_POOL_SIZE;
+}
+
 static bool voice_uplink_feed(struct userdata *u, pa_memchunk *chunk) {
+    bool frame_sent = false;
     pa_memchunk ichunk;
+    size_t offset = 0;
+    char *d, *s;
+
     pa_assert(u);
     pa_assert(u->aep_fragment_size == chunk->length);
 
-    if (pa_memblockq_push(u->ul_memblockq, chunk) < 0) {
-        pa_log("%s %d: Failed to push %zu byte chunk into memblockq (len %zu).",
-               __FILE__, __LINE__, chunk->length,
-               pa_memblockq_get_length(u->ul_memblockq));
-    }
-
-    if (util_memblockq_to_chunk(u->core->mempool, u->ul_memblockq, &ichunk, u->voice_ul_fragment_size)) {
-        if (pa_memblockq_get_length(u->ul_memblockq) != 0)
-            pa_log("%s %d: AEP processed UL left over %zu", __FILE__, __LINE__,
-                   pa_memblockq_get_length(u->ul_memblockq));
-
+    /* AEP fragment is a whole UL frame, post it as is. */
+    if (u->aep_fragment_size == u->voice_ul_fragment_size && u->ul_frame.length == 0) {
         if (PA_SOURCE_IS_OPENED(u->voip_source->thread_info.state))
-            pa_source_post(u->voip_source, &ichunk);
-        pa_memblock_unref(ichunk.memblock);
+            pa_source_post(u->voip_source, chunk);
         return true;
     }
-    else
-        return false;
+
+    /* Otherwise collect fragments to ul_frame and post it when full. */
+    while (offset < chunk->length) {
+        size_t len = PA_MIN(chunk->length - offset, u->voice_ul_fragment_size - u->ul_frame.length);
+
+        /* Posted frame may still be referenced by source outputs. */
+        if (u->ul_frame.length == 0 && !pa_memblock_ref_is_one(u->ul_frame.memblock))
+            voice_ul_frame_next(u);
+
+        d = pa_memblock_acquire(u->ul_frame.memblock);
+        s = pa_memblock_acquire(chunk->memblock);
+        memcpy(d + u->ul_frame.length, s + chunk->index + offset, len);
+        pa_memblock_release(chunk->memblock);
+        pa_memblock_release(u->ul_frame.memblock);
+
+        u->ul_frame.length += len;
+        offset += len;
+
+        if (u->ul_frame.length == u->voice_ul_fragment_size) {
+            ichunk = u->ul_frame;
+            if (PA_SOURCE_IS_OPENED(u->voip_source->thread_info.state))
+                pa_source_post(u->voip_source, &ichunk);
+            u->ul_frame.length = 0;
+            frame_sent = true;
+        }
+    }
+
+    return frame_sent;
 }
 
 static inline
 int voice_aep_ear_ref_check_ul_xrun(struct userdata *u) {
     struct voice_aep_ear_ref *r = &u->ear_ref;
-    bool overrun;
+    bool overrun = false;
 
     if (u->master_source) {
         PA_MSGOBJECT(u->master_source)->process_msg(
@@ -253,9 +300,9 @@ void voice_uplink_timing_check(struct userdata *u, pa_usec_t now,
     if ((int)to_deadline < VOICE_PERIOD_MASTER_USECS + u->ul_timing_advance) {
         if (!ul_frame_sent) {
             // Flush all that we have from buffers, so we should be in time on next round
-            size_t drop = pa_memblockq_get_length(u->ul_memblockq);
-            pa_memblockq_drop(u->ul_memblockq, drop);
-            pa_log_debug("Dropped %zu bytes (%" PRIu64 " usec) from ul_memblockq", drop,
+            size_t drop = u->ul_frame.length;
+            u->ul_frame.length = 0;
+            pa_log_debug("Dropped %zu bytes (%" PRIu64 " usec) from ul_frame", drop,
                          pa_bytes_to_usec_round_up((uint64_t)drop, &u->aep_sample_spec));
             drop = pa_memblockq_get_length(u->hw_source_memblockq);
             pa_memblockq_drop(u->hw_source_memblockq, drop);
@@ -299,12 +346,16 @@ static void hw_source_output_push_cb(pa_source_output *o, const pa_memchunk *new
         return;
     }
 
+    /* Sidetone takes the mic signal as it arrives, not per AEP fragment. */
+    if (voice_voip_source_active_iothread(u))
+        voice_sidetone_ul(u, new_chunk);
+
     while (util_memblockq_to_chunk(u->core->mempool, u->hw_source_memblockq, &chunk, u->aep_hw_fragment_size)) {
 
         if (voice_voip_source_active_iothread(u)) {
             /* This branch is taken when call is active */
             pa_memchunk mic_chunk, mic_chunk8k;
-            pa_memchunk amb_chunk = { 0, 0, 0 }, amb_chunk8k;
+            pa_memchunk amb_chunk8k = { 0, 0, 0 };
 
             switch (u->active_mic_channel) {
             default:
@@ -312,45 +363,57 @@ static void hw_source_output_push_cb(pa_source_output *o, const pa_memchunk *new
                 pa_assert_not_reached();
 
             case MIC_BOTH:
-                pa_optimized_downmix_to_mono(&chunk, &mic_chunk);
-                break;
-
             case MIC_CH0:
-                pa_optimized_take_channel(&chunk, &mic_chunk, 0);
-                break;
-
             case MIC_CH1:
-                pa_optimized_take_channel(&chunk, &mic_chunk, 1);
-                break;
-
             case MIC_CH0_AMB_CH1:
-                pa_optimized_deinterleave_stereo_to_mono(&chunk, &mic_chunk, &amb_chunk);
-                break;
-
             case MIC_CH1_AMB_CH0:
-                pa_optimized_deinterleave_stereo_to_mono(&chunk, &amb_chunk, &mic_chunk);
                 break;
-
             }
 
-            hook_data.channels = 1;
-            hook_data.channel[0] = mic_chunk;
+            if (meego_algorithm_hook_enabled(u->hooks[HOOK_RMC_MONO])) {
+                /* RMC used only with ECI headsets that have one mic, it
+                 * needs the 48kHz mono mic signal before resampling. */
+                switch (u->active_mic_channel) {
+                case MIC_BOTH:
+                    pa_optimized_downmix_to_mono(&chunk, &mic_chunk);
+                    break;
+
+                case MIC_CH0:
+                case MIC_CH0_AMB_CH1:
+                    pa_optimized_take_channel(&chunk, &mic_chunk, 0);
+                    break;
+
+                case MIC_CH1:
+                case MIC_CH1_AMB_CH0:
+                    pa_optimized_take_channel(&chunk, &mic_chunk, 1);
+                    break;
+                }
+
+                hook_data.channels = 1;
+                hook_data.channel[0] = mic_chunk;
+                meego_algorithm_hook_fire(u->hooks[HOOK_RMC_MONO], &hook_data);
+                mic_chunk = hook_data.channel[0];
 
-            /* RMC used only with ECI headsets that have one mic */
-            meego_algorithm_hook_fire(u->hooks[HOOK_RMC_MONO], &hook_data);
-            mic_chunk = hook_data.channel[0];
+                voice_convert_run_48_to_8_mono(u, u->hw_source_to_aep_resampler, &mic_chunk, &mic_chunk8k);
+                pa_memblock_unref(mic_chunk.memblock);
 
-            voice_convert_run_48_to_8(u, u->hw_source_to_aep_resampler, &mic_chunk, &mic_chunk8k);
-            pa_memblock_unref(mic_chunk.memblock);
+                if (u->active_mic_channel == MIC_CH0_AMB_CH1 || u->active_mic_channel == MIC_CH1_AMB_CH0) {
+                    pa_memchunk amb_chunk;
 
+                    pa_optimized_take_channel(&chunk, &amb_chunk, u->active_mic_channel == MIC_CH0_AMB_CH1 ? 1 : 0);
+                    voice_convert_run_48_to_8_mono(u, u->hw_source_to_aep_amb_resampler, &amb_chunk, &amb_chunk8k);
+                    pa_memblock_unref(amb_chunk.memblock);
+                }
+            } else
+                /* Channel selection and resampling in one pass */
+                voice_convert_run_48_stereo_to_8_mic(u, u->active_mic_channel, &chunk, &mic_chunk8k, &amb_chunk8k);
+
+            hook_data.channels = 1;
             hook_data.channel[0] = mic_chunk8k;
             meego_algorithm_hook_fire(u->hooks[HOOK_NARROWBAND_MIC_EQ_MONO], &hook_data);
             mic_chunk8k = hook_data.channel[0];
 
-            if (amb_chunk.memblock) {
-                voice_convert_run_48_to_8(u, u->hw_source_to_aep_amb_resampler, &amb_chunk, &amb_chunk8k);
-                pa_memblock_unref(amb_chunk.memblock);
-
+            if (amb_chunk8k.memblock) {
                 /* TODO: We should run the ambient reference trough EQ too,
                          but we'd need a separate (or a multi channel) hook for that.
                 hook_data.channel[0] = &something;
@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/volume.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/source.h>
+
+#include "module-voice-userdata.h"
+#include "voice-sidetone.h"
+
+#define SIDETONE_RING_FRAMES (4096) /* must be power of two, ~85ms at 48kHz */
+#define SIDETONE_MAX_STEPS (64)
+#define SIDETONE_STAMPS (64) /* must be power of two, more pushes than fit in the ring */
+/* Latency statistics are logged every this many measurements */
+#define SIDETONE_REPORT_INTERVAL (2000)
+
+struct voice_sidetone {
+    int n_steps;
+    int gain[SIDETONE_MAX_STEPS];       /* mB */
+    int volume[SIDETONE_MAX_STEPS];     /* mB, ascending */
+
+    pa_atomic_t gain_q15;
+
+    pa_usec_t latency_budget;
+    /* Frames left in the ring after a pop, older frames are skipped. */
+    unsigned hold_frames;
+
+    /* Mono ring, indices are free running frame counts. Producer is the
+     * master source IO thread, consumer the master sink IO thread. */
+    pa_atomic_t write_index;
+    pa_atomic_t read_index;
+    pa_atomic_t overflow_frames;
+    int16_t ring[SIDETONE_RING_FRAMES];
+
+    /* Capture time of the first frame of each push, written before
+     * write_index is advanced. Stamps are numbered by push count. */
+    struct {
+        pa_atomic_t index;              /* ring index of the first frame */
+        pa_atomic_t time;               /* low 32 bits of pa_rtclock_now() */
+    } stamps[SIDETONE_STAMPS];
+    unsigned n_pushes;                  /* producer only */
+    pa_atomic_t stamp_writing;          /* number of the stamp being written */
+    pa_atomic_t stamp_written;          /* number of the newest complete stamp */
+
+    /* Consumer side only */
+    unsigned n_measured;
+    unsigned n_over_budget;
+    pa_usec_t latency_sum;
+    pa_usec_t latency_max;
+    unsigned total_measured;
+    unsigned total_over_budget;
+    pa_usec_t total_latency_max;
+    uint64_t skipped_frames;
+};
+
+static int parse_steps(voice_sidetone *st, const char *steps) {
+    const char *state = NULL;
+    char *pair, *colon;
+    int n = 0;
+
+    while ((pair = pa_split(steps, ",", &state))) {
+        if (n == SIDETONE_MAX_STEPS || !(colon = strchr(pair, ':')))
+            goto fail;
+
+        *colon = '\0';
+
+        if (pa_atoi(pair, &st->gain[n]) < 0 || pa_atoi(colon + 1, &st->volume[n]) < 0)
+            goto fail;
+
+        if (n > 0 && st->volume[n] < st->volume[n - 1])
+            goto fail;
+
+        pa_xfree(pair);
+        n++;
+    }
+
+    st->n_steps = n;
+
+    return n > 0 ? 0 : -1;
+
+fail:
+    pa_xfree(pair);
+    return -1;
+}
+
+/* Same step selection as module-meego-sidetone uses for the HW control. */
+static int gain_for_volume(voice_sidetone *st, int volume_mb) {
+    int i;
+
+    for (i = 0; i < st->n_steps && st->volume[i] < volume_mb; i++)
+        ;
+
+    if (i == st->n_steps)
+        i = st->n_steps - 1;
+
+    /* If we're in between steps, choose the closer one. With equal distances, choose the higher step. */
+    if (i > 0 && (st->volume[i] - volume_mb > volume_mb - st->volume[i - 1]))
+        i--;
+
+    return st->gain[i];
+}
+
+static inline int16_t mix_s16(int16_t a, int b) {
+    int s = a + b;
+
+    return (int16_t) PA_CLAMP_UNLIKELY(s, INT16_MIN, INT16_MAX);
+}
+
+static void account_latency(voice_sidetone *st, pa_usec_t latency) {
+    st->n_measured++;
+    st->latency_sum += latency;
+
+    if (latency > st->latency_max)
+        st->latency_max = latency;
+
+    if (latency > st->latency_budget)
+        st->n_over_budget++;
+
+    if (st->n_measured < SIDETONE_REPORT_INTERVAL)
+        return;
+
+    if (st->n_over_budget > 0)
+        pa_log_info("Sidetone latency avg %llu max %llu usec, %u of %u over %llu usec budget",
+                    (unsigned long long) (st->latency_sum / st->n_measured),
+                    (unsigned long long) st->latency_max,
+                    st->n_over_budget, st->n_measured,
+                    (unsigned long long) st->latency_budget);
+    else
+        pa_log_debug("Sidetone latency avg %llu max %llu usec",
+                     (unsigned long long) (st->latency_sum / st->n_measured),
+                     (unsigned long long) st->latency_max);
+
+    st->total_measured += st->n_measured;
+    st->total_over_budget += st->n_over_budget;
+    if (st->latency_max > st->total_latency_max)
+        st->total_latency_max = st->latency_max;
+
+    st->n_measured = 0;
+    st->n_over_budget = 0;
+    st->latency_sum = 0;
+    st->latency_max = 0;
+}
+
+int voice_sidetone_init(struct userdata *u, const char *steps, pa_usec_t latency_budget) {
+    voice_sidetone *st;
+
+    pa_assert(u);
+    pa_assert(!u->sidetone);
+
+    if (!steps)
+        return 0;
+
+    st = pa_xnew0(voice_sidetone, 1);
+
+    if (parse_steps(st, steps) < 0) {
+        pa_log("Failed to parse sidetone steps: %s", steps);
+        pa_xfree(st);
+        return -1;
+    }
+
+    st->latency_budget = latency_budget;
+    st->hold_frames = pa_usec_to_bytes(latency_budget / 2, &u->hw_mono_sample_spec) /
+        pa_frame_size(&u->hw_mono_sample_spec);
+    pa_atomic_store(&st->gain_q15, 0);
+
+    pa_log_info("Software sidetone enabled with %d steps, latency budget %llu usec",
+                st->n_steps, (unsigned long long) latency_budget);
+
+    u->sidetone = st;
+
+    return 0;
+}
+
+void voice_sidetone_unload(struct userdata *u) {
+    voice_sidetone *st;
+
+    pa_assert(u);
+
+    if (!(st = u->sidetone))
+        return;
+
+    st->total_measured += st->n_measured;
+    st->total_over_budget += st->n_over_budget;
+    if (st->latency_max > st->total_latency_max)
+        st->total_latency_max = st->latency_max;
+
+    pa_log_info("Sidetone latency max %llu usec, %u of %u over %llu usec budget, "
+                "%llu frames skipped, %d frames dropped on overflow",
+                (unsigned long long) st->total_latency_max,
+                st->total_over_budget, st->total_measured,
+                (unsigned long long) st->latency_budget,
+                (unsigned long long) st->skipped_frames,
+                pa_atomic_load(&st->overflow_frames));
+
+    pa_xfree(st);
+    u->sidetone = NULL;
+}
+
+void voice_sidetone_volume_changed(struct userdata *u, const pa_cvolume *volume) {
+    voice_sidetone *st;
+    pa_volume_t avg;
+    double linear;
+    int gain_mb;
+    int q15 = 0;
+
+    pa_assert(u);
+    pa_assert(volume);
+
+    if (!(st = u->sidetone))
+        return;
+
+    avg = pa_cvolume_avg(volume);
+
+    if (avg != PA_VOLUME_MUTED) {
+        gain_mb = gain_for_volume(st, (int) (pa_sw_volume_to_dB(avg) * 100));
+        linear = pa_sw_volume_to_linear(pa_sw_volume_from_dB(gain_mb / 100.0));
+        q15 = (int) PA_MIN(linear * INT16_MAX + 0.5, (double) INT16_MAX);
+        pa_log_debug("Sidetone gain %d mB (q15 %d)", gain_mb, q15);
+    }
+
+    pa_atomic_store(&st->gain_q15, q15);
+}
+
+/* Called from master source IO thread context. Stamps the push of chunk to
+ * ring index w with the capture time of its first frame, which is the source
+ * latency and the duration of the chunk ago. */
+static void stamp_push(struct userdata *u, voice_sidetone *st, const pa_memchunk *chunk, unsigned w) {
+    int64_t source_latency;
+    pa_usec_t captured;
+    unsigned i;
+
+#if PULSEAUDIO_VERSION >= 11
+    source_latency = pa_source_get_latency_within_thread(u->hw_source_output->source, false);
+#else
+    source_latency = (int64_t) pa_source_get_latency_within_thread(u->hw_source_output->source);
+#endif
+    captured = pa_rtclock_now() - pa_bytes_to_usec(chunk->length, &u->hw_sample_spec) -
+        (pa_usec_t) PA_MAX(source_latency, 0);
+
+    i = st->n_pushes++;
+    pa_atomic_store(&st->stamp_writing, (int) i);
+    pa_atomic_store(&st->stamps[i & (SIDETONE_STAMPS - 1)].index, (int) w);
+    pa_atomic_store(&st->stamps[i & (SIDETONE_STAMPS - 1)].time, (int) (uint32_t) captured);
+    pa_atomic_store(&st->stamp_written, (int) i);
+}
+
+/* Called from master sink IO thread context. Looks up the capture time of
+ * the frame at ring index r, returns false if its stamp was overwritten. */
+static bool capture_time(struct userdata *u, voice_sidetone *st, unsigned r, uint32_t *time) {
+    unsigned i, last, index;
+    uint32_t t;
+
+    last = (unsigned) pa_atomic_load(&st->stamp_written);
+
+    for (i = last; last - i < SIDETONE_STAMPS; i--) {
+        index = (unsigned) pa_atomic_load(&st->stamps[i & (SIDETONE_STAMPS - 1)].index);
+        t = (uint32_t) pa_atomic_load(&st->stamps[i & (SIDETONE_STAMPS - 1)].time);
+
+        /* The slot of stamp i is reused by stamp i + SIDETONE_STAMPS. If
+         * that one has been started, what was read may be torn. */
+        if ((unsigned) pa_atomic_load(&st->stamp_writing) - i >= SIDETONE_STAMPS)
+            return false;
+
+        /* Free running indices, first stamp at or before r */
+        if ((int) (r - index) >= 0) {
+            *time = t + (uint32_t) pa_bytes_to_usec((uint64_t) (r - index) * pa_frame_size(&u->hw_mono_sample_spec),
+                                                    &u->hw_mono_sample_spec);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void voice_sidetone_ul(struct userdata *u, const pa_memchunk *chunk) {
+    voice_sidetone *st;
+    const int16_t *src;
+    unsigned w, r, n, space, k;
+    int channel;
+
+    pa_assert(u);
+    pa_assert(chunk);
+
+    if (!(st = u->sidetone) || pa_atomic_load(&st->gain_q15) == 0)
+        return;
+
+    n = chunk->length / pa_frame_size(&u->hw_sample_spec);
+
+    w = (unsigned) pa_atomic_load(&st->write_index);
+    r = (unsigned) pa_atomic_load(&st->read_index);
+    space = SIDETONE_RING_FRAMES - (w - r);
+
+    /* Consumer is not keeping up, e.g. master sink is suspended. */
+    if (n > space) {
+        pa_atomic_add(&st->overflow_frames, n - space);
+        n = space;
+    }
+
+    if (n == 0)
+        return;
+
+    switch (u->active_mic_channel) {
+    case MIC_BOTH:
+        channel = -1;
+        break;
+    case MIC_CH0:
+    case MIC_CH0_AMB_CH1:
+        channel = 0;
+        break;
+    default:
+        channel = 1;
+        break;
+    }
+
+    src = (const int16_t *) ((const uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+    if (channel < 0) {
+        for (k = 0; k < n; k++)
+            st->ring[(w + k) & (SIDETONE_RING_FRAMES - 1)] = (int16_t) ((src[2 * k] + src[2 * k + 1]) >> 1);
+    } else {
+        for (k = 0; k < n; k++)
+            st->ring[(w + k) & (SIDETONE_RING_FRAMES - 1)] = src[2 * k + channel];
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    stamp_push(u, st, chunk, w);
+    /* pa_atomic_store() is a full barrier, ring contents are visible before index. */
+    pa_atomic_store(&st->write_index, (int) (w + n));
+}
+
+void voice_sidetone_dl(struct userdata *u, pa_memchunk *chunk) {
+    voice_sidetone *st;
+    int16_t *dst;
+    unsigned w, r, avail, n, count, skip, k;
+    uint32_t captured;
+    bool measured;
+    pa_usec_t latency = 0;
+    int64_t sink_latency;
+    int gain;
+
+    pa_assert(u);
+    pa_assert(chunk);
+
+    if (!(st = u->sidetone))
+        return;
+
+    w = (unsigned) pa_atomic_load(&st->write_index);
+    r = (unsigned) pa_atomic_load(&st->read_index);
+
+    if (!(avail = w - r))
+        return;
+
+    if ((gain = pa_atomic_load(&st->gain_q15)) == 0) {
+        pa_atomic_store(&st->read_index, (int) w);
+        return;
+    }
+
+    n = chunk->length / pa_frame_size(&u->hw_sample_spec);
+
+    /* Keep the ring shallow, anything older than needed for this pop and
+     * hold_frames would only add latency. */
+    if (avail > n + st->hold_frames) {
+        skip = avail - n - st->hold_frames;
+        r += skip;
+        avail -= skip;
+        st->skipped_frames += skip;
+    }
+
+    count = PA_MIN(avail, n);
+
+    /* From capture of the oldest frame mixed now until it is played out.
+     * On underrun it goes n - count frames into chunk. */
+    if ((measured = capture_time(u, st, r, &captured))) {
+#if PULSEAUDIO_VERSION >= 11
+        sink_latency = pa_sink_get_latency_within_thread(u->hw_sink_input->sink, false);
+#else
+        sink_latency = (int64_t) pa_sink_get_latency_within_thread(u->hw_sink_input->sink);
+#endif
+        latency = (uint32_t) ((uint32_t) pa_rtclock_now() - captured) + (pa_usec_t) PA_MAX(sink_latency, 0) +
+            pa_bytes_to_usec((uint64_t) (n - count) * pa_frame_size(&u->hw_sample_spec), &u->hw_sample_spec);
+    }
+
+    pa_memchunk_make_writable(chunk, 0);
+    dst = (int16_t *) ((uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+
+    /* On underrun the frames go to the end of chunk, so that they continue
+     * without a gap to what the next pop mixes. */
+    dst += 2 * (n - count);
+
+    for (k = 0; k < count; k++) {
+        int s = (st->ring[(r + k) & (SIDETONE_RING_FRAMES - 1)] * gain) >> 15;
+
+        dst[2 * k] = mix_s16(dst[2 * k], s);
+        dst[2 * k + 1] = mix_s16(dst[2 * k + 1], s);
+    }
+
+    pa_memblock_release(chunk->memblock);
+
+    pa_atomic_store(&st->read_index, (int) (r + count));
+
+    if (measured)
+        account_latency(st, latency);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef voice_sidetone_h
+#define voice_sidetone_h
+
+#include "module-voice-userdata.h"
+
+/* Software sidetone for devices without a HW sidetone path (see
+ * module-meego-sidetone for the HW one). During a call the 48kHz mic
+ * signal is copied to a single producer single consumer ring straight
+ * from the master source push and mixed to the master sink input output
+ * when it is popped, without waiting for AEP fragments to fill up.
+ *
+ * steps has the syntax of module-meego-sidetone mainvolume argument,
+ * "gain:volume,gain:volume,...", where volume is the master sink volume
+ * and gain the sidetone gain for that step, both in millibels.
+ *
+ * The latency from capture of the oldest frame mixed to its playback is
+ * measured on every pop, from the source latency stamped on each push and
+ * the sink latency, and compared against latency_budget. */
+
+#define VOICE_SIDETONE_LATENCY_BUDGET_USEC (5000)
+
+/* Called from main context. Does nothing and returns 0 if steps is NULL. */
+int voice_sidetone_init(struct userdata *u, const char *steps, pa_usec_t latency_budget);
+void voice_sidetone_unload(struct userdata *u);
+
+/* Called from main context */
+void voice_sidetone_volume_changed(struct userdata *u, const pa_cvolume *volume);
+
+/* Called from master source IO thread context */
+void voice_sidetone_ul(struct userdata *u, const pa_memchunk *chunk);
+
+/* Called from master sink IO thread context. chunk is stereo hw_sample_spec. */
+void voice_sidetone_dl(struct userdata *u, pa_memchunk *chunk);
+
+#endif // voice_sidetone_h
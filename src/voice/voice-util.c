@@ -29,6 +29,7 @@
 #include "module-voice-userdata.h"
 #include "voice-util.h"
 #include "voice-aep-ear-ref.h"
+#include "voice-sidetone.h"
 #include "voice-convert.h"
 #include "proplist-meego.h"
 #include "proplist-nemo.h"
@@ -41,6 +42,8 @@
 
 /*** Deallocate stuff ***/
 void voice_clear_up(struct userdata *u) {
+    unsigned i;
+
     pa_assert(u);
 
     if (u->mainloop_handler) {
@@ -97,9 +100,20 @@ void voice_clear_up(struct userdata *u) {
         u->hw_source_memblockq = NULL;
     }
 
-    if (u->ul_memblockq) {
-        pa_memblockq_free(u->ul_memblockq);
-        u->ul_memblockq = NULL;
+    for (i = 0; i < VOICE_UL_FRAME_POOL_SIZE; i++) {
+        if (u->ul_frame_pool[i]) {
+            pa_memblock_unref(u->ul_frame_pool[i]);
+            u->ul_frame_pool[i] = NULL;
+        }
+    }
+    pa_memchunk_reset(&u->ul_frame);
+
+    if (u->dl_sideinfo_ring) {
+        pa_log_debug("DL side info ring overflows %d underflows %d",
+                     pa_atomic_load(&u->dl_sideinfo_ring->overflow_count),
+                     pa_atomic_load(&u->dl_sideinfo_ring->underflow_count));
+        pa_xfree(u->dl_sideinfo_ring);
+        u->dl_sideinfo_ring = NULL;
     }
 
     if (u->dl_sideinfo_queue) {
@@ -109,6 +123,8 @@ void voice_clear_up(struct userdata *u) {
 
     voice_aep_ear_ref_unload(u);
 
+    voice_sidetone_unload(u);
+
     if (u->aep_silence_memchunk.memblock) {
         pa_memblock_unref(u->aep_silence_memchunk.memblock);
         pa_memchunk_reset(&u->aep_silence_memchunk);
@@ -143,34 +159,54 @@ void voice_clear_up(struct userdata *u) {
     voice_memchunk_pool_unload(u);
 }
 
-static voice_memchunk_pool *voice_memchunk_pool_table = NULL;
-void voice_memchunk_pool_load(struct userdata *u) {
-    int i;
-
-    pa_assert(0 == offsetof(voice_memchunk_pool, chunk));
-    pa_atomic_ptr_store(&u->memchunk_pool, NULL);
+void voice_memchunk_pool_load(struct userdata *u, unsigned size) {
+    voice_memchunk_pool *p;
+    unsigned i;
 
-    voice_memchunk_pool_table = pa_xmalloc0(sizeof(voice_memchunk_pool)*VOICE_MEMCHUNK_POOL_SIZE);
-    pa_assert(voice_memchunk_pool_table);
-
-    for (i = 0; i<VOICE_MEMCHUNK_POOL_SIZE; i++)
-        voice_memchunk_pool_free(u, (pa_memchunk *)&voice_memchunk_pool_table[i]);
+    pa_assert(u);
+    pa_assert(size > 0 && size <= VOICE_MEMCHUNK_POOL_SIZE_MAX);
+    pa_assert(0 == offsetof(voice_memchunk_pool_entry, chunk));
+
+    p = &u->memchunk_pool;
+    p->table = pa_xnew0(voice_memchunk_pool_entry, size);
+    p->size = size;
+    p->low_water = size / 8;
+    pa_atomic_store(&p->head, 0);
+    pa_atomic_store(&p->in_use, size);
+    pa_atomic_store(&p->in_use_max, 0);
+    pa_atomic_store(&p->exhausted, 0);
+    pa_atomic_store(&p->low_water_hit, 0);
+    pa_atomic_store(&p->low_water_active, 0);
+
+    for (i = 0; i < size; i++)
+        voice_memchunk_pool_free(u, &p->table[i].chunk);
 }
 
 void voice_memchunk_pool_unload(struct userdata *u) {
-    int i = 0;
+    voice_memchunk_pool *p;
+    unsigned i = 0;
+
+    pa_assert(u);
+
+    p = &u->memchunk_pool;
 
-    if (voice_memchunk_pool_table == NULL)
+    if (p->table == NULL)
         return;
 
-    while (voice_memchunk_pool_get(u)) i++;
+    pa_log_debug("voice_memchunk_pool max %d of %u slots in use, exhausted %d times, low water hit %d times",
+                 pa_atomic_load(&p->in_use_max), p->size,
+                 pa_atomic_load(&p->exhausted), pa_atomic_load(&p->low_water_hit));
+
+    /* Empty pool without touching the statistics */
+    p->low_water = 0;
+    while (i < p->size && voice_memchunk_pool_get(u)) i++;
 
-    if (i < VOICE_MEMCHUNK_POOL_SIZE)
-        pa_log("voice_memchunk_pool only %d element of %d allocated was retured to pool",
-               i, VOICE_MEMCHUNK_POOL_SIZE);
+    if (i < p->size)
+        pa_log("voice_memchunk_pool only %u element of %u allocated was retured to pool",
+               i, p->size);
 
-    pa_xfree(voice_memchunk_pool_table);
-    voice_memchunk_pool_table = NULL;
+    pa_xfree(p->table);
+    p->table = NULL;
 }
 
 /* Generic source state change logic. Used by raw_source and voice_source. */
@@ -239,7 +275,7 @@ int voice_sink_set_state(pa_sink *s, pa_sink *other, pa_sink_state_t state) {
     if (om_sink == NULL) {
         pa_log_info("No master sink, assuming primary mixer tuning.\n");
         pa_atomic_store(&u->mixer_state, PROP_MIXER_TUNING_PRI);
-        pa_shared_data_sets(u->shared, PA_NEMO_PROP_CALL_STATE, PA_NEMO_PROP_CALL_STATE_INACTIVE);
+        pa_shared_data_key_sets(u->call_state_key, PA_NEMO_PROP_CALL_STATE_INACTIVE);
     }
     else if (voice_voip_sink_active(u)) {
         if (pa_atomic_load(&u->mixer_state) == PROP_MIXER_TUNING_PRI) {
@@ -248,7 +284,7 @@ int voice_sink_set_state(pa_sink *s, pa_sink *other, pa_sink_state_t state) {
              pa_proplist_sets(p, PROP_MIXER_TUNING_MODE, PROP_MIXER_TUNING_ALT_S);
              pa_sink_update_proplist(om_sink, PA_UPDATE_REPLACE, p);
              pa_atomic_store(&u->mixer_state, PROP_MIXER_TUNING_ALT);
-             pa_shared_data_sets(u->shared, PA_NEMO_PROP_CALL_STATE, PA_NEMO_PROP_CALL_STATE_ACTIVE);
+             pa_shared_data_key_sets(u->call_state_key, PA_NEMO_PROP_CALL_STATE_ACTIVE);
              pa_proplist_free(p);
 
              meego_algorithm_hook_fire(u->hooks[HOOK_CALL_BEGIN], s);
@@ -261,7 +297,7 @@ int voice_sink_set_state(pa_sink *s, pa_sink *other, pa_sink_state_t state) {
             pa_proplist_sets(p, PROP_MIXER_TUNING_MODE, PROP_MIXER_TUNING_PRI_S);
             pa_sink_update_proplist(om_sink, PA_UPDATE_REPLACE, p);
             pa_atomic_store(&u->mixer_state, PROP_MIXER_TUNING_PRI);
-            pa_shared_data_sets(u->shared, PA_NEMO_PROP_CALL_STATE, PA_NEMO_PROP_CALL_STATE_INACTIVE);
+            pa_shared_data_key_sets(u->call_state_key, PA_NEMO_PROP_CALL_STATE_INACTIVE);
             pa_proplist_free(p);
 
             meego_algorithm_hook_fire(u->hooks[HOOK_CALL_END], s);
@@ -313,6 +349,41 @@ pa_usec_t voice_sink_get_requested_latency(pa_sink *s, pa_sink *other) {
     return latency;
 }
 
+/* Used by raw_sink and voip_sink to hand their requested latency over to the
+ * master sink. When not in a call and raw batching is configured the request
+ * is raised to two batches, so that master sink wakes up about once per batch
+ * instead of the batch just making the render queue deeper. Called from I/O
+ * thread. */
+void voice_hw_sink_input_update_requested_latency(struct userdata *u, pa_usec_t latency) {
+    pa_assert(u);
+    pa_assert(u->hw_sink_input);
+
+    if (u->raw_batch_size > u->hw_fragment_size &&
+        !(u->voip_sink && pa_hashmap_size(u->voip_sink->thread_info.inputs) > 0) &&
+        (latency == (pa_usec_t) -1 || latency < 2 * u->raw_batch_usec))
+        latency = 2 * u->raw_batch_usec;
+
+    pa_sink_input_set_requested_latency_within_thread(u->hw_sink_input, latency);
+}
+
+/* Raw batches are rendered only when not in a call and only if master sink
+ * latency is long enough to hold two of them. Called from I/O thread. */
+bool voice_raw_batch_enabled(struct userdata *u, pa_sink *master) {
+    pa_usec_t latency;
+
+    pa_assert(u);
+    pa_assert(master);
+
+    if (u->raw_batch_size <= u->hw_fragment_size || voice_voip_sink_active_iothread(u))
+        return false;
+
+    latency = pa_sink_get_requested_latency_within_thread(master);
+    if (latency == (pa_usec_t) -1)
+        latency = master->thread_info.max_latency;
+
+    return latency >= 2 * u->raw_batch_usec;
+}
+
 void voice_sink_inputs_may_move(pa_sink *s, bool move) {
     pa_sink_input *i;
     uint32_t idx;
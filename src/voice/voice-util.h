@@ -34,35 +34,71 @@
 #define VOICE_TIMEVAL_IS_VALID(TVal) ((bool) ((TVal)->tv_usec >= 0))
 
 #define VOICE_MEMCHUNK_POOL_SIZE 128
-typedef struct voice_memchunk_pool {
-    pa_memchunk chunk;
-    pa_atomic_ptr_t next;
-} voice_memchunk_pool;
+#define VOICE_MEMCHUNK_POOL_SIZE_MAX 0xffff
 
-void voice_memchunk_pool_load(struct userdata *u);
+#define VOICE_MEMCHUNK_POOL_INDEX(head) ((unsigned) (head) & 0xffff)
+#define VOICE_MEMCHUNK_POOL_HEAD(old_head, index) \
+    ((int) (((((unsigned) (old_head) >> 16) + 1) << 16) | (index)))
+
+void voice_memchunk_pool_load(struct userdata *u, unsigned size);
 void voice_memchunk_pool_unload(struct userdata *u);
 
+static inline
+void voice_memchunk_pool_update_stats(voice_memchunk_pool *p, int in_use) {
+    int max;
+
+    while (in_use > (max = pa_atomic_load(&p->in_use_max)))
+        if (pa_atomic_cmpxchg(&p->in_use_max, max, in_use))
+            break;
+
+    if (p->size - in_use < p->low_water) {
+        if (pa_atomic_cmpxchg(&p->low_water_active, 0, 1)) {
+            pa_atomic_inc(&p->low_water_hit);
+            pa_log_warn("voice_memchunk_pool low, %d of %u slots in use", in_use, p->size);
+        }
+    } else if (pa_atomic_load(&p->low_water_active))
+        pa_atomic_store(&p->low_water_active, 0);
+}
+
 static inline
 pa_memchunk *voice_memchunk_pool_get(struct userdata *u) {
-    voice_memchunk_pool *mp;
+    voice_memchunk_pool *p = &u->memchunk_pool;
+    voice_memchunk_pool_entry *e;
+    unsigned index;
+    int head;
+
     do {
-        mp = (voice_memchunk_pool *) pa_atomic_ptr_load(&u->memchunk_pool);
-    } while (mp != NULL &&
-             !pa_atomic_ptr_cmpxchg(&u->memchunk_pool, mp, pa_atomic_ptr_load(&mp->next)));
-    if (mp != NULL)
-        return &mp->chunk;
-    pa_log_warn("voice_memchunk_pool empty, all %d slots allocated", VOICE_MEMCHUNK_POOL_SIZE);
-    return NULL;
+        head = pa_atomic_load(&p->head);
+        if ((index = VOICE_MEMCHUNK_POOL_INDEX(head)) == 0) {
+            if (pa_atomic_inc(&p->exhausted) == 0)
+                pa_log_warn("voice_memchunk_pool empty, all %u slots allocated", p->size);
+            return NULL;
+        }
+        e = &p->table[index - 1];
+    } while (!pa_atomic_cmpxchg(&p->head, head,
+                                VOICE_MEMCHUNK_POOL_HEAD(head, (unsigned) pa_atomic_load(&e->next))));
+
+    voice_memchunk_pool_update_stats(p, pa_atomic_inc(&p->in_use) + 1);
+
+    return &e->chunk;
 }
 
 static inline
 void voice_memchunk_pool_free(struct userdata *u, pa_memchunk *chunk) {
-    voice_memchunk_pool *mp, *mp_new = (voice_memchunk_pool *)chunk;
+    voice_memchunk_pool *p = &u->memchunk_pool;
+    voice_memchunk_pool_entry *e = (voice_memchunk_pool_entry *) chunk;
+    unsigned index = e - p->table + 1;
+    int head;
+
+    pa_assert_fp(index >= 1 && index <= p->size);
+
     pa_memchunk_reset(chunk);
     do {
-        mp = (voice_memchunk_pool *) pa_atomic_ptr_load(&u->memchunk_pool);
-        pa_atomic_ptr_store(&mp_new->next, mp);
-    } while (!pa_atomic_ptr_cmpxchg(&u->memchunk_pool, mp, mp_new));
+        head = pa_atomic_load(&p->head);
+        pa_atomic_store(&e->next, VOICE_MEMCHUNK_POOL_INDEX(head));
+    } while (!pa_atomic_cmpxchg(&p->head, head, VOICE_MEMCHUNK_POOL_HEAD(head, index)));
+
+    pa_atomic_dec(&p->in_use);
 }
 
 void voice_clear_up(struct userdata *u);
@@ -75,6 +111,10 @@ pa_usec_t voice_source_get_requested_latency(pa_source *s, pa_source *other);
 
 pa_usec_t voice_sink_get_requested_latency(pa_sink *s, pa_sink *other);
 
+void voice_hw_sink_input_update_requested_latency(struct userdata *u, pa_usec_t latency);
+
+bool voice_raw_batch_enabled(struct userdata *u, pa_sink *master);
+
 void voice_sink_inputs_may_move(pa_sink *s, bool move);
 void voice_source_outputs_may_move(pa_source *s, bool move);
 
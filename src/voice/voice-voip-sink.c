@@ -40,11 +40,37 @@ static int voip_sink_process_msg(pa_msgobject *o, int code, void *data, int64_t
             if (!u->dl_sideinfo_queue) {
                 pa_log_warn("Side info queue not set");
             }
+            pa_log_warn("Side info queue is deprecated, client should use side info ring");
+            u->dl_sideinfo_queue_attached = !!u->dl_sideinfo_queue;
             *((pa_queue **) data) = u->dl_sideinfo_queue;
             pa_log_debug("Side info queue (%p) passed to client", (void *) u->dl_sideinfo_queue);
             return 0;
         }
 
+        case VOICE_SINK_GET_SIDE_INFO_RING_PTR: {
+            /* The ring has a single producer, a second client would
+             * corrupt it. */
+            if (u->dl_sideinfo_ring_attached) {
+                pa_log_error("Side info ring already has a client");
+                *((voice_sideinfo_ring **) data) = NULL;
+                return -1;
+            }
+            if (!u->dl_sideinfo_ring) {
+                pa_log_warn("Side info ring not set");
+            }
+            u->dl_sideinfo_ring_attached = !!u->dl_sideinfo_ring;
+            *((voice_sideinfo_ring **) data) = u->dl_sideinfo_ring;
+            pa_log_debug("Side info ring (%p) passed to client", (void *) u->dl_sideinfo_ring);
+            return 0;
+        }
+
+        case VOICE_SINK_RELEASE_SIDE_INFO: {
+            u->dl_sideinfo_ring_attached = false;
+            u->dl_sideinfo_queue_attached = false;
+            pa_log_debug("Side info client released");
+            return 0;
+        }
+
         case PA_SINK_MESSAGE_GET_LATENCY: {
             pa_usec_t usec = 0;
 
@@ -136,9 +162,7 @@ static void voip_sink_update_requested_latency(pa_sink *s) {
     }
 
     /* Just hand this one over to the master sink */
-    pa_sink_input_set_requested_latency_within_thread(
-        u->hw_sink_input,
-        voice_sink_get_requested_latency(s, u->raw_sink));
+    voice_hw_sink_input_update_requested_latency(u, voice_sink_get_requested_latency(s, u->raw_sink));
 }
 
 int voice_init_voip_sink(struct userdata *u, const char *name) {
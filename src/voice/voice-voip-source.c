@@ -49,7 +49,7 @@ static int voip_source_process_msg(pa_msgobject *o, int code, void *data, int64_
                     PA_MSGOBJECT(u->master_source), PA_SOURCE_MESSAGE_GET_LATENCY, &usec, 0, NULL) < 0)
                 usec = 0;
 
-            usec += pa_bytes_to_usec(pa_memblockq_get_length(u->ul_memblockq),
+            usec += pa_bytes_to_usec(u->ul_frame.length,
                                      &u->aep_sample_spec);
             *((pa_usec_t*) data) = usec;
             return 0;